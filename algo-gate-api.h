@@ -4,6 +4,7 @@
 #include "miner.h"
 #include "avxdefs.h"
 #include "interleave.h"
+#include "scratch.h"
 
 /////////////////////////////
 ////
@@ -141,6 +142,10 @@ void ( *resync_threads )         ( struct work* );
 bool ( *do_this_thread )         ( int );
 json_t* (*longpoll_rpc_call)     ( CURL*, int*, char* );
 bool ( *stratum_handle_response )( json_t* );
+// optional, only algos with ASIC support override these
+bool ( *asic_thread_init )       ( int );
+void ( *asic_hash )              ( void*, const void* );
+void ( *asic_hash_4way )         ( void*, const void* );  // NULL if none
 set_t optimizations;
 int  ntime_index;
 int  nbits_index;
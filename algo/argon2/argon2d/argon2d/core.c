@@ -33,6 +33,7 @@
 #include "thread.h"
 #include "../blake2/blake2.h"
 #include "../blake2/blake2-impl.h"
+#include "scratch.h"
 
 #ifdef GENKAT
 #include "genkat.h"
@@ -83,6 +84,12 @@ static void store_block(void *output, const block *src) {
 
 /***************Memory functions*****************/
 
+/* Without callbacks the memory is the calling thread's scratchpad, kept
+ * from one hash to the next and only grown, rather than a new allocation
+ * for every hash. */
+static __thread uint8_t *thread_memory = NULL;
+static __thread size_t thread_memory_size = 0;
+
 int allocate_memory(const argon2_context *context, uint8_t **memory,
                     size_t num, size_t size) {
     size_t memory_size = num*size;
@@ -99,7 +106,12 @@ int allocate_memory(const argon2_context *context, uint8_t **memory,
     if (context->allocate_cbk) {
         (context->allocate_cbk)(memory, memory_size);
     } else {
-        *memory = malloc(memory_size);
+        if (thread_memory_size < memory_size) {
+            scratch_free(thread_memory);
+            thread_memory = scratch_alloc(memory_size);
+            thread_memory_size = thread_memory ? memory_size : 0;
+        }
+        *memory = thread_memory;
     }
 
     if (*memory == NULL) {
@@ -115,8 +127,6 @@ void free_memory(const argon2_context *context, uint8_t *memory,
     clear_internal_memory(memory, memory_size);
     if (context->free_cbk) {
         (context->free_cbk)(memory, memory_size);
-    } else {
-        free(memory);
     }
 }
 
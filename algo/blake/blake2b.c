@@ -120,8 +120,8 @@ void blake2b_be_build_stratum_request( char *req, struct work *work )
    uint16_t high_nonce = swab32(work->data[9]) >> 16;
    xnonce2str = abin2hex((unsigned char*)(&high_nonce), 2);
    snprintf( req, JSON_BUF_LEN,
-        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr );
+        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
+         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr, work->submit_id );
    free( xnonce2str );
 }
 
@@ -66,8 +66,8 @@ void decred_be_build_stratum_request( char *req, struct work *work,
    xnonce2str = abin2hex( (char*)( &work->data[ DECRED_XNONCE_INDEX ] ),
                                      sctx->xnonce1_size );
    snprintf( req, JSON_BUF_LEN,
-        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr );
+        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
+         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr, work->submit_id );
    free(xnonce2str);
 }
 #define min(a,b) (a>b ? (b) :(a))
@@ -145,7 +145,6 @@ static algo_cn ALGO = 0;
 static bool SOFT_AES = true;
 static bool PREFETCH = true;
 static size_t MEM;
-static cryptonight_ctx _ALIGN(256) g_stCtx;
 
 
 void do_blake_hash(const void* input, size_t len, char* output) {
@@ -695,28 +694,28 @@ typedef uint64_t GetOptimalSqrtType_t;
 	}
 
 #define CN_INIT(n, monero_const, l0, ax0, bx0, idx0, ptr0, bx1, sqrt_result, division_result_xmm) \
-	keccak((const uint8_t *)input + len * n, len, ctx->hash_state, 200); \
-	uint64_t monero_const; \
+	keccak((const uint8_t *)input + len * n, len, ctx[n]->hash_state, 200); \
+	uint64_t monero_const = 0; \
 	if(ALGO == cryptonight_monero || ALGO == cryptonight_aeon || ALGO == cryptonight_ipbc || ALGO == cryptonight_stellite || ALGO == cryptonight_masari || ALGO == cryptonight_bittube2) \
 	{ \
 		/* monero_const =  *reinterpret_cast<const uint64_t*>(reinterpret_cast<const uint8_t*>(input) + len * n + 35); */\
 		/* monero_const ^=  *(reinterpret_cast<const uint64_t*>(ctx[n]->hash_state) + 24); */ \
-		monero_const = *((const uint64_t*) (((const uint8_t*)input) + 35)) ^ *((const uint64_t*)(ctx->hash_state + 24)); \
+		monero_const = *((const uint64_t*) (((const uint8_t*)input) + len * n + 35)) ^ *((const uint64_t*)(ctx[n]->hash_state + 24)); \
 	} \
 	/* Optim - 99% time boundary */ \
-	cn_explode_scratchpad((__m128i*)ctx->hash_state, (__m128i*)ctx->long_state); \
+	cn_explode_scratchpad((__m128i*)ctx[n]->hash_state, (__m128i*)ctx[n]->long_state); \
 	\
 	__m128i ax0; \
 	uint64_t idx0; \
 	__m128i bx0; \
-	uint8_t* l0 = ctx->long_state; \
-	/* BEGIN cryptonight_monero_v8 variables */ \
-	__m128i bx1; \
-	__m128i division_result_xmm; \
-	GetOptimalSqrtType_t sqrt_result; \
+	uint8_t* l0 = ctx[n]->long_state; \
+	/* BEGIN cryptonight_monero_v8 variables, zero for the other algos */ \
+	__m128i bx1 = _mm_setzero_si128(); \
+	__m128i division_result_xmm = _mm_setzero_si128(); \
+	GetOptimalSqrtType_t sqrt_result = 0; \
 	/* END cryptonight_monero_v8 variables */ \
 	{ \
-		uint64_t* h0 = (uint64_t*)ctx->hash_state; \
+		uint64_t* h0 = (uint64_t*)ctx[n]->hash_state; \
 		idx0 = h0[0] ^ h0[4]; \
 		ax0 = _mm_set_epi64x(h0[1] ^ h0[5], idx0); \
 		bx0 = _mm_set_epi64x(h0[3] ^ h0[7], h0[2] ^ h0[6]); \
@@ -822,10 +821,10 @@ typedef uint64_t GetOptimalSqrtType_t;
 
 #define CN_FINALIZE(n) \
 	/* Optim - 90% time boundary */ \
-	cn_implode_scratchpad((__m128i*)ctx->long_state, (__m128i*)ctx->hash_state); \
+	cn_implode_scratchpad((__m128i*)ctx[n]->long_state, (__m128i*)ctx[n]->hash_state); \
 	/* Optim - 99% time boundary */ \
-	keccakf((uint64_t*)ctx->hash_state, 24); \
-	extra_hashes[ctx->hash_state[0] & 3](ctx->hash_state, 200, (char*)output + 32 * n)
+	keccakf((uint64_t*)ctx[n]->hash_state, 24); \
+	extra_hashes[ctx[n]->hash_state[0] & 3](ctx[n]->hash_state, 200, (char*)output + 32 * n)
 
 #ifndef _MSC_VER
 #	define CN_DEFER(...) __VA_ARGS__
@@ -854,6 +853,9 @@ typedef uint64_t GetOptimalSqrtType_t;
 
 #define CN_EXEC(f,...) CN_DEFER(f)(__VA_ARGS__)
 #define REPEAT_1(n, f, ...) CN_EXEC(f, CN_ENUM_ ## n(0, __VA_ARGS__))
+#define REPEAT_2(n, f, ...) CN_EXEC(f, CN_ENUM_ ## n(0, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(1, __VA_ARGS__))
+#define REPEAT_3(n, f, ...) CN_EXEC(f, CN_ENUM_ ## n(0, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(1, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(2, __VA_ARGS__))
+#define REPEAT_4(n, f, ...) CN_EXEC(f, CN_ENUM_ ## n(0, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(1, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(2, __VA_ARGS__)); CN_EXEC(f, CN_ENUM_ ## n(3, __VA_ARGS__))
 
 static inline void print8u(const char *str, uint8_t *v, uint32_t len) {
 
@@ -887,29 +889,80 @@ static uint8_t ou[32] = {
 	0x58, 0x60, 0xb1, 0x37, 0x80, 0xd8, 0xc0, 0x20, 
 };
 
-void cryptonight_hash( void *restrict output, const void *input, int len )
-{
-	size_t MASK = cn_select_mask(ALGO);
-	size_t ITERATIONS = cn_select_iter(ALGO);
-	MEM = cn_select_memory(ALGO);
-	uint32_t N = 1;
-	cryptonight_ctx* ctx = malloc(sizeof(cryptonight_ctx));
+// N hashes of consecutive inputs of len bytes into consecutive 32 byte
+// outputs, their steps interleaved so one hash's random scratchpad access
+// overlaps the others' arithmetic.
+#define CN_HASH_WAYS(W) \
+static void cryptonight_hash_ ## W( void *restrict output, const void *input, \
+                                   int len, cryptonight_ctx **ctx ) \
+{ \
+	size_t MASK = cn_select_mask(ALGO); \
+	size_t ITERATIONS = cn_select_iter(ALGO); \
+	uint32_t N = W; \
+	\
+	CN_INIT_SINGLE; \
+	REPEAT_ ## W(9, CN_INIT, monero_const, l0, ax0, bx0, idx0, ptr0, bx1, sqrt_result, division_result_xmm); \
+	\
+	/* Optim - 90% time boundary */ \
+	for(size_t i = 0; i < ITERATIONS; i++) \
+	{ \
+		REPEAT_ ## W(8, CN_STEP1, monero_const, l0, ax0, bx0, idx0, ptr0, cx, bx1); \
+		REPEAT_ ## W(7, CN_STEP2, monero_const, l0, ax0, bx0, idx0, ptr0, cx); \
+		REPEAT_ ## W(15, CN_STEP3, monero_const, l0, ax0, bx0, idx0, ptr0, lo, cl, ch, al0, ah0, cx, bx1, sqrt_result, division_result_xmm); \
+		REPEAT_ ## W(11, CN_STEP4, monero_const, l0, ax0, bx0, idx0, ptr0, lo, cl, ch, al0, ah0); \
+		REPEAT_ ## W(6, CN_STEP5, monero_const, l0, ax0, bx0, idx0, ptr0); \
+	} \
+	\
+	REPEAT_ ## W(0, CN_FINALIZE); \
+}
 
-	CN_INIT_SINGLE;
-	REPEAT_1(9, CN_INIT, monero_const, l0, ax0, bx0, idx0, ptr0, bx1, sqrt_result, division_result_xmm);
+CN_HASH_WAYS(1)
+CN_HASH_WAYS(2)
+CN_HASH_WAYS(3)
+CN_HASH_WAYS(4)
 
-	// Optim - 90% time boundary
-	for(size_t i = 0; i < ITERATIONS; i++)
+static void (* const cn_hash_ways[CN_MAX_WAYS])( void *restrict, const void *,
+                                                int, cryptonight_ctx ** ) =
+	{ cryptonight_hash_1, cryptonight_hash_2, cryptonight_hash_3,
+	  cryptonight_hash_4 };
+
+// The thread's contexts, allocated on first use and kept, one pad holding
+// as many as the widest hash it ran. Only MEM bytes of each long_state
+// are used, so they are packed at that stride.
+static __thread uint8_t *cn_pad = NULL;
+static __thread size_t cn_pad_size = 0;
+
+static cryptonight_ctx **cn_thread_ctx( int ways )
+{
+	static __thread cryptonight_ctx *ctx[CN_MAX_WAYS];
+	const size_t stride = offsetof(cryptonight_ctx, long_state) + MEM;
+
+	if (stride * ways > cn_pad_size)
 	{
-		REPEAT_1(8, CN_STEP1, monero_const, l0, ax0, bx0, idx0, ptr0, cx, bx1);
-		REPEAT_1(7, CN_STEP2, monero_const, l0, ax0, bx0, idx0, ptr0, cx);
-		REPEAT_1(15, CN_STEP3, monero_const, l0, ax0, bx0, idx0, ptr0, lo, cl, ch, al0, ah0, cx, bx1, sqrt_result, division_result_xmm);
-		REPEAT_1(11, CN_STEP4, monero_const, l0, ax0, bx0, idx0, ptr0, lo, cl, ch, al0, ah0);
-		REPEAT_1(6, CN_STEP5, monero_const, l0, ax0, bx0, idx0, ptr0);
+		scratch_free(cn_pad);
+		cn_pad = scratch_alloc(stride * ways);
+		if (!cn_pad)
+		{
+			applog(LOG_ERR, "Failed to allocate cryptonight scratchpad");
+			exit(1);
+		}
+		cn_pad_size = stride * ways;
 	}
+	for (int n = 0; n < ways; n++)
+		ctx[n] = (cryptonight_ctx*)(cn_pad + stride * n);
+	return ctx;
+}
 
-	REPEAT_1(0, CN_FINALIZE);
-	free(ctx);
+// ways hashes of consecutive inputs, 1 to CN_MAX_WAYS.
+void cryptonight_hash_ways( void *restrict output, const void *input, int len,
+                            int ways )
+{
+	cn_hash_ways[ways - 1](output, input, len, cn_thread_ctx(ways));
+}
+
+void cryptonight_hash( void *restrict output, const void *input, int len )
+{
+	cryptonight_hash_ways(output, input, len, 1);
 }
 
 void cryptonight_hash_suw( void *restrict output, const void *input )
@@ -917,6 +970,12 @@ void cryptonight_hash_suw( void *restrict output, const void *input )
   cryptonight_hash( output, input, 76 );
 }
 
+// Hashes per call for miner thread thr_id, --cn-ways.
+static int cn_thread_ways( int thr_id )
+{
+	return opt_cn_ways_count ? opt_cn_ways[ thr_id % opt_cn_ways_count ] : 1;
+}
+
 int scanhash_cryptonight( int thr_id, struct work *work, uint32_t max_nonce,
                    uint64_t *hashes_done )
  {
@@ -927,20 +986,36 @@ int scanhash_cryptonight( int thr_id, struct work *work, uint32_t max_nonce,
     uint32_t n = *nonceptr - 1;
     const uint32_t first_nonce = n + 1;
     const uint32_t Htarg = ptarget[7];
-    uint32_t hash[32 / 4] __attribute__((aligned(32)));
+    const int ways = cn_thread_ways( thr_id );
+    uint8_t blobs[CN_MAX_WAYS][76] __attribute__((aligned(16)));
+    uint32_t hash[CN_MAX_WAYS][32 / 4] __attribute__((aligned(32)));
 
+    for ( int k = 0; k < ways; k++ )
+       memcpy( blobs[k], pdata, 76 );
 
     do
     {
-       *nonceptr = ++n;
-       cryptonight_hash( hash, pdata, 76 );
-       if (unlikely( hash[7] < Htarg ))
+       // fewer at the end of the range
+       int w = max_nonce - n < (uint32_t)ways ? max_nonce - n : ways;
+       if ( w < 1 )
+          w = 1;
+       for ( int k = 0; k < w; k++ )
        {
-           *hashes_done = n - first_nonce + 1;
-	   return true;
+          uint32_t nonce = n + 1 + k;
+          memcpy( blobs[k] + 39, &nonce, 4 );
        }
-    } while (likely((n <= max_nonce && !work_restart[thr_id].restart)));
-
+       cryptonight_hash_ways( hash, blobs, 76, w );
+       for ( int k = 0; k < w; k++ )
+          if (unlikely( hash[k][7] < Htarg ))
+          {
+             *nonceptr = n + 1 + k;
+             *hashes_done = n + 1 + k - first_nonce + 1;
+             return true;
+          }
+       n += w;
+    } while (likely((n < max_nonce && !work_restart[thr_id].restart)));
+
+    *nonceptr = n;
     *hashes_done = n - first_nonce + 1;
     return 0;
 }
@@ -948,6 +1023,7 @@ int scanhash_cryptonight( int thr_id, struct work *work, uint32_t max_nonce,
 bool register_cryptonight_algo( algo_gate_t* gate )
 {
 	ALGO = cryptonight;
+  MEM = cn_select_memory(ALGO);
   register_json_rpc2( gate );
   gate->optimizations = SSE2_OPT | AES_OPT;
   gate->scanhash         = (void*)&scanhash_cryptonight;
@@ -960,6 +1036,7 @@ bool register_cryptonight_algo( algo_gate_t* gate )
 bool register_cryptonightv7_algo( algo_gate_t* gate )
 {
 	ALGO = cryptonight_monero;
+  MEM = cn_select_memory(ALGO);
   register_json_rpc2( gate );
   gate->optimizations = SSE2_OPT | AES_OPT;
   gate->scanhash      = (void*)&scanhash_cryptonight;
@@ -972,6 +1049,7 @@ bool register_cryptonightv7_algo( algo_gate_t* gate )
 bool register_cryptonightv8_algo( algo_gate_t* gate )
 {
 	ALGO = cryptonight_monero_v8;
+  MEM = cn_select_memory(ALGO);
   register_json_rpc2( gate );
   gate->optimizations = SSE2_OPT | AES_OPT;
   gate->scanhash      = (void*)&scanhash_cryptonight;
@@ -984,6 +1062,7 @@ bool register_cryptonightv8_algo( algo_gate_t* gate )
 bool register_cryptonightheavy_algo( algo_gate_t* gate )
 {
 	ALGO = cryptonight_heavy;
+  MEM = cn_select_memory(ALGO);
   register_json_rpc2( gate );
   gate->optimizations = SSE2_OPT | AES_OPT;
   gate->scanhash      = (void*)&scanhash_cryptonight;
@@ -993,4 +1072,15 @@ bool register_cryptonightheavy_algo( algo_gate_t* gate )
   return true;
 };
 
-
+bool register_cryptolight_algo( algo_gate_t* gate )
+{
+	ALGO = cryptonight_lite;
+  MEM = cn_select_memory(ALGO);
+  register_json_rpc2( gate );
+  gate->optimizations = SSE2_OPT | AES_OPT;
+  gate->scanhash      = (void*)&scanhash_cryptonight;
+  gate->hash          = (void*)&cryptonight_hash;
+  gate->hash_suw      = (void*)&cryptonight_hash_suw;
+  gate->get_max64     = (void*)&get_max64_0x40LL;
+  return true;
+};
@@ -44,6 +44,8 @@ int scanhash_cryptonight( int thr_id, struct work *work, uint32_t max_nonce,
                            uint64_t *hashes_done );
 
 void cryptonight_hash_aes( void *restrict output, const void *input, int len );
+void cryptonight_hash_ways( void *restrict output, const void *input, int len,
+                            int ways );
 
 extern bool cryptonightV7;
 
@@ -36,9 +36,9 @@ void hodl_le_build_stratum_request( char* req, struct work* work,
    le32enc( &nfinalcalc, work->data[ HODL_NFINALCALC_INDEX ] );
    bin2hex( nstartlocstr,  (char*)(&nstartloc),  sizeof(uint32_t) );
    bin2hex( nfinalcalcstr, (char*)(&nfinalcalc), sizeof(uint32_t) );
-   sprintf( req, "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
+   sprintf( req, "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
            rpc_user, work->job_id, xnonce2str, ntimestr, noncestr,
-           nstartlocstr, nfinalcalcstr );
+           nstartlocstr, nfinalcalcstr, work->submit_id );
    free( xnonce2str );
 }
 
@@ -211,7 +211,7 @@ bool register_hodl_algo( algo_gate_t* gate )
   gate->resync_threads        = (void*)&hodl_resync_threads;
   gate->do_this_thread        = (void*)&hodl_do_this_thread;
   gate->work_cmp_size         = 76;
-  hodl_scratchbuf = (unsigned char*)malloc( 1 << 30 );
+  hodl_scratchbuf = (unsigned char*)scratch_alloc( 1 << 30 );
   allow_getwork = false;
   return ( hodl_scratchbuf != NULL );
 }
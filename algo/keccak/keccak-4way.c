@@ -59,7 +59,7 @@ int scanhash_keccak_4way( int thr_id, struct work *work, uint32_t max_nonce,
       }
       n += 4;
 
-   } while ( (num_found == 0) && (n < max_nonce-4)
+   } while ( (num_found == 0) && (n < max_nonce)
                    && !work_restart[thr_id].restart);
 
    *hashes_done = n - first_nonce + 1;
@@ -129,7 +129,7 @@ int scanhash_allium_4way( int thr_id, struct work *work, uint32_t max_nonce,
          work_set_target_ratio( work, hash+(i<<3) );
      }
      n += 4;
-   } while ( (num_found == 0) && (n < max_nonce-4)
+   } while ( (num_found == 0) && (n < max_nonce)
                    && !work_restart[thr_id].restart);
 
    *hashes_done = n - first_nonce + 1;
@@ -8,7 +8,7 @@ __thread uint64_t* lyra2h_matrix;
 
 bool lyra2h_thread_init()
 {
-   lyra2h_matrix = _mm_malloc( LYRA2H_MATRIX_SIZE, 64 );
+   lyra2h_matrix = scratch_alloc( LYRA2H_MATRIX_SIZE );
    return lyra2h_matrix;
 }
 
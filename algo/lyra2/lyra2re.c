@@ -7,7 +7,6 @@
 #include "lyra2.h"
 #include "algo-gate-api.h"
 #include "avxdefs.h"
-#include "drv_api.h"
 #ifndef NO_AES_NI
   #include "algo/groestl/aes_ni/hash-groestl256.h"
 #endif
@@ -82,107 +81,12 @@ void lyra2re_hash(void *state, const void *input)
 	memcpy(state, hashA, 32);
 }
 
-static uint8_t g_msgIdx = 0;
-
-static int _get_leadingZeroCnt(uint8_t *result) {
-
-  int count = 0;
-
-  for (int i = 31; i >= 0; i--) {
-    //printf("0x%02x ", result[i]);
-    if (result[i] < 1)        {count += 8;}
-    else if (result[i] < 2)   {count += 7; break;}
-    else if (result[i] < 4)   {count += 6; break;}
-    else if (result[i] < 8)   {count += 5; break;}
-    else if (result[i] < 16)  {count += 4; break;}
-    else if (result[i] < 32)  {count += 3; break;}
-    else if (result[i] < 64)  {count += 2; break;}
-    else if (result[i] < 128) {count += 1; break;}
-    else break;
-  }
-
-  return count;
-}
-
-static void printv( const uint8_t *str, uint32_t *v, uint32_t len) {
-
-  printf( "%s:", str);
-  for( uint32_t i=0; i<len; i++) {
-
-    if( ( i%8) == 0) printf( "\n");
-    printf( "%08x ", v[ i]);
-  }
-  printf( "\n\n");
-}
-
-static uint32_t g_u32Work[20];
-
-#if 0
-int scanhash_lyra2re(int thr_id, struct work *work,
-	uint32_t max_nonce,	uint64_t *hashes_done)
+// Single hash of an 80 byte big endian header, used to verify ASIC nonces.
+void lyra2re_asic_hash( void *state, const void *input )
 {
-  uint32_t *pdata = work->data;
-  uint32_t *ptarget = work->target;
-  uint32_t _ALIGN(64) endiandata[20];
-  uint32_t hash[8] __attribute__((aligned(64)));
-  const uint32_t first_nonce = pdata[19];
-  uint32_t nonce = first_nonce;
-  //const uint32_t Htarg = ptarget[7];
-
-  uint8_t diff = _get_leadingZeroCnt((uint8_t *)ptarget);
-  uint8_t diff1 = diff > 10 ? 15 : diff;
-  if (memcmp((uint8_t *)&endiandata[0], g_u32Work, 76) != 0) {
-
-    memcpy(g_u32Work, (uint8_t *)&endiandata[0], 76);
-    g_u32Work[19] = nonce;
-    printf("**************new work,%d, diff:%d\n", g_msgIdx, diff);
-
-    drv_send_work(g_msgIdx, diff1, (uint8_t *)&nonce, 4, (uint8_t *)g_u32Work, 80);
-    printv("work", g_u32Work, 20);
-  }
-
-  uint64_t n[64];
-  uint8_t msgidx;
-  int ncnt = drv_get_nonce(&msgidx, (uint8_t *)&n[0]);
-  if(ncnt == 0)
-    return 0;
-
-  if ( ncnt == 1)
-    printf("rx %d nonce, 1st nonce:0x%08lx\n", ncnt, n[0]);
-  else
-    printf("rx %d nonce, 1st nonce:0x%08lx, 2nd:0x%08lx\n", ncnt, n[0], n[1]);
-
-  int v_cnt = 0;
-  for (int i = 0; i < ncnt; i++) {
-    uint32_t tm[20];
-    uint32_t tn = n[i];
-
-    swab32_array( tm, g_u32Work, 20 );
-    lyra2_blake256_midstate( tm );
-    be32enc(&tm[19], tn);
-    lyra2re_hash( hash, tm);
-
-    uint8_t td = _get_leadingZeroCnt((uint8_t *)hash);
-    //if(fulltest( hash, ptarget)) {
-    if (1) {  //(td >= diff1) {
-      work->nonces[v_cnt] = tn;
-      v_cnt +=1;
-      printf("#### find valid nonce: 0x%08x, diff:%d\r\n", tn, td);
-    } else {
-      printf("error nonce:0x%08x, diff:%d\n", tn, td);
-    }
-  }
-
-  g_msgIdx += 1;
-  return v_cnt;
+        lyra2_blake256_midstate( input );
+        lyra2re_hash( state, input );
 }
-#else
-
-static uint32_t w[20] = {
-  0xa88c6e5c, 0x00007fd6, 0x5aabb994, 0x00005585, 0xa88c6ff0, 0x00007fd6, 0x5aab9858, 0x00005585,
-  0x900011a0, 0x00007fd6, 0x5bfc5dc0, 0x00005585, 0x5bfc5dd0, 0x00005585, 0xb194fefa, 0x00007fd6,
-  0x00000030, 0x00000030, 0xa88c6e98, 0x00000000
-};
 
 int scanhash_lyra2re(int thr_id, struct work *work,
 	uint32_t max_nonce,	uint64_t *hashes_done)
@@ -195,20 +99,13 @@ int scanhash_lyra2re(int thr_id, struct work *work,
 	uint32_t nonce = first_nonce;
         const uint32_t Htarg = ptarget[7];
 
-        #if 1
-        memcpy(pdata, w, 80);
-        nonce = 0x14d45;
-        printv("work", pdata, 20);
-        #endif
         swab32_array( endiandata, pdata, 20 );
 
         lyra2_blake256_midstate( endiandata );
 
 	do {
-      printv("nonce", &nonce, 1);
 		be32enc(&endiandata[19], nonce);
 		lyra2re_hash(hash, endiandata);
-        printv("\nhash output", hash, 8);
 		if (hash[7] <= Htarg )
                 {
                    if ( fulltest(hash, ptarget) )
@@ -227,7 +124,6 @@ int scanhash_lyra2re(int thr_id, struct work *work,
 	*hashes_done = pdata[19] - first_nonce + 1;
 	return 0;
 }
-#endif
 
 int64_t lyra2re_get_max64 ()
 {
@@ -247,5 +143,7 @@ bool register_lyra2re_algo( algo_gate_t* gate )
   gate->hash       = (void*)&lyra2re_hash;
   gate->get_max64  = (void*)&lyra2re_get_max64;
   gate->set_target = (void*)&lyra2re_set_target;
+  gate->asic_thread_init = (void*)&return_true;
+  gate->asic_hash  = (void*)&lyra2re_asic_hash;
   return true;
 };
@@ -13,7 +13,7 @@ bool lyra2rev2_thread_init()
    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
    int i = (int64_t)ROW_LEN_BYTES * 4; // nRows;
-   l2v2_wholeMatrix = _mm_malloc( i, 64 );
+   l2v2_wholeMatrix = scratch_alloc( i );
 #if defined (LYRA2REV2_4WAY)
    init_lyra2rev2_4way_ctx();;
 #else
@@ -22,6 +22,21 @@ bool lyra2rev2_thread_init()
    return l2v2_wholeMatrix;
 }
 
+// Each ASIC verifier thread needs both the plain and the 4way context.
+bool lyra2rev2_asic_thread_init()
+{
+   const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * 4; // nCols
+   const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
+
+   int i = (int64_t)ROW_LEN_BYTES * 4; // nRows;
+   l2v2_wholeMatrix = scratch_alloc( i );
+   init_lyra2rev2_ctx();
+#if defined (LYRA2REV2_4WAY)
+   init_lyra2rev2_4way_ctx();
+#endif
+   return l2v2_wholeMatrix;
+}
+
 bool register_lyra2rev2_algo( algo_gate_t* gate )
 {
 #if defined (LYRA2REV2_4WAY)
@@ -34,5 +49,10 @@ bool register_lyra2rev2_algo( algo_gate_t* gate )
   gate->optimizations = SSE2_OPT | AES_OPT | SSE42_OPT | AVX2_OPT;
   gate->miner_thread_init = (void*)&lyra2rev2_thread_init;
   gate->set_target        = (void*)&lyra2rev2_set_target;
+  gate->asic_thread_init  = (void*)&lyra2rev2_asic_thread_init;
+  gate->asic_hash         = (void*)&lyra2rev2_asic_hash;
+#if defined (LYRA2REV2_4WAY)
+  gate->asic_hash_4way    = (void*)&lyra2rev2_4way_asic_hash;
+#endif
   return true;
 };
@@ -17,6 +17,8 @@ bool register_lyra2rev2_algo( algo_gate_t* gate );
 
 void lyra2rev2_4way_hash( void *state, const void *input );
 
+void lyra2rev2_4way_asic_hash( void *state, const void *input );
+
 int scanhash_lyra2rev2_4way( int thr_id, struct work *work, uint32_t max_nonce,
                          uint64_t *hashes_done );
 
@@ -31,5 +33,7 @@ int scanhash_lyra2rev2( int thr_id, struct work *work, uint32_t max_nonce,
 
 bool init_lyra2rev2_ctx();
 
+void lyra2rev2_asic_hash( void *state, const void *input );
+
 #endif
 
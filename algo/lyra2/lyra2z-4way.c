@@ -12,7 +12,7 @@ __thread uint64_t* lyra2z_4way_matrix;
 
 bool lyra2z_4way_thread_init()
 {
- return ( lyra2z_4way_matrix = _mm_malloc( LYRA2Z_MATRIX_SIZE, 64 ) );
+ return ( lyra2z_4way_matrix = scratch_alloc( LYRA2Z_MATRIX_SIZE ) );
 }
 
 static __thread blake256_4way_context l2z_4way_blake_mid;
@@ -91,7 +91,7 @@ int scanhash_lyra2z_4way( int thr_id, struct work *work, uint32_t max_nonce,
           work_set_target_ratio( work, hash+(i<<3) );
       }
       n += 4;
-   } while ( (num_found == 0) && (n < max_nonce-4)
+   } while ( (num_found == 0) && (n < max_nonce)
                    && !work_restart[thr_id].restart);
 
    *hashes_done = n - first_nonce + 1;
@@ -106,7 +106,7 @@ __thread uint64_t* lyra2z_8way_matrix;
 
 bool lyra2z_8way_thread_init()
 {
- return ( lyra2z_8way_matrix = _mm_malloc( LYRA2Z_MATRIX_SIZE, 64 ) );
+ return ( lyra2z_8way_matrix = scratch_alloc( LYRA2Z_MATRIX_SIZE ) );
 }
 
 static __thread blake256_8way_context l2z_8way_blake_mid;
@@ -203,7 +203,7 @@ int scanhash_lyra2z_8way( int thr_id, struct work *work, uint32_t max_nonce,
           work_set_target_ratio( work, hash+(i<<3) );
       }
       n += 8;
-   } while ( (num_found == 0) && (n < max_nonce-4)
+   } while ( (num_found == 0) && (n < max_nonce)
                    && !work_restart[thr_id].restart);
 
    *hashes_done = n - first_nonce + 1;
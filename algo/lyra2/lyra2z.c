@@ -13,7 +13,7 @@ bool lyra2z_thread_init()
 //   const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 //   int i = (int64_t)ROW_LEN_BYTES * 8; // nRows;
    const int i = BLOCK_LEN_INT64 * 8 * 8 * 8;
-   lyra2z_matrix = _mm_malloc( i, 64 );
+   lyra2z_matrix = scratch_alloc( i );
    return lyra2z_matrix;
 }
 
@@ -62,7 +62,7 @@ bool lyra2z330_thread_init()
    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
    int i = (int64_t)ROW_LEN_BYTES * 330; // nRows;
-   lyra2z330_wholeMatrix = _mm_malloc( i, 64 );
+   lyra2z330_wholeMatrix = scratch_alloc( i );
 
    return lyra2z330_wholeMatrix;
 }
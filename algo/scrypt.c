@@ -508,7 +508,7 @@ static inline void scrypt_core(uint32_t *X, uint32_t *V, int N)
 
 unsigned char *scrypt_buffer_alloc(int N)
 {
-	return (uchar*) malloc((size_t)N * SCRYPT_MAX_WAYS * 128 + 63);
+	return (uchar*) scratch_alloc((size_t)N * SCRYPT_MAX_WAYS * 128 + 63);
 }
 
 static void scrypt_1024_1_1_256(const uint32_t *input, uint32_t *output,
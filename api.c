@@ -32,6 +32,11 @@
 #include <sys/types.h>
 
 #include "miner.h"
+#include "asic-miner.h"
+#include "trace.h"
+#include "job-trace.h"
+#include "share-track.h"
+#include "pools.h"
 
 #ifndef WIN32
 # include <errno.h>
@@ -116,7 +121,7 @@ static void cpustatus(int thr_id)
 //      struct cpu_info *cpu = &thr_info[thr_id].cpu;
       char buf[512]; *buf = '\0';
       char units[4] = {0};
-      double hashrate = thr_hashrates[thr_id];
+      double hashrate = thr_hashrate( thr_id );
 
       scale_hash_for_display ( &hashrate, units );
       snprintf( buf, sizeof(buf), "CPU=%d;%sH/s=%.2f|", thr_id, units,
@@ -139,7 +144,7 @@ static char *getsummary( char *params )
    double accps = (60.0 * accepted_count) / (uptime ? uptime : 1.0);
    double diff = net_diff > 0. ? net_diff : stratum_diff;
    char diff_str[16];
-   double hrate = (double)global_hashrate;
+   double hcount, hrate;
    struct cpu_info cpu = { 0 };
 #ifdef USE_MONITORING
    cpu.has_monitoring = true;
@@ -149,6 +154,7 @@ static char *getsummary( char *params )
 #endif
 
    get_currentalgo(algo, sizeof(algo));
+   thr_stats_total( &hcount, &hrate );
 
    // if diff is integer don't display decimals
    if ( diff == trunc( diff ) )
@@ -181,6 +187,41 @@ static char *getthreads(char *params)
 	return buffer;
 }
 
+/**
+ * Returns ASIC nonce counters, one record per chain followed by one per
+ * chip that reported anything
+ */
+static char *getasic(char *params)
+{
+	char *p = buffer;
+	char *end = buffer + MYBUFSIZ;
+
+	*buffer = '\0';
+	for (int c = 0; c < asic_stats_chains; c++) {
+		struct asic_chain_stats *cs = &asic_stats[c];
+
+		p += snprintf(p, end - p, "CHAIN=%d;KHS=%.2f;DIFF=%d;NONCES=%.2f;SHARES=%"
+			PRIu64 ";STALE=%" PRIu64 ";DROPPED=%" PRIu64 "|", c,
+			cs->hashrate / 1000.0, cs->diff, cs->nonce_rate, cs->shares,
+			cs->stale, cs->dropped);
+		if (p > end)
+			p = end;
+		for (int i = 0; i < 256 && p < end; i++) {
+			struct asic_chip_stats *st = &cs->chip[i];
+			if (!st->valid && !st->invalid && !st->dup)
+				continue;
+			p += snprintf(p, end - p, "CHAIN=%d;CHIP=%d;KHS=%.2f;VALID=%" PRIu64
+				";INVALID=%" PRIu64 ";DUP=%" PRIu64 "|",
+				c, i, st->hashrate / 1000.0, st->valid, st->invalid, st->dup);
+			if (p > end)
+				p = end;
+		}
+		if (p >= end)
+			break;
+	}
+	return buffer;
+}
+
 /**
  * Is remote control allowed ?
  */
@@ -189,6 +230,66 @@ static bool check_remote_access(void)
 	return (opt_api_remote > 0);
 }
 
+/**
+ * UART trace counters, "trace|on" or "trace|off" switches it (remote)
+ */
+static char *gettrace(char *params)
+{
+	struct trace_stats st;
+
+	*buffer = '\0';
+	if (params && *params) {
+		if (!check_remote_access())
+			return buffer;
+		trace_enable(!strcasecmp(params, "on"));
+	}
+	trace_get_stats(&st);
+	sprintf(buffer, "TRACE=%s;RECORDS=%" PRIu64 ";BYTES=%" PRIu64
+		";DROPPED=%" PRIu64 "|", g_trace_on ? "on" : "off",
+		st.records, st.bytes, st.dropped);
+	return buffer;
+}
+
+/**
+ * Work handoff allocation counters, only REUSED should grow once mining
+ */
+static char *getalloc(char *params)
+{
+	struct work_alloc_stats st;
+
+	work_get_alloc_stats(&st);
+	sprintf(buffer, "CMDALLOCS=%" PRIu64 ";REUSED=%" PRIu64 ";HEAP=%" PRIu64 "|",
+		st.cmd_allocs, st.cmd_reused, st.heap);
+	return buffer;
+}
+
+/**
+ * Job switch latency histograms in microseconds, per algo and stage
+ */
+static char *getjobtrace(char *params)
+{
+	job_trace_report(buffer, MYBUFSIZ);
+	return buffer;
+}
+
+/**
+ * Shares in flight and submit to answer latencies in microseconds
+ */
+static char *getshares(char *params)
+{
+	share_track_report(buffer, MYBUFSIZ);
+	return buffer;
+}
+
+/**
+ * Pools, their roles and ping round trips, failovers and time without work
+ */
+static char *getpools(char *params)
+{
+	pool_report(buffer, MYBUFSIZ);
+	return buffer;
+}
+
 /**
  * Change pool url (see --url parameter)
  * seturl|stratum+tcp://XeVrkPrWB7pDbdFLfKhF1Z3xpqhsx6wkH3:X@stratum+tcp://mine.xpool.ca:1131|
@@ -226,9 +327,15 @@ struct CMDS {
 } cmds[] = {
 	{ "summary", getsummary },
 	{ "threads", getthreads },
+	{ "asic",    getasic },
+	{ "alloc",   getalloc },
+	{ "jobtrace", getjobtrace },
+	{ "shares",  getshares },
+	{ "pools",   getpools },
 	/* remote functions */
 	{ "seturl", remote_seturl },
 	{ "quit",    remote_quit },
+	{ "trace",   gettrace },
 	/* keep it the last */
 	{ "help",    gethelp },
 };
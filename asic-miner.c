@@ -0,0 +1,545 @@
+/*
+ * Asynchronous ASIC scheduler.
+ *
+ * One thread feeds stratum jobs to every chain and collects the nonces the
+ * chips report. Jobs are sent without waiting for results; the chip echoes
+ * the 8 bit message id of the job a nonce belongs to, which indexes a table
+ * of the last ASIC_MAX_JOBS works. A clean stratum job bumps the generation
+ * so nonces for older jobs are dropped instead of being submitted.
+ *
+ * Nonces are re-hashed by a small pool of verifier threads, four at a time
+ * when the algo has a 4way kernel, and only those meeting the target are
+ * submitted. The scheduler keeps the job table to itself: verifiers get a
+ * copy of the header and target and hand back a verdict.
+ *
+ * The chip difficulty is set per chain so the chips report about
+ * --asic-nonce-rate nonces/s each: enough to judge their health, few enough
+ * not to flood the UART. It never exceeds the pool target's leading zeros,
+ * so no share is filtered out by the chips, unless the link could not carry
+ * the nonces otherwise.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "miner.h"
+#include "algo-gate-api.h"
+#include "interleave.h"
+#include "drv_api.h"
+#include "asic-miner.h"
+
+bool opt_asic = false;
+int  opt_asic_verify = 1;
+char *opt_uart_trace = NULL;
+double opt_asic_nonce_rate = ASIC_NONCE_RATE;
+int  asic_thr_id = -1;
+
+struct asic_chain_stats *asic_stats = NULL;
+int asic_stats_chains = 0;
+
+struct asic_job
+{
+   struct work work;
+   uint32_t    gen;      // asic_gen when the job was sent
+   uint32_t    seq;      // asic_seq when the job was sent
+   uint8_t     diff[256]; // leading zero bits each chain was asked for
+   struct timeval sent;
+   bool        valid;
+   int         seen_cnt;
+   uint32_t    seen[ ASIC_SEEN_SLOTS ];
+   uint64_t    seen_used[ ASIC_SEEN_SLOTS / 64 ];
+};
+
+enum asic_verdict
+{
+   ASIC_NONCE_INVALID,   // below the chip difficulty, a hardware error
+   ASIC_NONCE_VALID,     // meets the chip difficulty only
+   ASIC_NONCE_SHARE      // meets the pool target
+};
+
+// One nonce on its way through the verifiers.
+struct asic_nonce
+{
+   uint32_t edata[20] __attribute__ ((aligned (64)));
+   uint32_t target[8];
+   uint32_t hash[8];
+   uint32_t seq;
+   uint32_t nonce;
+   int      diff;
+   int      verdict;
+   uint8_t  msg_id;
+   uint8_t  chain_id;
+   uint8_t  chip_addr;
+};
+
+// Difficulty control of one chain.
+struct asic_diff_ctl
+{
+   uint64_t valid;       // chain totals at the last adjustment
+   uint64_t hashes;
+   int      rate_diff;   // difficulty giving --asic-nonce-rate
+   int      link_diff;   // lowest difficulty the UART can carry
+};
+
+static struct asic_job asic_jobs[ ASIC_MAX_JOBS ];
+static struct asic_diff_ctl *asic_ctl = NULL;
+static uint8_t  asic_msg_id = 0;
+static uint32_t asic_seq = 0;
+static uint32_t asic_gen = 0;
+static uint32_t asic_pending = 0;
+
+static struct thread_q *asic_verify_q = NULL;
+static struct thread_q *asic_done_q = NULL;
+
+void asic_new_job( bool clean )
+{
+   if ( clean )
+      __atomic_add_fetch( &asic_gen, 1, __ATOMIC_SEQ_CST );
+   __atomic_store_n( &asic_pending, 1, __ATOMIC_SEQ_CST );
+   drv_wakeup();
+}
+
+static double asic_now()
+{
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Leading zero bits of a 256 bit little endian number.
+static int asic_zero_bits( const uint32_t *v )
+{
+   int bits = 0;
+   for ( int i = 7; i >= 0; i-- )
+   {
+      if ( v[i] )
+         return bits + __builtin_clz( v[i] );
+      bits += 32;
+   }
+   return bits;
+}
+
+// Remember nonce for this job, true if it was already reported. Once the
+// table is 3/4 full new nonces are no longer tracked.
+static bool asic_job_seen( struct asic_job *job, uint32_t nonce )
+{
+   uint32_t h = ( nonce * 2654435761u ) & ( ASIC_SEEN_SLOTS - 1 );
+
+   for ( int i = 0; i < ASIC_SEEN_SLOTS; i++ )
+   {
+      uint32_t s = ( h + i ) & ( ASIC_SEEN_SLOTS - 1 );
+      uint64_t bit = 1ULL << ( s & 63 );
+
+      if ( !( job->seen_used[ s >> 6 ] & bit ) )
+      {
+         if ( job->seen_cnt >= ASIC_SEEN_SLOTS * 3 / 4 )
+            return false;
+         job->seen_used[ s >> 6 ] |= bit;
+         job->seen[s] = nonce;
+         job->seen_cnt++;
+         return false;
+      }
+      if ( job->seen[s] == nonce )
+         return true;
+   }
+   return false;
+}
+
+// Difficulty for a chain's next job: the rate target as long as that keeps
+// every share, raised further only when the link needs it.
+static int asic_chain_diff( int c, int pool_bits )
+{
+   struct asic_chain_stats *cs = &asic_stats[c];
+   int diff = asic_ctl[c].rate_diff;
+
+   if ( diff > pool_bits )
+      diff = pool_bits;
+   if ( diff < asic_ctl[c].link_diff )
+      diff = asic_ctl[c].link_diff;
+
+   if ( diff != cs->diff )
+   {
+      applog( LOG_INFO, "ASIC: chain %d difficulty %d -> %d at %.2f nonces/s",
+              c, cs->diff, diff, cs->nonce_rate );
+      cs->diff = diff;
+   }
+   return diff;
+}
+
+static int asic_clamp_diff( double bits )
+{
+   if ( bits < ASIC_MIN_DIFF )
+      return ASIC_MIN_DIFF;
+   if ( bits > ASIC_MAX_DIFF )
+      return ASIC_MAX_DIFF;
+   return (int)bits;
+}
+
+// Re-aim each chain's difficulty at the hashrate seen since the last call.
+static void asic_adjust_diff( double elapsed )
+{
+   for ( int c = 0; c < asic_stats_chains; c++ )
+   {
+      struct asic_chain_stats *cs = &asic_stats[c];
+      struct asic_diff_ctl *ctl = &asic_ctl[c];
+      uint64_t valid = 0, hashes = 0;
+      int chips = drv_get_chip_num( c );
+      double rate, link, hr;
+
+      for ( int i = 0; i < 256; i++ )
+      {
+         valid += cs->chip[i].valid;
+         hashes += cs->chip[i].hashes;
+      }
+      cs->nonce_rate = ( valid - ctl->valid ) / elapsed;
+
+      // Without a nonce all that is known is the hashrate being below
+      // one nonce at the current difficulty.
+      if ( valid > ctl->valid )
+         hr = ( hashes - ctl->hashes ) / elapsed;
+      else
+         hr = (double)( 1ULL << cs->diff ) / elapsed;
+      ctl->valid = valid;
+      ctl->hashes = hashes;
+
+      rate = opt_asic_nonce_rate * ( chips > 0 ? chips : 1 );
+      link = drv_get_baudrate( c ) * ASIC_LINK_SHARE / ASIC_NONCE_BITS;
+      ctl->rate_diff = asic_clamp_diff( round( log2( hr / rate ) ) );
+      ctl->link_diff = link > 0. ? asic_clamp_diff( ceil( log2( hr / link ) ) )
+                                 : 0;
+   }
+}
+
+static bool asic_send_job()
+{
+   struct asic_job *job = &asic_jobs[ asic_msg_id ];
+   uint8_t nonce_start[4] = { 0 };
+   int pool_bits;
+
+   if ( !stratum.job.job_id || !stratum.job.diff )
+      return false;
+
+   job->valid = false;
+   job->gen = __atomic_load_n( &asic_gen, __ATOMIC_SEQ_CST );
+   job->seq = ++asic_seq;
+   algo_gate.stratum_gen_work( &stratum, &job->work );
+
+   pool_bits = asic_zero_bits( job->work.target );
+   for ( int c = 0; c < asic_stats_chains; c++ )
+      job->diff[c] = asic_chain_diff( c, pool_bits );
+   job->seen_cnt = 0;
+   memset( job->seen_used, 0, sizeof job->seen_used );
+   job->valid = true;
+   gettimeofday( &job->sent, NULL );
+
+   drv_send_work( asic_msg_id, job->diff, nonce_start, sizeof nonce_start,
+                  (uint8_t*)job->work.data, 80 );
+
+   if ( opt_debug )
+      applog( LOG_DEBUG, "ASIC: job %s sent as msg %d, pool diff %d bits",
+              job->work.job_id, asic_msg_id, pool_bits );
+   asic_msg_id++;
+   return true;
+}
+
+static inline bool asic_job_current( const struct asic_job *job )
+{
+   return job->valid
+       && job->gen == __atomic_load_n( &asic_gen, __ATOMIC_SEQ_CST );
+}
+
+// Scheduler side: drop stale and duplicate nonces, queue the rest.
+static void asic_queue_nonces( const struct drv_nonce_pkg *pkg )
+{
+   struct asic_job *job = &asic_jobs[ pkg->msg_id ];
+   struct asic_chain_stats *cs = &asic_stats[ pkg->chain_id ];
+   uint32_t edata[20];
+   int i;
+
+   if ( !asic_job_current( job ) )
+   {
+      cs->stale += pkg->n_cnt;
+      if ( opt_debug )
+         applog( LOG_DEBUG, "ASIC: dropped %d stale nonce(s) for msg %d",
+                 pkg->n_cnt, pkg->msg_id );
+      return;
+   }
+
+   swab32_array( edata, job->work.data, 20 );
+   for ( i = 0; i < pkg->n_cnt; i++ )
+   {
+      struct asic_nonce *n;
+
+      if ( asic_job_seen( job, pkg->nonce[i] ) )
+      {
+         cs->chip[ pkg->chip_addr ].dup++;
+         continue;
+      }
+
+      n = (struct asic_nonce*) malloc( sizeof *n );
+      if ( !n )
+         return;
+      memcpy( n->edata, edata, sizeof edata );
+      be32enc( &n->edata[19], pkg->nonce[i] );
+      memcpy( n->target, job->work.target, sizeof n->target );
+      n->seq       = job->seq;
+      n->nonce     = pkg->nonce[i];
+      n->diff      = job->diff[ pkg->chain_id ];
+      n->msg_id    = pkg->msg_id;
+      n->chain_id  = pkg->chain_id;
+      n->chip_addr = pkg->chip_addr;
+      // the verifiers are TQ_SIZE nonces behind, stalling the chains
+      // would not help them catch up
+      if ( !tq_push( asic_verify_q, n ) )
+      {
+         cs->dropped++;
+         free( n );
+      }
+   }
+}
+
+// Scheduler side: account verdicts and submit shares.
+static void asic_handle_verdict( struct thr_info *thr, struct asic_nonce *n )
+{
+   struct asic_job *job = &asic_jobs[ n->msg_id ];
+   struct asic_chain_stats *cs = &asic_stats[ n->chain_id ];
+
+   if ( n->verdict == ASIC_NONCE_INVALID )
+   {
+      cs->chip[ n->chip_addr ].invalid++;
+      applog( LOG_WARNING, "ASIC: chain %d chip %d bad nonce %08x",
+              n->chain_id, n->chip_addr, n->nonce );
+      return;
+   }
+   cs->chip[ n->chip_addr ].valid++;
+   cs->chip[ n->chip_addr ].hashes += 1ULL << n->diff;
+   if ( n->verdict != ASIC_NONCE_SHARE )
+      return;
+
+   // the slot may have been reused or made stale while verifying
+   if ( job->seq != n->seq || !asic_job_current( job ) )
+   {
+      cs->stale++;
+      return;
+   }
+
+   *algo_gate.get_nonceptr( job->work.data ) = n->nonce;
+   work_set_target_ratio( &job->work, n->hash );
+   if ( submit_work( thr, &job->work ) )
+   {
+      cs->shares++;
+      if ( opt_debug )
+      {
+         struct timeval now, diff;
+         gettimeofday( &now, NULL );
+         timeval_subtract( &diff, &now, &job->sent );
+         applog( LOG_DEBUG, "ASIC: chain %d chip %d share %08x, %.1f ms after job",
+                 n->chain_id, n->chip_addr, n->nonce,
+                 diff.tv_sec * 1e3 + diff.tv_usec / 1e3 );
+      }
+   }
+   else
+      applog( LOG_WARNING, "ASIC: failed to submit share" );
+}
+
+static void asic_judge( struct asic_nonce *n )
+{
+   if ( fulltest( n->hash, n->target ) )
+      n->verdict = ASIC_NONCE_SHARE;
+   else if ( asic_zero_bits( n->hash ) >= n->diff )
+      n->verdict = ASIC_NONCE_VALID;
+   else
+      n->verdict = ASIC_NONCE_INVALID;
+}
+
+static void *asic_verify_thread( void *arg )
+{
+   const struct timespec now = { 0, 0 };     // already expired, don't wait
+   uint32_t vdata[20*4] __attribute__ ((aligned (64)));
+   uint32_t vhash[8*4] __attribute__ ((aligned (64)));
+   struct asic_nonce *batch[4];
+   int id = (int)(intptr_t)arg;
+
+   if ( !algo_gate.asic_thread_init( asic_thr_id ) )
+   {
+      applog( LOG_ERR, "ASIC verifier %d init failed", id );
+      return NULL;
+   }
+
+   while ( 1 )
+   {
+      int cnt = 0, i;
+
+      batch[0] = (struct asic_nonce*) tq_pop( asic_verify_q, NULL );
+      if ( !batch[0] )
+         continue;
+      cnt = 1;
+      while ( cnt < 4 && ( batch[cnt] =
+                 (struct asic_nonce*) tq_pop( asic_verify_q, &now ) ) )
+         cnt++;
+
+      if ( cnt > 1 && algo_gate.asic_hash_4way )
+      {
+         // idle lanes repeat the last header and are ignored
+         mm_interleave_4x32( vdata, batch[0]->edata, batch[1]->edata,
+                             batch[ cnt > 2 ? 2 : 1 ]->edata,
+                             batch[ cnt > 3 ? 3 : cnt - 1 ]->edata, 640 );
+         algo_gate.asic_hash_4way( vhash, vdata );
+         for ( i = 0; i < cnt; i++ )
+            memcpy( batch[i]->hash, vhash + ( i << 3 ), 32 );
+      }
+      else
+         for ( i = 0; i < cnt; i++ )
+            algo_gate.asic_hash( batch[i]->hash, batch[i]->edata );
+
+      for ( i = 0; i < cnt; i++ )
+      {
+         asic_judge( batch[i] );
+         if ( !tq_push( asic_done_q, batch[i] ) )
+            free( batch[i] );
+      }
+      drv_wakeup();
+   }
+
+   return NULL;
+}
+
+// Refresh chip hashrates, returns the fastest chip's rate.
+static double asic_update_rates( double elapsed )
+{
+   double best = 0.;
+
+   for ( int c = 0; c < asic_stats_chains; c++ )
+   {
+      struct asic_chain_stats *cs = &asic_stats[c];
+
+      cs->hashrate = 0.;
+      for ( int i = 0; i < 256; i++ )
+      {
+         struct asic_chip_stats *st = &cs->chip[i];
+
+         st->hashrate = ( st->hashes - st->rate_hashes ) / elapsed;
+         st->rate_hashes = st->hashes;
+         cs->hashrate += st->hashrate;
+         if ( st->hashrate > best )
+            best = st->hashrate;
+      }
+   }
+   return best;
+}
+
+static bool asic_start_verifiers()
+{
+   asic_verify_q = tq_new();
+   asic_done_q = tq_new();
+   if ( !asic_verify_q || !asic_done_q )
+      return false;
+
+   for ( int i = 0; i < opt_asic_verify; i++ )
+   {
+      pthread_t th;
+      if ( pthread_create( &th, NULL, asic_verify_thread, (void*)(intptr_t)i ) )
+         return false;
+      pthread_detach( th );
+   }
+   return true;
+}
+
+void *asic_thread( void *userdata )
+{
+   const struct timespec now = { 0, 0 };
+   struct thr_info *mythr = (struct thr_info *) userdata;
+   struct drv_nonce_pkg pkg;
+   struct asic_nonce *n;
+   double last_send = 0., last_rate, last_diff, roll = opt_scantime;
+
+   if ( !have_stratum )
+   {
+      applog( LOG_ERR, "ASIC mining needs a stratum pool" );
+      return NULL;
+   }
+   if ( !algo_gate.asic_thread_init( mythr->id ) )
+   {
+      applog( LOG_ERR, "ASIC mining is not supported for %s",
+              algo_names[opt_algo] );
+      return NULL;
+   }
+
+   asic_stats = (struct asic_chain_stats*)
+                calloc( drv_get_chain_num(), sizeof *asic_stats );
+   asic_ctl = (struct asic_diff_ctl*)
+              calloc( drv_get_chain_num(), sizeof *asic_ctl );
+   if ( !asic_stats || !asic_ctl || !asic_start_verifiers() )
+   {
+      applog( LOG_ERR, "ASIC scheduler init failed" );
+      return NULL;
+   }
+   asic_stats_chains = drv_get_chain_num();
+   // start high, the first adjustment brings it down to what the chips
+   // and links actually do
+   for ( int c = 0; c < asic_stats_chains; c++ )
+   {
+      asic_stats[c].diff = ASIC_MAX_DIFF;
+      asic_ctl[c].rate_diff = asic_ctl[c].link_diff = ASIC_MAX_DIFF;
+   }
+   applog( LOG_INFO, "ASIC scheduler started on %d chain(s), %d verifier(s)",
+           asic_stats_chains, opt_asic_verify );
+   last_rate = last_diff = asic_now();
+
+   while ( 1 )
+   {
+      double now_s = asic_now();
+
+      // wait for the first job, an idle chain says nothing about its chips
+      if ( now_s - last_diff >= ASIC_DIFF_SECS )
+      {
+         if ( asic_seq )
+            asic_adjust_diff( now_s - last_diff );
+         last_diff = now_s;
+      }
+
+      if ( now_s - last_rate >= ASIC_RATE_SECS )
+      {
+         double best = asic_update_rates( now_s - last_rate );
+         uint32_t region = drv_get_region_size();
+
+         // Roll extranonce2 before the fastest chip runs out of its
+         // nonce region, or every scantime, whichever comes first.
+         roll = opt_scantime;
+         if ( best > 0. && region && region / best * 0.75 < roll )
+            roll = region / best * 0.75;
+         last_rate = now_s;
+      }
+
+      // New stratum jobs go out at once, otherwise roll the work so
+      // chips never idle at the end of their region.
+      if ( __atomic_exchange_n( &asic_pending, 0, __ATOMIC_SEQ_CST )
+           || now_s - last_send >= roll )
+      {
+         if ( asic_send_job() )
+            last_send = now_s;
+      }
+
+      if ( drv_get_nonce( &pkg, ASIC_POLL_MS ) > 0
+           && pkg.chain_id < asic_stats_chains )
+         asic_queue_nonces( &pkg );
+
+      while ( ( n = (struct asic_nonce*) tq_pop( asic_done_q, &now ) ) )
+      {
+         asic_handle_verdict( mythr, n );
+         free( n );
+      }
+   }
+
+   return NULL;
+}
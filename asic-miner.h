@@ -0,0 +1,69 @@
+#ifndef ASIC_MINER_H__
+#define ASIC_MINER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Jobs are tracked by the chip's 8 bit message id.
+#define ASIC_MAX_JOBS      256
+// Range of the chip difficulty, the leading zero bits a nonce needs before
+// the chip reports it.
+#define ASIC_MIN_DIFF      4
+#define ASIC_MAX_DIFF      15
+// The chip difficulty is adjusted this often.
+#define ASIC_DIFF_SECS     10
+// Nonce reports may use up to this share of a chain's UART bandwidth.
+#define ASIC_LINK_SHARE    0.5
+// A one nonce report is 13 bytes, 10 bits each on the wire.
+#define ASIC_NONCE_BITS    130
+// Default for --asic-nonce-rate.
+#define ASIC_NONCE_RATE    1.0
+// Longest the scheduler sleeps in the driver before checking for work.
+#define ASIC_POLL_MS       100
+// Upper bound for --asic-verify.
+#define ASIC_MAX_VERIFY    16
+// Per job nonce history used to spot duplicates, power of 2.
+#define ASIC_SEEN_SLOTS    512
+// Chip hashrates are estimated from returned nonces over this period.
+#define ASIC_RATE_SECS     30
+
+extern bool opt_asic;
+extern int  opt_asic_verify;
+extern char *opt_uart_trace;
+extern double opt_asic_nonce_rate;
+extern int  asic_thr_id;
+
+// Counters for one chip, valid means at least the chip difficulty.
+// Each valid nonce at difficulty d stands for 2^d hashes on average.
+struct asic_chip_stats
+{
+   uint64_t valid;
+   uint64_t invalid;
+   uint64_t dup;
+   uint64_t hashes;
+   uint64_t rate_hashes; // hashes at the last rate update
+   double   hashrate;
+};
+
+struct asic_chain_stats
+{
+   uint64_t shares;      // nonces that met the pool target
+   uint64_t stale;       // nonces for jobs already replaced
+   uint64_t dropped;     // nonces the verify queue had no room for
+   double   hashrate;
+   double   nonce_rate;  // valid nonces/s seen by the difficulty control
+   int      diff;        // chip difficulty currently sent to the chain
+   struct asic_chip_stats chip[256];
+};
+
+// One entry per chain, NULL until the ASIC thread has started.
+extern struct asic_chain_stats *asic_stats;
+extern int asic_stats_chains;
+
+// Called by the stratum thread whenever stratum_gen_work has a new job.
+// A clean job makes every nonce from earlier jobs stale.
+void  asic_new_job( bool clean );
+
+void *asic_thread( void *userdata );
+
+#endif
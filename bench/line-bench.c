@@ -0,0 +1,303 @@
+/*
+ * Stratum line reader benchmark.
+ *
+ * Feeds pool traffic through the line_buf reader of stratum_recv_line
+ * and, for comparison, through the strstr, strcpy, strtok, strdup and
+ * memmove reader it replaced, and checks both hand out the same lines.
+ * The traffic is "received" from memory in chunks of -c bytes, a TCP
+ * segment by default, so only the readers are measured.
+ *
+ * The traffic is a file of raw bytes as received from a pool, -f, or a
+ * generated stream of mining.notify lines with -m merkle branches and
+ * the usual set_difficulty and submit answers, with a getblocktemplate
+ * sized line of -g KiB every 64 lines if -g is given.
+ *
+ *   line-bench [-f traffic] [-n lines] [-m branches] [-g KiB] [-c chunk]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "line-buf.h"
+
+static int opt_lines = 20000;
+static int opt_branches = 12;
+static int opt_gbt_kib = 0;
+static int opt_chunk = 1448;
+
+static char  *traffic;
+static size_t traffic_len;
+static size_t traffic_pos;
+
+struct bench_sum
+{
+   uint64_t lines;
+   uint64_t bytes;
+   uint64_t hash;
+};
+
+// recv from the traffic, at most one chunk
+static size_t fake_recv( char *buf, size_t room )
+{
+   size_t n = traffic_len - traffic_pos;
+
+   if ( n > (size_t)opt_chunk )
+      n = opt_chunk;
+   if ( n > room )
+      n = room;
+   memcpy( buf, traffic + traffic_pos, n );
+   traffic_pos += n;
+   return n;
+}
+
+// What a caller does with a line at the least, look at every byte.
+static void consume( struct bench_sum *sum, const char *line )
+{
+   size_t len = strlen( line );
+   uint64_t h = sum->hash;
+
+   if ( len && line[ len - 1 ] == '\r' )
+      len--;
+   for ( size_t i = 0; i < len; i++ )
+      h = ( h ^ (uint8_t)line[i] ) * 0x100000001b3ULL;
+   sum->hash = h;
+   sum->bytes += len;
+   sum->lines++;
+}
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The reader stratum_recv_line used to be.
+#define OLD_RBUFSIZE 2048
+#define OLD_RECVSIZE (OLD_RBUFSIZE - 4)
+
+static char  *old_sockbuf;
+static size_t old_sockbuf_size;
+
+static void old_buffer_append( const char *s )
+{
+   size_t old, n;
+
+   old = strlen( old_sockbuf );
+   n = old + strlen( s ) + 1;
+   if ( n >= old_sockbuf_size )
+   {
+      old_sockbuf_size = n + ( OLD_RBUFSIZE - ( n % OLD_RBUFSIZE ) );
+      old_sockbuf = (char*) realloc( old_sockbuf, old_sockbuf_size );
+   }
+   strcpy( old_sockbuf + old, s );
+}
+
+static char *old_recv_line()
+{
+   ssize_t len, buflen;
+   char *tok;
+
+   if ( !strstr( old_sockbuf, "\n" ) )
+   {
+      do
+      {
+         char s[ OLD_RBUFSIZE ];
+
+         memset( s, 0, OLD_RBUFSIZE );
+         if ( !fake_recv( s, OLD_RECVSIZE ) )
+            break;
+         old_buffer_append( s );
+      } while ( !strstr( old_sockbuf, "\n" ) );
+   }
+
+   buflen = (ssize_t) strlen( old_sockbuf );
+   tok = strtok( old_sockbuf, "\n" );
+   if ( !tok )
+      return NULL;
+   tok = strdup( tok );
+   len = (ssize_t) strlen( tok );
+   if ( buflen > len + 1 )
+      memmove( old_sockbuf, old_sockbuf + len + 1, buflen - len + 1 );
+   else
+      old_sockbuf[0] = '\0';
+   return tok;
+}
+
+static void run_old( struct bench_sum *sum )
+{
+   char *line;
+
+   old_sockbuf_size = OLD_RBUFSIZE;
+   old_sockbuf = (char*) calloc( OLD_RBUFSIZE, 1 );
+   while ( ( line = old_recv_line() ) )
+   {
+      consume( sum, line );
+      free( line );
+   }
+   free( old_sockbuf );
+}
+
+static bool run_new( struct bench_sum *sum )
+{
+   struct line_buf lb;
+   char *line;
+
+   if ( !line_buf_init( &lb ) )
+      return false;
+   while ( 1 )
+   {
+      size_t room, n;
+      char *p;
+
+      while ( ( line = line_buf_next( &lb, NULL ) ) )
+         consume( sum, line );
+      if ( !( p = line_buf_space( &lb, &room ) ) )
+         break;
+      if ( !( n = fake_recv( p, room ) ) )
+         break;
+      line_buf_commit( &lb, n );
+   }
+   line_buf_free( &lb );
+   return true;
+}
+
+static void put( size_t *cap, const char *s, size_t n )
+{
+   if ( traffic_len + n > *cap )
+   {
+      *cap = ( traffic_len + n ) * 2;
+      traffic = (char*) realloc( traffic, *cap );
+   }
+   memcpy( traffic + traffic_len, s, n );
+   traffic_len += n;
+}
+
+static void generate()
+{
+   char line[ 4096 + 80 * 64 ];
+   size_t cap = 0;
+
+   srand( 1 );
+   for ( int i = 0; i < opt_lines; i++ )
+   {
+      int n;
+
+      if ( opt_gbt_kib && i % 64 == 63 )
+      {
+         // a template full of transaction hex
+         size_t len = (size_t)opt_gbt_kib * 1024;
+         char *gbt = (char*) malloc( len + 1 );
+
+         n = sprintf( gbt, "{\"id\":%d,\"result\":{\"transactions\":[\"", i );
+         for ( size_t j = n; j < len - 5; j++ )
+            gbt[j] = "0123456789abcdef"[ rand() & 15 ];
+         memcpy( gbt + len - 5, "\"]}}\n", 5 );
+         put( &cap, gbt, len );
+         free( gbt );
+      }
+      else if ( i % 8 == 1 )
+      {
+         n = sprintf( line, "{\"id\":%d,\"result\":true,\"error\":null}\n", i );
+         put( &cap, line, n );
+      }
+      else if ( i % 32 == 2 )
+      {
+         n = sprintf( line, "{\"id\":null,\"method\":\"mining.set_difficulty\""
+                      ",\"params\":[%d]}\n", 1 + rand() % 1000 );
+         put( &cap, line, n );
+      }
+      else
+      {
+         n = sprintf( line, "{\"id\":null,\"method\":\"mining.notify\","
+                      "\"params\":[\"%x\",\"%064x\",\"0100000001000000000000"
+                      "00000000000000000000000000000000000000000000000000ffff"
+                      "ffff20\",\"ffffffff0100f2052a010000001976a914000000000"
+                      "0000000000000000000000000000088ac00000000\",[", i, rand() );
+         for ( int b = 0; b < opt_branches && b < 64; b++ )
+            n += sprintf( line + n, b ? ",\"%064x\"" : "\"%064x\"", rand() );
+         n += sprintf( line + n, "],\"20000000\",\"1d00ffff\",\"%08x\",%s]}\n",
+                       (unsigned)time( NULL ), i % 4 ? "false" : "true" );
+         put( &cap, line, n );
+      }
+   }
+}
+
+static bool load( const char *path )
+{
+   FILE *f = fopen( path, "rb" );
+   size_t cap = 0, n;
+   char buf[ 65536 ];
+
+   if ( !f )
+   {
+      perror( path );
+      return false;
+   }
+   while ( ( n = fread( buf, 1, sizeof buf, f ) ) )
+      put( &cap, buf, n );
+   fclose( f );
+   return true;
+}
+
+int main( int argc, char *argv[] )
+{
+   struct bench_sum old_sum = { 0, 0, 0xcbf29ce484222325ULL };
+   struct bench_sum new_sum = old_sum;
+   const char *path = NULL;
+   uint64_t t_old, t_new;
+   bool ok;
+   int c;
+
+   while ( ( c = getopt( argc, argv, "f:n:m:g:c:h" ) ) != -1 )
+   {
+      switch ( c )
+      {
+         case 'f': path = optarg; break;
+         case 'n': opt_lines = atoi( optarg ); break;
+         case 'm': opt_branches = atoi( optarg ); break;
+         case 'g': opt_gbt_kib = atoi( optarg ); break;
+         case 'c': opt_chunk = atoi( optarg ); break;
+         default:
+            fprintf( stderr, "usage: %s [-f traffic] [-n lines] [-m branches]"
+                     " [-g KiB] [-c chunk]\n", argv[0] );
+            return 1;
+      }
+   }
+   if ( opt_lines < 1 || opt_chunk < 1 || opt_gbt_kib < 0 )
+      return 1;
+   if ( path )
+   {
+      if ( !load( path ) )
+         return 1;
+   }
+   else
+      generate();
+   if ( !traffic_len )
+      return 1;
+
+   traffic_pos = 0;
+   t_old = now_ns();
+   run_old( &old_sum );
+   t_old = now_ns() - t_old;
+
+   traffic_pos = 0;
+   t_new = now_ns();
+   ok = run_new( &new_sum );
+   t_new = now_ns() - t_new;
+
+   ok = ok && old_sum.lines == new_sum.lines && old_sum.hash == new_sum.hash;
+   printf( "  %.2f MiB, %llu lines, %d byte chunks\n", traffic_len / 1048576.,
+           (unsigned long long)old_sum.lines, opt_chunk );
+   printf( "  reader   ns/line      MiB/s\n" );
+   printf( "  old     %9.0f  %9.1f\n", (double)t_old / old_sum.lines,
+           traffic_len * 1e9 / 1048576. / t_old );
+   printf( "  new     %9.0f  %9.1f  %s\n", (double)t_new / new_sum.lines,
+           traffic_len * 1e9 / 1048576. / t_new, ok ? "ok" : "MISMATCH" );
+   free( traffic );
+   return ok ? 0 : 1;
+}
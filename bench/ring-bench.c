@@ -0,0 +1,300 @@
+/*
+ * Chain ring benchmark: the lock-free SPSC rt_ringbuffer against the
+ * mutex and condvar ring it replaced.
+ *
+ * One producer puts -n records of -s bytes into a blocking ring of 256
+ * records, the depth the driver gives its chain rings, and one consumer
+ * gets them, the way the dispatch thread hands nonce frames to the miner
+ * and the scheduler hands work frames to a send thread. Every record
+ * carries its sequence number, checked on arrival, and the time it was
+ * put, so the consumer sees the latency from put to get.
+ *
+ * Prints ops/s and the average, median, 99th, 99.9th percentile and
+ * worst put to get latency for both rings, by default for records the
+ * size of a nonce frame and of a work frame. Flat out the ring is always
+ * full and the latency is mostly queueing, so each size also runs with
+ * the producer paced to -r records/s, where the consumer sleeps between
+ * records and the latency is that of waking it.
+ *
+ *   ring-bench [-s size] [-n records] [-r rate]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "ringbuffer.h"
+
+// Latency histogram, log2 buckets of nanoseconds.
+#define BENCH_BUCKETS  40
+
+#define BENCH_DEPTH    256
+
+enum bench_mode { MODE_LOCK, MODE_SPSC };
+
+struct bench_rec
+{
+   uint64_t t_put;
+   uint32_t seq;
+};
+
+static int opt_records = 2000000;
+static int opt_rate = 100000;
+
+static enum bench_mode mode;
+static struct rt_ringbuffer spsc;
+static uint32_t rec_size;
+static int rate;
+static int records;
+static volatile int go;
+
+// The ring rt_ringbuffer used to be: 15 bit indices with a mirror bit,
+// one mutex around both sides and a condvar each way.
+static struct
+{
+   unsigned char *buffer_ptr;
+   unsigned short read_mirror : 1;
+   unsigned short read_index  : 15;
+   unsigned short write_mirror : 1;
+   unsigned short write_index  : 15;
+   unsigned short buffer_size;
+   pthread_mutex_t lock;
+   pthread_cond_t  notfull;
+   pthread_cond_t  notempty;
+} old;
+
+static uint16_t old_data_len()
+{
+   if ( old.read_index == old.write_index )
+      return old.read_mirror == old.write_mirror ? 0 : old.buffer_size;
+   if ( old.write_index > old.read_index )
+      return old.write_index - old.read_index;
+   return old.buffer_size - ( old.read_index - old.write_index );
+}
+
+static void old_init( uint8_t *pool, uint16_t size )
+{
+   old.read_mirror = old.read_index = 0;
+   old.write_mirror = old.write_index = 0;
+   old.buffer_ptr = pool;
+   old.buffer_size = RT_ALIGN_DOWN( size, RT_ALIGN_SIZE );
+   pthread_mutex_init( &old.lock, NULL );
+   pthread_cond_init( &old.notfull, NULL );
+   pthread_cond_init( &old.notempty, NULL );
+}
+
+static void old_put( const uint8_t *ptr, uint16_t length )
+{
+   pthread_mutex_lock( &old.lock );
+   while ( old.buffer_size - old_data_len() < length )
+      pthread_cond_wait( &old.notfull, &old.lock );
+
+   if ( old.buffer_size - old.write_index > length )
+   {
+      memcpy( &old.buffer_ptr[ old.write_index ], ptr, length );
+      old.write_index += length;
+   }
+   else
+   {
+      uint16_t first = old.buffer_size - old.write_index;
+
+      memcpy( &old.buffer_ptr[ old.write_index ], ptr, first );
+      memcpy( &old.buffer_ptr[0], ptr + first, length - first );
+      old.write_mirror = ~old.write_mirror;
+      old.write_index = length - first;
+   }
+   pthread_cond_signal( &old.notempty );
+   pthread_mutex_unlock( &old.lock );
+}
+
+static void old_get( uint8_t *ptr, uint16_t length )
+{
+   pthread_mutex_lock( &old.lock );
+   while ( old_data_len() < length )
+      pthread_cond_wait( &old.notempty, &old.lock );
+
+   if ( old.buffer_size - old.read_index > length )
+   {
+      memcpy( ptr, &old.buffer_ptr[ old.read_index ], length );
+      old.read_index += length;
+   }
+   else
+   {
+      uint16_t first = old.buffer_size - old.read_index;
+
+      memcpy( ptr, &old.buffer_ptr[ old.read_index ], first );
+      memcpy( ptr + first, &old.buffer_ptr[0], length - first );
+      old.read_mirror = ~old.read_mirror;
+      old.read_index = length - first;
+   }
+   pthread_cond_signal( &old.notfull );
+   pthread_mutex_unlock( &old.lock );
+}
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *producer_thread( void *arg )
+{
+   uint8_t buf[ 512 ] = { 0 };
+   struct bench_rec *r = (struct bench_rec*) buf;
+   uint64_t next;
+
+   (void)arg;
+   while ( !go );
+   next = now_ns();
+   for ( int i = 0; i < records; i++ )
+   {
+      // sleep rather than spin, the consumer may share the cpu
+      if ( rate )
+      {
+         struct timespec ts;
+
+         next += 1000000000ull / rate;
+         ts.tv_sec = next / 1000000000ull;
+         ts.tv_nsec = next % 1000000000ull;
+         clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+      }
+      r->seq = i;
+      r->t_put = now_ns();
+      if ( mode == MODE_SPSC )
+         rt_ringbuffer_put( &spsc, buf, rec_size );
+      else
+         old_put( buf, rec_size );
+   }
+   return NULL;
+}
+
+// Upper bound of the bucket holding the p-th fraction of n.
+static uint64_t pct( const uint64_t *hist, uint64_t n, double p )
+{
+   uint64_t seen = 0;
+
+   for ( int b = 0; b < BENCH_BUCKETS; b++ )
+   {
+      seen += hist[b];
+      if ( seen >= n * p )
+         return 1ull << ( b + 1 );
+   }
+   return 0;
+}
+
+static bool run( enum bench_mode m, uint32_t size, int r_rate, int n )
+{
+   uint32_t len = rt_ringbuffer_roundup( size * BENCH_DEPTH );
+   uint8_t *pool = (uint8_t*) calloc( 1, len );
+   uint8_t buf[ 512 ];
+   struct bench_rec *r = (struct bench_rec*) buf;
+   uint64_t hist[ BENCH_BUCKETS ] = { 0 };
+   uint64_t sum = 0, max = 0, t0;
+   pthread_t th;
+   bool ok = true;
+
+   mode = m;
+   rec_size = size;
+   rate = r_rate;
+   records = n;
+   if ( m == MODE_SPSC )
+      rt_ringbuffer_init( &spsc, pool, len, BLOCK_TYPE );
+   else
+      old_init( pool, size * BENCH_DEPTH );
+
+   go = 0;
+   pthread_create( &th, NULL, producer_thread, NULL );
+   t0 = now_ns();
+   go = 1;
+   for ( int i = 0; i < n; i++ )
+   {
+      uint64_t d;
+      int b = 0;
+
+      if ( m == MODE_SPSC )
+         rt_ringbuffer_get( &spsc, buf, size );
+      else
+         old_get( buf, size );
+      d = now_ns() - r->t_put;
+
+      if ( r->seq != (uint32_t)i && ok )
+      {
+         fprintf( stderr, "record %d: got %u\n", i, r->seq );
+         ok = false;
+      }
+      sum += d;
+      if ( d > max )
+         max = d;
+      while ( b < BENCH_BUCKETS - 1 && ( 1ull << ( b + 1 ) ) <= d )
+         b++;
+      hist[b]++;
+   }
+   t0 = now_ns() - t0;
+   pthread_join( th, NULL );
+
+   if ( m == MODE_LOCK )
+   {
+      pthread_mutex_destroy( &old.lock );
+      pthread_cond_destroy( &old.notfull );
+      pthread_cond_destroy( &old.notempty );
+   }
+   free( pool );
+
+   printf( "  %-4s %4u  %7d  %6.2f  %8.0f  %9llu %9llu %9llu  %8.1f  %s\n",
+           m == MODE_LOCK ? "lock" : "spsc", size, r_rate, n * 1e3 / t0,
+           (double)sum / n, (unsigned long long)pct( hist, n, 0.5 ),
+           (unsigned long long)pct( hist, n, 0.99 ),
+           (unsigned long long)pct( hist, n, 0.999 ), max / 1e3,
+           ok ? "ok" : "FAILED" );
+   return ok;
+}
+
+int main( int argc, char *argv[] )
+{
+   // a nonce record, 9 byte frame and chain id, needs room for the
+   // bench header, and a work frame
+   uint32_t sizes[] = { sizeof( struct bench_rec ), 6 + 86 };
+   int nsizes = 2, paced;
+   bool ok = true;
+   int c;
+
+   while ( ( c = getopt( argc, argv, "s:n:r:h" ) ) != -1 )
+   {
+      switch ( c )
+      {
+         case 's': sizes[0] = atoi( optarg ); nsizes = 1; break;
+         case 'n': opt_records = atoi( optarg ); break;
+         case 'r': opt_rate = atoi( optarg ); break;
+         default:
+            fprintf( stderr, "usage: %s [-s size] [-n records] [-r rate]\n",
+                     argv[0] );
+            return 1;
+      }
+   }
+   if ( opt_records < 1 || opt_rate < 1
+        || sizes[0] < sizeof( struct bench_rec ) || sizes[0] > 255 )
+   {
+      fprintf( stderr, "size is %u..255 bytes\n",
+               (unsigned)sizeof( struct bench_rec ) );
+      return 1;
+   }
+
+   // paced runs last two seconds
+   paced = opt_rate * 2 < opt_records ? opt_rate * 2 : opt_records;
+
+   printf( "  ring size     rate  Mops/s  avg (ns)  p50 (<ns) p99 (<ns) "
+           "p99.9(<ns)  max us\n" );
+   for ( int i = 0; i < nsizes; i++ )
+   {
+      ok = run( MODE_LOCK, sizes[i], 0, opt_records ) && ok;
+      ok = run( MODE_SPSC, sizes[i], 0, opt_records ) && ok;
+      ok = run( MODE_LOCK, sizes[i], opt_rate, paced ) && ok;
+      ok = run( MODE_SPSC, sizes[i], opt_rate, paced ) && ok;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+/*
+ * Thread queue stress benchmark: tq_push latency under many producers.
+ *
+ * -p producer threads each push -n entries into one queue, the way miner
+ * threads submit shares to the workio thread and the ASIC scheduler
+ * queues nonces for the verify threads, while consumers pop them with
+ * blocking tq_pop. Every entry is checked to arrive exactly once, and in
+ * order per producer as seen by each consumer.
+ *
+ * Two loads run: a flood, all producers pushing as fast as they can into
+ * one consumer, and a paced one, each producer pushing -r entries/s for
+ * two seconds into -c consumers that sleep between entries, which is
+ * what the queues see while mining. A full tq_* queue fails the push, a
+ * flooding producer then yields and retries.
+ *
+ * It runs the lock-free tq_* queue and, for comparison, the mutex and
+ * condvar list it replaced, and prints per push latency (average, 99th
+ * percentile, worst), the latency from push to pop (99th percentile,
+ * worst) and overall throughput.
+ *
+ *   tq-bench [-p producers] [-n pushes] [-c consumers] [-r rate]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "miner.h"
+
+// Latency histogram, log2 buckets of nanoseconds.
+#define BENCH_BUCKETS  40
+
+// Ends a consumer, never a real entry: producer ids are below 2^31.
+#define BENCH_STOP  ( (uintptr_t)~0ull )
+
+enum bench_mode { MODE_LOCK, MODE_TQ };
+
+struct bench_hist
+{
+   uint64_t  hist[ BENCH_BUCKETS ];
+   uint64_t  n;
+   uint64_t  ns;
+   uint64_t  max;
+};
+
+struct bench_producer
+{
+   pthread_t th;
+   int       id;
+   uint64_t *t_push;          // when each entry was pushed
+   struct bench_hist push;
+} __attribute__ ((aligned (64)));
+
+struct bench_consumer
+{
+   pthread_t th;
+   uint32_t *last;            // last sequence seen from each producer
+   uint64_t  got;
+   bool      ok;
+   struct bench_hist deliver;
+} __attribute__ ((aligned (64)));
+
+static int opt_producers = 128;
+static int opt_pushes = 20000;
+static int opt_consumers = 4;
+static int opt_rate = 1000;
+
+static enum bench_mode mode;
+static struct thread_q *tq;
+static struct bench_producer *producers;
+static int n_producers, n_pushes, rate;
+static volatile int go;
+
+// The queue tq_* used to be: a mutex and condvar around a list, one
+// malloc per entry.
+struct lock_ent
+{
+   void *data;
+   struct lock_ent *next;
+};
+
+static struct
+{
+   struct lock_ent *head, *tail;
+   pthread_mutex_t mutex;
+   pthread_cond_t  cond;
+} lq = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void lock_push( void *data )
+{
+   struct lock_ent *e = (struct lock_ent*) calloc( 1, sizeof *e );
+
+   e->data = data;
+   pthread_mutex_lock( &lq.mutex );
+   if ( lq.tail )
+      lq.tail->next = e;
+   else
+      lq.head = e;
+   lq.tail = e;
+   pthread_cond_signal( &lq.cond );
+   pthread_mutex_unlock( &lq.mutex );
+}
+
+static void *lock_pop()
+{
+   struct lock_ent *e;
+   void *data = NULL;
+
+   pthread_mutex_lock( &lq.mutex );
+   if ( !lq.head )
+      pthread_cond_wait( &lq.cond, &lq.mutex );
+   if ( ( e = lq.head ) )
+   {
+      lq.head = e->next;
+      if ( !lq.head )
+         lq.tail = NULL;
+      data = e->data;
+      free( e );
+   }
+   pthread_mutex_unlock( &lq.mutex );
+   return data;
+}
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void hist_add( struct bench_hist *h, uint64_t d )
+{
+   int b = 0;
+
+   h->n++;
+   h->ns += d;
+   if ( d > h->max )
+      h->max = d;
+   while ( b < BENCH_BUCKETS - 1 && ( 1ull << ( b + 1 ) ) <= d )
+      b++;
+   h->hist[b]++;
+}
+
+static void hist_merge( struct bench_hist *to, const struct bench_hist *h )
+{
+   to->n += h->n;
+   to->ns += h->ns;
+   if ( h->max > to->max )
+      to->max = h->max;
+   for ( int b = 0; b < BENCH_BUCKETS; b++ )
+      to->hist[b] += h->hist[b];
+}
+
+// Upper bound of the bucket holding the 99th percentile.
+static uint64_t hist_p99( const struct bench_hist *h )
+{
+   uint64_t seen = 0;
+
+   for ( int b = 0; b < BENCH_BUCKETS; b++ )
+   {
+      seen += h->hist[b];
+      if ( seen * 100 >= h->n * 99 )
+         return 1ull << ( b + 1 );
+   }
+   return 0;
+}
+
+static void bench_push( void *data )
+{
+   if ( mode == MODE_TQ )
+      // a full queue fails the push, retry as a flooding caller would
+      // have to rather than drop, so every entry still arrives
+      while ( !tq_push( tq, data ) )
+         sched_yield();
+   else
+      lock_push( data );
+}
+
+static void *producer_thread( void *arg )
+{
+   struct bench_producer *p = (struct bench_producer*) arg;
+   uint64_t next;
+
+   while ( !go );
+   next = now_ns();
+   for ( int i = 0; i < n_pushes; i++ )
+   {
+      // entry is producer id and sequence, never NULL
+      void *data = (void*)( ( (uintptr_t)p->id << 32 ) | ( i + 1 ) );
+      uint64_t t0;
+
+      // sleep rather than spin, consumers may share the cpu
+      if ( rate )
+      {
+         struct timespec ts;
+
+         next += 1000000000ull / rate;
+         ts.tv_sec = next / 1000000000ull;
+         ts.tv_nsec = next % 1000000000ull;
+         clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+      }
+      t0 = now_ns();
+      p->t_push[i] = t0;
+      bench_push( data );
+      hist_add( &p->push, now_ns() - t0 );
+   }
+   return NULL;
+}
+
+static void *consumer_thread( void *arg )
+{
+   struct bench_consumer *c = (struct bench_consumer*) arg;
+
+   while ( 1 )
+   {
+      uintptr_t v = (uintptr_t)( mode == MODE_TQ ? tq_pop( tq, NULL )
+                                                 : lock_pop() );
+      uint64_t now = now_ns();
+      int id = v >> 32;
+      uint32_t seq = (uint32_t)v;
+
+      if ( v == BENCH_STOP )
+         break;
+      if ( !v )
+         continue;
+      if ( id >= n_producers || seq > (uint32_t)n_pushes
+           || seq <= c->last[id] )
+      {
+         if ( c->ok )
+            fprintf( stderr, "producer %d: got %u after %u\n",
+                     id, seq, c->last[id] );
+         c->ok = false;
+         continue;
+      }
+      c->last[id] = seq;
+      c->got++;
+      hist_add( &c->deliver, now - producers[id].t_push[ seq - 1 ] );
+   }
+   return NULL;
+}
+
+static bool run( enum bench_mode m, int n_prod, int n_cons, int pushes,
+                 int r )
+{
+   struct bench_consumer *co = (struct bench_consumer*)
+                               calloc( n_cons, sizeof *co );
+   struct bench_hist push = { { 0 } }, deliver = { { 0 } };
+   uint64_t total = (uint64_t)n_prod * pushes, got = 0, t0;
+   bool ok = true;
+
+   mode = m;
+   n_producers = n_prod;
+   n_pushes = pushes;
+   rate = r;
+   producers = (struct bench_producer*) calloc( n_prod, sizeof *producers );
+
+   go = 0;
+   for ( int i = 0; i < n_cons; i++ )
+   {
+      co[i].last = (uint32_t*) calloc( n_prod, sizeof *co[i].last );
+      co[i].ok = true;
+      pthread_create( &co[i].th, NULL, consumer_thread, &co[i] );
+   }
+   for ( int i = 0; i < n_prod; i++ )
+   {
+      producers[i].id = i;
+      producers[i].t_push = (uint64_t*) malloc( pushes * sizeof( uint64_t ) );
+      pthread_create( &producers[i].th, NULL, producer_thread, &producers[i] );
+   }
+
+   t0 = now_ns();
+   go = 1;
+   for ( int i = 0; i < n_prod; i++ )
+      pthread_join( producers[i].th, NULL );
+   for ( int i = 0; i < n_cons; i++ )
+      bench_push( (void*)BENCH_STOP );
+   for ( int i = 0; i < n_cons; i++ )
+      pthread_join( co[i].th, NULL );
+   t0 = now_ns() - t0;
+
+   for ( int i = 0; i < n_prod; i++ )
+   {
+      hist_merge( &push, &producers[i].push );
+      free( producers[i].t_push );
+   }
+   for ( int i = 0; i < n_cons; i++ )
+   {
+      hist_merge( &deliver, &co[i].deliver );
+      got += co[i].got;
+      ok = ok && co[i].ok;
+      free( co[i].last );
+   }
+   if ( got != total )
+   {
+      fprintf( stderr, "got %llu of %llu entries\n",
+               (unsigned long long)got, (unsigned long long)total );
+      ok = false;
+   }
+   free( producers );
+   free( co );
+
+   printf( "  %-4s %4d %4d %6d  %8.0f %9llu %10.1f  %9llu %10.1f  %7.2f  %s\n",
+           m == MODE_LOCK ? "lock" : "tq", n_prod, n_cons, r,
+           (double)push.ns / total, (unsigned long long)hist_p99( &push ),
+           push.max / 1e3, (unsigned long long)hist_p99( &deliver ),
+           deliver.max / 1e3, total * 1e3 / t0, ok ? "ok" : "FAILED" );
+   return ok;
+}
+
+int main( int argc, char *argv[] )
+{
+   bool ok;
+   int c, paced;
+
+   while ( ( c = getopt( argc, argv, "p:n:c:r:h" ) ) != -1 )
+   {
+      switch ( c )
+      {
+         case 'p': opt_producers = atoi( optarg ); break;
+         case 'n': opt_pushes = atoi( optarg ); break;
+         case 'c': opt_consumers = atoi( optarg ); break;
+         case 'r': opt_rate = atoi( optarg ); break;
+         default:
+            fprintf( stderr, "usage: %s [-p producers] [-n pushes] "
+                     "[-c consumers] [-r rate]\n", argv[0] );
+            return 1;
+      }
+   }
+   if ( opt_producers < 1 || opt_pushes < 1 || opt_consumers < 1
+        || opt_rate < 1 )
+      return 1;
+   if ( !( tq = tq_new() ) )
+      return 1;
+
+   // paced runs last two seconds
+   paced = opt_rate * 2 < opt_pushes ? opt_rate * 2 : opt_pushes;
+
+   printf( "                         push                  push to pop\n"
+           "  mode prod cons   rate  avg (ns) p99 (<ns)     max us  "
+           "p99 (<ns)     max us  Mpush/s\n" );
+   ok = run( MODE_LOCK, opt_producers, 1, opt_pushes, 0 );
+   ok = run( MODE_TQ, opt_producers, 1, opt_pushes, 0 ) && ok;
+   ok = run( MODE_LOCK, opt_producers, opt_consumers, paced, opt_rate ) && ok;
+   ok = run( MODE_TQ, opt_producers, opt_consumers, paced, opt_rate ) && ok;
+   tq_free( tq );
+   return ok ? 0 : 1;
+}
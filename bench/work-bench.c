@@ -0,0 +1,246 @@
+/*
+ * Job switch benchmark: g_work_lock against published work snapshots.
+ *
+ * Reader threads stand in for miner threads: every pass they pick up the
+ * current work the way miner_thread does, copying it when it changed, then
+ * "hash" for -s microseconds. One writer thread stands in for the stratum
+ * thread and builds a new job every -i microseconds, under the lock the
+ * way stratum_gen_work does, and in snapshot mode publishes it after.
+ *
+ * For 1, 2, 4 ... -t readers it prints the cost of one pass and the time
+ * from a job arriving until a reader runs on it (job switch), average
+ * and worst case over all readers and jobs.
+ *
+ *   work-bench [-t threads] [-j jobs] [-i interval_us] [-s scan_us]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "miner.h"
+#include "work-snap.h"
+
+#define BENCH_MAX_JOBS   4096
+
+enum bench_mode { MODE_LOCK, MODE_SNAP };
+
+struct bench_reader
+{
+   pthread_t th;
+   int       id;
+   uint64_t  passes;
+   uint64_t  pass_ns;
+   uint64_t  switches;
+   uint64_t  switch_ns;
+   uint64_t  switch_max;
+} __attribute__ ((aligned (64)));
+
+static int opt_threads = 0;
+static int opt_jobs = 200;
+static int opt_interval = 2000;
+static int opt_scan = 50;
+
+static enum bench_mode mode;
+static struct work g_work;
+static pthread_mutex_t g_work_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t job_ready[ BENCH_MAX_JOBS ];
+static volatile int running;
+
+// work-snap.c needs these, heap only versions of the pp-miner.c ones.
+void work_free( struct work *w )
+{
+   free( w->txs );
+   free( w->workid );
+   free( w->job_id );
+   free( w->xnonce2 );
+}
+
+void work_copy( struct work *dest, const struct work *src )
+{
+   memcpy( dest, src, sizeof(struct work) );
+   if ( src->txs )
+      dest->txs = strdup( src->txs );
+   if ( src->workid )
+      dest->workid = strdup( src->workid );
+   if ( src->job_id )
+      dest->job_id = strdup( src->job_id );
+   if ( src->xnonce2 )
+   {
+      dest->xnonce2 = (unsigned char*) malloc( src->xnonce2_len );
+      memcpy( dest->xnonce2, src->xnonce2, src->xnonce2_len );
+   }
+}
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void spin_us( int us )
+{
+   uint64_t end = now_ns() + us * 1000ull;
+   while ( now_ns() < end );
+}
+
+// What std_get_new_work does with a changed job, the job number is data[1].
+static void take_work( struct work *work, const struct work *g )
+{
+   if ( memcmp( work->data, g->data, 76 ) )
+   {
+      work_free( work );
+      work_copy( work, g );
+   }
+}
+
+static void *reader_thread( void *arg )
+{
+   struct bench_reader *r = (struct bench_reader*) arg;
+   struct work work;
+   uint32_t job = 0;
+
+   memset( &work, 0, sizeof work );
+   while ( running )
+   {
+      uint64_t t0 = now_ns(), t1;
+
+      if ( mode == MODE_LOCK )
+      {
+         pthread_mutex_lock( &g_work_lock );
+         take_work( &work, &g_work );
+         pthread_mutex_unlock( &g_work_lock );
+      }
+      else
+      {
+         const struct work_snap *snap = work_snap_acquire( r->id );
+         if ( snap )
+            take_work( &work, &snap->work );
+         work_snap_release( r->id );
+      }
+      t1 = now_ns();
+      r->passes++;
+      r->pass_ns += t1 - t0;
+
+      // the first work seen may be left over from the previous run
+      if ( work.data[1] != job && !job )
+         job = work.data[1];
+      else if ( work.data[1] != job )
+      {
+         uint64_t d;
+
+         job = work.data[1];
+         d = t1 - job_ready[ job % BENCH_MAX_JOBS ];
+         r->switches++;
+         r->switch_ns += d;
+         if ( d > r->switch_max )
+            r->switch_max = d;
+      }
+      spin_us( opt_scan );
+   }
+   work_free( &work );
+   return NULL;
+}
+
+// Roughly the cost of a merkle root and header build.
+static void build_job( struct work *w, uint32_t job )
+{
+   uint32_t h = job;
+
+   for ( int i = 0; i < 4000; i++ )
+      h = ( h ^ ( h >> 15 ) ) * 2654435761u + i;
+   work_free( w );
+   memset( w, 0, sizeof *w );
+   for ( int i = 2; i < 19; i++ )
+      w->data[i] = h + i;
+   w->data[1] = job;
+   w->job_id = strdup( "0123456789abcdef" );
+   w->xnonce2_len = 4;
+   w->xnonce2 = (unsigned char*) calloc( 1, 4 );
+}
+
+static void run( enum bench_mode m, int threads )
+{
+   struct bench_reader *rd = (struct bench_reader*)
+                             calloc( threads, sizeof *rd );
+   uint64_t passes = 0, pass_ns = 0, sw = 0, sw_ns = 0, sw_max = 0;
+
+   mode = m;
+   running = 1;
+   for ( int i = 0; i < threads; i++ )
+   {
+      rd[i].id = i;
+      pthread_create( &rd[i].th, NULL, reader_thread, &rd[i] );
+   }
+
+   for ( uint32_t j = 1; j <= (uint32_t)opt_jobs; j++ )
+   {
+      usleep( opt_interval );
+      // the job arrives now, building it is part of the switch
+      job_ready[ j % BENCH_MAX_JOBS ] = now_ns();
+      pthread_mutex_lock( &g_work_lock );
+      build_job( &g_work, j );
+      if ( m == MODE_SNAP )
+         work_snap_publish( &g_work, NULL );
+      pthread_mutex_unlock( &g_work_lock );
+   }
+
+   usleep( opt_interval );
+   running = 0;
+   for ( int i = 0; i < threads; i++ )
+   {
+      pthread_join( rd[i].th, NULL );
+      passes += rd[i].passes;
+      pass_ns += rd[i].pass_ns;
+      sw += rd[i].switches;
+      sw_ns += rd[i].switch_ns;
+      if ( rd[i].switch_max > sw_max )
+         sw_max = rd[i].switch_max;
+   }
+   free( rd );
+
+   printf( "  %-5s %4d  %10.0f  %13.2f  %13.2f\n",
+           m == MODE_LOCK ? "lock" : "snap", threads,
+           passes ? (double)pass_ns / passes : 0.,
+           sw ? sw_ns / 1e3 / sw : 0., sw_max / 1e3 );
+}
+
+int main( int argc, char *argv[] )
+{
+   int c;
+
+   opt_threads = sysconf( _SC_NPROCESSORS_ONLN );
+   while ( ( c = getopt( argc, argv, "t:j:i:s:h" ) ) != -1 )
+   {
+      switch ( c )
+      {
+         case 't': opt_threads = atoi( optarg ); break;
+         case 'j': opt_jobs = atoi( optarg ); break;
+         case 'i': opt_interval = atoi( optarg ); break;
+         case 's': opt_scan = atoi( optarg ); break;
+         default:
+            fprintf( stderr, "usage: %s [-t threads] [-j jobs] "
+                     "[-i interval_us] [-s scan_us]\n", argv[0] );
+            return 1;
+      }
+   }
+   if ( opt_threads < 1 || opt_jobs < 1 || opt_jobs >= BENCH_MAX_JOBS )
+      return 1;
+   if ( !work_snap_init( opt_threads ) )
+      return 1;
+
+   printf( "  mode   thr   pass (ns)  switch avg us  switch max us\n" );
+   for ( int t = 1; ; t *= 2 )
+   {
+      if ( t > opt_threads )
+         t = opt_threads;
+      run( MODE_LOCK, t );
+      run( MODE_SNAP, t );
+      if ( t == opt_threads )
+         break;
+   }
+   return 0;
+}
@@ -19,10 +19,9 @@ extern struct chip_api g_chip_api;
 extern struct comm_api g_comm_api;
 
 
-static uint8_t g_headHash[256];
-static int midd_send_work_to_rb(uint8_t *str, uint32_t len)
+static int midd_send_work_to_rb(struct std_chain_info *chain, uint8_t *str, uint32_t len)
 {
-	return rt_ringbuffer_put(&g_midd_api.bm_work_rb, str, len);
+	return rt_ringbuffer_put(&chain->work_rb, str, len);
 }
 
 static int midd_send_framedata_to_rb(uint8_t *str, uint32_t len, int idx)
@@ -32,7 +31,7 @@ static int midd_send_framedata_to_rb(uint8_t *str, uint32_t len, int idx)
 
 static int midd_recv_framedata(uint8_t *str, uint32_t len, uint8_t idx)
 {
-    if (g_midd_api.bm_reg_rb.block_flag == BLOCK_TYPE) {
+    if (g_midd_api.bm_data_response_rb[idx].block_flag == BLOCK_TYPE) {
         return  rt_ringbuffer_get(&g_midd_api.bm_data_response_rb[idx], str, len);
     } else {
         uint32_t rb_len = rt_ringbuffer_data_len(&g_midd_api.bm_data_response_rb[idx]);
@@ -45,37 +44,37 @@ static int midd_recv_framedata(uint8_t *str, uint32_t len, uint8_t idx)
 }
 
 
-static int midd_recv_work(uint8_t *str, uint32_t len)
+static int midd_recv_work(struct std_chain_info *chain, uint8_t *str, uint32_t len)
 {
-    if (g_midd_api.bm_nonce_rb.block_flag == BLOCK_TYPE) {
-        return rt_ringbuffer_get(&g_midd_api.bm_nonce_rb, str, len);
+    if (chain->nonce_rb.block_flag == BLOCK_TYPE) {
+        return rt_ringbuffer_get(&chain->nonce_rb, str, len);
     } else {
-        uint32_t rb_len = rt_ringbuffer_data_len(&g_midd_api.bm_nonce_rb);
+        uint32_t rb_len = rt_ringbuffer_data_len(&chain->nonce_rb);
         if (rb_len < len) {
             return rb_len;
         }
 
-        return rt_ringbuffer_get(&g_midd_api.bm_nonce_rb, str, len);
+        return rt_ringbuffer_get(&chain->nonce_rb, str, len);
     }
 }
 
-static int midd_recv_regdata(uint8_t *str, uint32_t len)
+static int midd_recv_regdata(struct std_chain_info *chain, uint8_t *str, uint32_t len)
 {
-    if (g_midd_api.bm_reg_rb.block_flag == BLOCK_TYPE) {
-        return  rt_ringbuffer_get(&g_midd_api.bm_reg_rb, str, len);
+    if (chain->reg_rb.block_flag == BLOCK_TYPE) {
+        return  rt_ringbuffer_get(&chain->reg_rb, str, len);
     } else {
-        uint32_t rb_len = rt_ringbuffer_data_len(&g_midd_api.bm_reg_rb);
+        uint32_t rb_len = rt_ringbuffer_data_len(&chain->reg_rb);
         if (rb_len < len) {
             return rb_len;
         }
 
-        return  rt_ringbuffer_get(&g_midd_api.bm_reg_rb, str, len);
+        return  rt_ringbuffer_get(&chain->reg_rb, str, len);
     }
 }
 
 static int midd_recv_pmonitor(uint8_t *str, uint32_t len)
 {
-    if (g_midd_api.bm_reg_rb.block_flag == BLOCK_TYPE) {
+    if (g_midd_api.bm_pmonitor_rb.block_flag == BLOCK_TYPE) {
         return  rt_ringbuffer_get(&g_midd_api.bm_pmonitor_rb, str, len);
     } else {
         uint32_t rb_len = rt_ringbuffer_data_len(&g_midd_api.bm_pmonitor_rb);
@@ -104,74 +103,162 @@ static int midd_ioctl_regtable(uint32_t oper_type, void *param)
     return g_chip_api.ioctl_regtable(oper_type, param);
 }
 
+struct midd_rx_parser
+{
+    int st;
+    int read_bytes;
+    uint32_t pkg_len;
+    uint8_t pkg[MAX_RESPOND_PKG_LEN];
+};
+
+static void midd_deliver_packet(struct std_chain_info *chain, struct midd_rx_parser *p,
+                                uint8_t *out_str)
+{
+    int rsp_type = 0;
+    int out_len = g_chip_api.parse_respond_pkg(p->pkg, p->pkg_len,
+                                               &rsp_type, out_str, MAX_NONCE_LEN);
+    if (out_len <= 0) {
+        chain->rx_stats.bad_frames++;
+        return;
+    }
+
+    chain->rx_stats.frames++;
+    out_str[out_len] = chain->chain_id;
+    out_len += 1;
+
+    switch (rsp_type)
+    {
+        case NONCE_RESPOND:
+            chain->rx_stats.nonce_frames++;
+            rt_ringbuffer_put(&chain->nonce_rb, out_str, out_len);
+            sem_post(&g_midd_api.nonce_sem);
+            break;
+        case REGISTER_RESPOND:
+            rt_ringbuffer_put(&chain->reg_rb, out_str, out_len);
+            sem_post(&chain->reg_sem);
+            break;
+        default:
+            applog(LOG_WARNING, "unknow receive type %d\n", rsp_type);
+            break;
+    }
+}
+
+/*
+ * Run the chip's frame state machine over everything buffered in
+ * chain->rx_buf. Returns the number of bytes consumed; a partial frame
+ * stays in the parser and the caller keeps the unconsumed tail.
+ */
+static uint32_t midd_parse_stream(struct std_chain_info *chain, struct midd_rx_parser *p,
+                                  uint8_t *out_str)
+{
+    uint32_t pos = 0;
+
+    while (chain->rx_len - pos >= (uint32_t)p->read_bytes)
+    {
+        uint8_t *str = chain->rx_buf + pos;
+        int prev_st = p->st;
+        int next_bytes = 1;
+        int parse_stage = g_chip_api.parse_respond_len(str, p->read_bytes, &next_bytes, &p->st);
+
+        if (parse_stage == PKG_PARSE_IDLE_STATE) {
+            /* a byte that broke the 0xaa 0x55 preamble may itself be the
+             * start of the next frame, so rescan it instead of dropping it */
+            if (prev_st == SEARCH_0X55) {
+                chain->rx_stats.dropped_bytes += p->pkg_len;
+            } else {
+                chain->rx_stats.dropped_bytes += p->read_bytes;
+                pos += p->read_bytes;
+            }
+            p->pkg_len = 0;
+            p->read_bytes = 1;
+            continue;
+        }
+
+        memcpy(p->pkg + p->pkg_len, str, p->read_bytes);
+        p->pkg_len += p->read_bytes;
+        pos += p->read_bytes;
+
+        if (parse_stage == PKG_PARSE_MIDDLE_STATE) {
+            p->read_bytes = next_bytes;
+        } else {
+            midd_deliver_packet(chain, p, out_str);
+            p->pkg_len = 0;
+            p->read_bytes = 1;
+        }
+    }
+
+    return pos;
+}
+
+static void midd_update_rx_rate(struct std_chain_info *chain, struct timeval *last,
+                                uint64_t *last_frames, uint64_t *last_bytes)
+{
+    struct timeval now;
+    double dt;
+
+    gettimeofday(&now, NULL);
+    dt = (now.tv_sec - last->tv_sec) + (now.tv_usec - last->tv_usec) / 1e6;
+    if (dt < 1.0)
+        return;
+
+    chain->rx_stats.fps = (chain->rx_stats.frames - *last_frames) / dt;
+    chain->rx_stats.bps = (chain->rx_stats.bytes - *last_bytes) / dt;
+    *last_frames = chain->rx_stats.frames;
+    *last_bytes = chain->rx_stats.bytes;
+    *last = now;
+}
+
 static void *midd_dispatch_packet(void *param)
 {
-    uint8_t rev_buf[MAX_RECV_LEN_EACH_TIME] = {0};
-    uint8_t complete_pkg[MAX_RECV_LEN_EACH_TIME] = {0};
-    uint8_t *p_complete_pkg = complete_pkg;
     uint8_t out_str[MAX_NONCE_LEN] = {0};
-	struct std_chain_info *chain = (struct std_chain_info *)param;
-    int out_len = 0;
-    int rsp_type = 0;
-    int read_bytes = 1;
-    int next_bytes = 1;
-    int parse_stage = 0;
-    int st = 0;
+    struct std_chain_info *chain = (struct std_chain_info *)param;
+    struct midd_rx_parser parser;
+    struct timeval rate_tv;
+    uint64_t rate_frames = 0, rate_bytes = 0;
 
     pthread_detach(pthread_self());
 
+    memset(&parser, 0, sizeof(parser));
+    parser.read_bytes = 1;
+    chain->rx_len = 0;
+    memset(&chain->rx_stats, 0, sizeof(chain->rx_stats));
+    gettimeofday(&rate_tv, NULL);
+
     applog(LOG_INFO, "[%s, %d] Chain %d, dev handle:%d", __FUNCTION__, __LINE__, chain->chain_id, chain->fd);
     while(1)
     {
-        z_msleep(20);
-        int len = g_comm_api.bm_recv(chain->fd, rev_buf, read_bytes);
-        if (len != read_bytes) {
-          //applog(LOG_INFO, "[%s, %d] Chain %d, dev handle:%d, data len:%d", __FUNCTION__, __LINE__, chain->chain_id, chain->fd, len);
-          continue;
+        /* sleep in the kernel until the tty has data, then drain it all */
+        int ready = g_comm_api.bm_poll(chain->fd, MIDD_RX_POLL_MS);
+        if (ready < 0) {
+            z_msleep(MIDD_RX_POLL_MS);
+            continue;
         }
 
-        parse_stage = g_chip_api.parse_respond_len(rev_buf, read_bytes, &next_bytes, &st);
-
-        if (parse_stage == PKG_PARSE_IDLE_STATE) {
-            read_bytes = 1;
-            p_complete_pkg = complete_pkg;
-            continue;
-        } else if (parse_stage == PKG_PARSE_MIDDLE_STATE) {
-            memcpy(p_complete_pkg, rev_buf, read_bytes);
-            p_complete_pkg += read_bytes;
-            read_bytes = next_bytes;
-        } else {
-            memcpy(p_complete_pkg, rev_buf, read_bytes);
-            p_complete_pkg += read_bytes;
-
-            out_len = g_chip_api.parse_respond_pkg(complete_pkg, p_complete_pkg-complete_pkg,
-                                                   &rsp_type, out_str, MAX_NONCE_LEN);
-            if (out_len > 0) {
-                out_str[out_len] = chain->chain_id;
-                out_len += 1;
-
-                switch (rsp_type)
-                {
-                    case NONCE_RESPOND:
-                        rt_ringbuffer_put(&g_midd_api.bm_nonce_rb, out_str, out_len);
-                        break;
-                    case REGISTER_RESPOND:
-                        rt_ringbuffer_put(&g_midd_api.bm_reg_rb, out_str, out_len);
-                        break;
-                    default:
-                        applog(LOG_WARNING, "unknow receive type %d\n", rsp_type);
-                        break;
-                }
+        if (ready > 0) {
+            int len = g_comm_api.bm_recv(chain->fd, chain->rx_buf + chain->rx_len,
+                                         MIDD_RX_BUF_LEN - chain->rx_len);
+            if (len > 0) {
+                chain->rx_len += len;
+                chain->rx_stats.bytes += len;
+
+                uint32_t used = midd_parse_stream(chain, &parser, out_str);
+                chain->rx_len -= used;
+                if (chain->rx_len > 0 && used > 0)
+                    memmove(chain->rx_buf, chain->rx_buf + used, chain->rx_len);
             }
-
-            p_complete_pkg = complete_pkg;
-            read_bytes = 1;
         }
+
+        midd_update_rx_rate(chain, &rate_tv, &rate_frames, &rate_bytes);
     }
 
     return NULL;
 }
 
+void midd_get_rx_stats(struct std_chain_info *chain, struct midd_rx_stats *stats)
+{
+    memcpy(stats, &chain->rx_stats, sizeof(*stats));
+}
+
 
 int start_dispatch_packet(void *param)
 {
@@ -194,22 +281,20 @@ void stop_dispatch_packet(void *param)
 static void *midd_send_work(void *param)
 {
     struct std_chain_info *chain = (struct std_chain_info *)param;
-    uint8_t *str = (uint8_t *)malloc(g_chip_api.chip.work_len);
-    if (str == NULL) {
-        printf("%s malloc failed\n", __func__);
-        exit(1);
-    }
+    struct cmd_header frame;
 
     pthread_detach(pthread_self());
     while(1)
     {
-        rt_ringbuffer_get(&g_midd_api.bm_work_rb, str, g_chip_api.chip.work_len);
-        g_chip_api.pack_work_pkg(str);
-        memcpy(g_headHash, &str[ZCASH_HEAD_OFFSET], ZCASH_HEAD_LEN);
-        g_comm_api.bm_send(chain->fd, str, g_chip_api.chip.work_len);
+        /* work frames are queued unpacked: header first, then data_len bytes */
+        rt_ringbuffer_get(&chain->work_rb, (uint8_t *)&frame, BM_CMD_HEADER_LEN);
+        if (frame.data_len)
+            rt_ringbuffer_get(&chain->work_rb, frame.data, frame.data_len);
+
+        int len = g_chip_api.pack_work_pkg((uint8_t *)&frame);
+        g_comm_api.bm_send(chain->fd, (uint8_t *)&frame, len);
     }
 
-    free(str);
     return NULL;
 }
 
@@ -268,7 +353,8 @@ void stop_send_work(void *param)
 
 void init_ringbuf(struct rt_ringbuffer *rb, uint32_t len, ringbuffer_type_t type) {
 
-    len  *= 300;
+    /* room for MIDD_RB_DEPTH records, rounded to the ring's power of two */
+    len = rt_ringbuffer_roundup(len * MIDD_RB_DEPTH);
     uint8_t *ptr = (uint8_t *)malloc(len);
     if (!ptr) {
         printf("%s malloc failed\n", __func__);
@@ -279,6 +365,26 @@ void init_ringbuf(struct rt_ringbuffer *rb, uint32_t len, ringbuffer_type_t type
     rt_ringbuffer_init(rb, ptr, len, type);
 }
 
+int midd_chain_init(struct std_chain_info *chain)
+{
+    init_ringbuf(&chain->nonce_rb, g_chip_api.chip.nonce_len, BLOCK_TYPE);
+    init_ringbuf(&chain->reg_rb, g_chip_api.chip.reg_len, BLOCK_TYPE);
+    init_ringbuf(&chain->work_rb, g_chip_api.chip.work_len, BLOCK_TYPE);
+    sem_init(&chain->reg_sem, 0, 0);
+    return 0;
+}
+
+void midd_chain_exit(struct std_chain_info *chain)
+{
+    rt_ringbuffer_lock_destory(&chain->nonce_rb);
+    rt_ringbuffer_lock_destory(&chain->reg_rb);
+    rt_ringbuffer_lock_destory(&chain->work_rb);
+    sem_destroy(&chain->reg_sem);
+    free(chain->nonce_rb.buffer_ptr);
+    free(chain->reg_rb.buffer_ptr);
+    free(chain->work_rb.buffer_ptr);
+}
+
 int midd_api_init()
 {
     g_midd_api.send_work        = midd_send_work_to_rb;
@@ -290,11 +396,9 @@ int midd_api_init()
     g_midd_api.send_framedata   = midd_send_framedata_to_rb;
     g_midd_api.recv_framedata   = midd_recv_framedata;
 
-    init_ringbuf(&g_midd_api.bm_nonce_rb, g_chip_api.chip.nonce_len, BLOCK_TYPE);
-    init_ringbuf(&g_midd_api.bm_reg_rb, g_chip_api.chip.reg_len, BLOCK_TYPE);
+    sem_init(&g_midd_api.nonce_sem, 0, 0);
     init_ringbuf(&g_midd_api.bm_pmonitor_rb, g_chip_api.chip.pm_len, BLOCK_TYPE);
     init_ringbuf(&g_midd_api.bm_bist_rb, g_chip_api.chip.bist_len, BLOCK_TYPE);
-    init_ringbuf(&g_midd_api.bm_work_rb, g_chip_api.chip.work_len, BLOCK_TYPE);
 
     for(int i=0; i<PLATFORM_DATAPATH_NUM; i++) {
         init_ringbuf(&g_midd_api.bm_data_rb[i], g_chip_api.chip.frame_len, BLOCK_TYPE);
@@ -305,14 +409,12 @@ int midd_api_init()
 
 void midd_api_exit()
 {
-    rt_ringbuffer_lock_destory(&g_midd_api.bm_nonce_rb);
-    rt_ringbuffer_lock_destory(&g_midd_api.bm_reg_rb);
     rt_ringbuffer_lock_destory(&g_midd_api.bm_pmonitor_rb);
     rt_ringbuffer_lock_destory(&g_midd_api.bm_bist_rb);
-    rt_ringbuffer_lock_destory(&g_midd_api.bm_work_rb);
     for(int i=0; i<PLATFORM_DATAPATH_NUM; i++) {
         rt_ringbuffer_lock_destory(&g_midd_api.bm_data_rb[i]);
         rt_ringbuffer_lock_destory(&g_midd_api.bm_data_response_rb[i]);
     }
+    sem_destroy(&g_midd_api.nonce_sem);
 
 }
@@ -4,32 +4,68 @@
 #include "ringbuffer.h"
 #include "platform-driver.h"
 #include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #define MAX_RECV_LEN_EACH_TIME        	200
 #define MAX_NONCE_LEN                   2048
+#define MIDD_RX_BUF_LEN                 4096
+#define MIDD_RX_POLL_MS                 100
+#define MIDD_RB_DEPTH                   256
+#define MAX_RESPOND_PKG_LEN             (BM_ACK_HEADER_LEN + 256)
+
+/* receive counters of one chain, updated by its dispatch thread only */
+struct midd_rx_stats
+{
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t nonce_frames;
+    uint64_t bad_frames;        /* checksum or header mismatch */
+    uint64_t dropped_bytes;     /* skipped while hunting for a header */
+    double fps;                 /* frames/s over the last rate window */
+    double bps;                 /* bytes/s over the last rate window */
+};
+
+struct std_chain_info
+{
+    int fd;
+    uint8_t chain_id;
+
+    char devname[24];
+    int bandrate;
+    int chip_num;
+
+    pthread_t p_dispatch;
+    pthread_t p_send_work;
+    pthread_t p_data_download;
+
+    /* per-chain queues, so chains never contend on each other's locks */
+    struct rt_ringbuffer nonce_rb;
+    struct rt_ringbuffer reg_rb;
+    struct rt_ringbuffer work_rb;
+    /* posted once for every frame queued on reg_rb */
+    sem_t reg_sem;
+
+    /* bytes read from the device but not yet parsed into a frame */
+    uint8_t rx_buf[MIDD_RX_BUF_LEN];
+    uint32_t rx_len;
+    struct midd_rx_stats rx_stats;
+};
 
 /* API for upper layer */
 struct midd_api
 {
-    struct rt_ringbuffer bm_nonce_rb;
-    struct rt_ringbuffer bm_reg_rb;
     struct rt_ringbuffer bm_pmonitor_rb;
     struct rt_ringbuffer bm_bist_rb;
-    struct rt_ringbuffer bm_work_rb;
     struct rt_ringbuffer bm_data_rb[PLATFORM_DATAPATH_NUM];
     struct rt_ringbuffer bm_data_response_rb[PLATFORM_DATAPATH_NUM];
 
-    uint8_t *rb_nonce;
-    uint8_t *rb_pm;
-    uint8_t *rb_reg;
-    uint8_t *rb_bist;
-    uint8_t *rb_work;
-    uint8_t *rb_data;
-    uint8_t *rb_data_response;
-
-    int (*send_work)(uint8_t *str, uint32_t len);
-    int (*recv_work)(uint8_t *str, uint32_t len);
-    int (*recv_regdata)(uint8_t *str, uint32_t len);
+    /* posted once for every nonce frame queued on any chain */
+    sem_t nonce_sem;
+
+    int (*send_work)(struct std_chain_info *chain, uint8_t *str, uint32_t len);
+    int (*recv_work)(struct std_chain_info *chain, uint8_t *str, uint32_t len);
+    int (*recv_regdata)(struct std_chain_info *chain, uint8_t *str, uint32_t len);
     int (*recv_pmonitor)(uint8_t *str, uint32_t len);
     int (*recv_bist)(uint8_t *str, uint32_t len);
     int (*ioctl)(int fd, uint32_t oper_type, void *param);
@@ -38,19 +74,6 @@ struct midd_api
     int (*recv_framedata)(uint8_t *str, uint32_t len, uint8_t idx);
 };
 
-struct std_chain_info
-{
-    int fd;
-    uint8_t chain_id;
-
-    char devname[12];
-    int bandrate;
-
-    pthread_t p_dispatch;
-    pthread_t p_send_work;
-    pthread_t p_data_download;
-};
-
 #if 0
 #define bswap_16( value)  \
   ( ( ( ( value) & 0xff) << 8) | ( ( value) >> 8))
@@ -72,6 +95,11 @@ void stop_send_work(void *param);
 int start_dispatch_packet(void *param);
 void stop_dispatch_packet(void *param);
 
+void midd_get_rx_stats(struct std_chain_info *chain, struct midd_rx_stats *stats);
+
+int midd_chain_init(struct std_chain_info *chain);
+void midd_chain_exit(struct std_chain_info *chain);
+
 int midd_api_init();
 void midd_api_exit();
 
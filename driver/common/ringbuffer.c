@@ -9,265 +9,249 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "ringbuffer.h"
 
-uint16_t rt_ringbuffer_get_size(struct rt_ringbuffer *rb)
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static void rt_ringbuffer_wait(uint32_t *addr, uint32_t val)
+{
+    /* returns at once if *addr already moved on */
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void rt_ringbuffer_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+static void rt_ringbuffer_wait(uint32_t *addr, uint32_t val)
+{
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val)
+        usleep(100);
+}
+
+static void rt_ringbuffer_wake(uint32_t *addr)
+{
+    (void)addr;
+}
+#endif
+
+uint32_t rt_ringbuffer_get_size(struct rt_ringbuffer *rb)
 {
     return rb->buffer_size;
 }
 
-RINGBUFFER_STATE rt_ringbuffer_status(struct rt_ringbuffer *rb)
+/** round size up to the next power of two */
+uint32_t rt_ringbuffer_roundup(uint32_t size)
 {
-    if (rb->read_index == rb->write_index)
-    {
-        if (rb->read_mirror == rb->write_mirror)
-            return RT_RINGBUFFER_EMPTY;
-        else
-            return RT_RINGBUFFER_FULL;
-    }
-    return RT_RINGBUFFER_HALFFULL;
+    uint32_t n = RT_CACHE_LINE;
+
+    while (n < size && n < 0x80000000u)
+        n <<= 1;
+    return n;
 }
 
-/** return the size of data in rb */
-uint16_t rt_ringbuffer_data_len(struct rt_ringbuffer *rb)
+/** return the size of data in rb, valid from either side */
+uint32_t rt_ringbuffer_data_len(struct rt_ringbuffer *rb)
 {
-    switch (rt_ringbuffer_status(rb))
-    {
-    case RT_RINGBUFFER_EMPTY:
-        return 0;
-    case RT_RINGBUFFER_FULL:
-        return rb->buffer_size;
-    case RT_RINGBUFFER_HALFFULL:
-    default:
-        if (rb->write_index > rb->read_index)
-            return rb->write_index - rb->read_index;
-        else
-            return rb->buffer_size - (rb->read_index - rb->write_index);
-    };
+    uint32_t r = __atomic_load_n(&rb->read_index, __ATOMIC_ACQUIRE);
+    uint32_t w = __atomic_load_n(&rb->write_index, __ATOMIC_ACQUIRE);
+
+    return w - r;
 }
 
+RINGBUFFER_STATE rt_ringbuffer_status(struct rt_ringbuffer *rb)
+{
+    uint32_t len = rt_ringbuffer_data_len(rb);
 
-/** return the size of empty space in rb */
-#define rt_ringbuffer_space_len(rb) ((rb)->buffer_size - rt_ringbuffer_data_len(rb))
+    if (len == 0)
+        return RT_RINGBUFFER_EMPTY;
+    if (len == rb->buffer_size)
+        return RT_RINGBUFFER_FULL;
+    return RT_RINGBUFFER_HALFFULL;
+}
 
 void rt_ringbuffer_init(struct rt_ringbuffer *rb,
                         uint8_t           *pool,
-                        int16_t            size,
+                        uint32_t           size,
                         ringbuffer_type_t ringbuffer_type)
 {
-    /* initialize read and write index */
-    rb->read_mirror = rb->read_index = 0;
-    rb->write_mirror = rb->write_index = 0;
+    uint32_t n = 1;
 
-    /* set buffer pool and size */
-    rb->buffer_ptr = pool;
-    rb->buffer_size = RT_ALIGN_DOWN(size, RT_ALIGN_SIZE);
+    /* the indices are masked, so only use the largest power of two */
+    while (n <= size / 2)
+        n <<= 1;
+    if (size == 0)
+        n = 0;
 
+    rb->buffer_ptr = pool;
+    rb->buffer_size = n;
+    rb->buffer_mask = n ? n - 1 : 0;
     rb->ringbuffer_type = ringbuffer_type;
-    pthread_mutex_init(&(rb->ringbuf_lock), NULL);
-    if(BLOCK_TYPE == rb->ringbuffer_type)
-    {
-        pthread_cond_init(&rb->notfull, NULL);
-        pthread_cond_init(&rb->notempty, NULL);
-    }
+
+    rb->write_index = rb->read_cache = rb->read_waiting = 0;
+    rb->read_index = rb->write_cache = rb->write_waiting = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
 void rt_ringbuffer_lock_destory(struct rt_ringbuffer *rb)
 {
-    pthread_mutex_destroy(&(rb->ringbuf_lock));
-    if(BLOCK_TYPE == rb->ringbuffer_type)
-    {
-        pthread_cond_destroy(&rb->notfull);
-        pthread_cond_destroy(&rb->notempty);
-    }
+    /* nothing to release, kept for API compatibility */
+    (void)rb;
 }
+
+static void rt_ringbuffer_copy_in(struct rt_ringbuffer *rb, uint32_t pos,
+                                  const uint8_t *ptr, uint32_t length)
+{
+    uint32_t off = pos & rb->buffer_mask;
+    uint32_t first = rb->buffer_size - off;
+
+    if (first > length)
+        first = length;
+    memcpy(&rb->buffer_ptr[off], ptr, first);
+    memcpy(&rb->buffer_ptr[0], ptr + first, length - first);
+}
+
+static void rt_ringbuffer_copy_out(struct rt_ringbuffer *rb, uint32_t pos,
+                                   uint8_t *ptr, uint32_t length)
+{
+    uint32_t off = pos & rb->buffer_mask;
+    uint32_t first = rb->buffer_size - off;
+
+    if (first > length)
+        first = length;
+    memcpy(ptr, &rb->buffer_ptr[off], first);
+    memcpy(ptr + first, &rb->buffer_ptr[0], length - first);
+}
+
 /**
- * put a block of data into ring buffer
+ * put a block of data into ring buffer, producer side only
  */
 uint32_t rt_ringbuffer_put(struct rt_ringbuffer *rb,
                            const uint8_t     *ptr,
-                           uint16_t           length)
+                           uint32_t           length)
 {
-    uint16_t size;
-
-    /* whether has enough space */
+    uint32_t w = rb->write_index;
+    uint32_t space = rb->buffer_size - (w - rb->read_cache);
 
-    pthread_mutex_lock(&rb->ringbuf_lock);
-    size = rt_ringbuffer_space_len(rb);
+    if (space < length) {
+        rb->read_cache = __atomic_load_n(&rb->read_index, __ATOMIC_ACQUIRE);
+        space = rb->buffer_size - (w - rb->read_cache);
+    }
 
-    if(POLL_TYPE == rb->ringbuffer_type)
+    if (POLL_TYPE == rb->ringbuffer_type)
     {
         /* no space */
-        if (size == 0)
-        {
-            pthread_mutex_unlock(&rb->ringbuf_lock);
+        if (space == 0)
             return 0;
-        }
 
         /* drop some data */
-        if (size < length)
-            length = size;
-    }else if(BLOCK_TYPE == rb->ringbuffer_type)
-    {
-        while(size < length)
-        {
-            pthread_cond_wait(&rb->notfull, &rb->ringbuf_lock);
-            size = rt_ringbuffer_space_len(rb);
-        }
+        if (space < length)
+            length = space;
     }
-
-    if (rb->buffer_size - rb->write_index > length)
+    else
     {
-        /* read_index - write_index = empty space */
-        memcpy(&rb->buffer_ptr[rb->write_index], ptr, length);
-        /* this should not cause overflow because there is enough space for
-         * length of data in current mirror */
-        rb->write_index += length;
-        pthread_cond_signal(&rb->notempty);
-        pthread_mutex_unlock(&rb->ringbuf_lock);
-        return length;
-    }
-
-    memcpy(&rb->buffer_ptr[rb->write_index],
-           &ptr[0],
-           rb->buffer_size - rb->write_index);
-    memcpy(&rb->buffer_ptr[0],
-           &ptr[rb->buffer_size - rb->write_index],
-           length - (rb->buffer_size - rb->write_index));
-
-    /* we are going into the other side of the mirror */
-    rb->write_mirror = ~rb->write_mirror;
-    rb->write_index = length - (rb->buffer_size - rb->write_index);
-
-    pthread_cond_signal(&rb->notempty);
-    pthread_mutex_unlock(&rb->ringbuf_lock);
-
-    return length;
-}
-
-uint32_t rt_ringbuffer_put_force(struct rt_ringbuffer *rb,
-                                 const uint8_t     *ptr,
-                                 uint16_t           length)
-{
-    uint16_t space_length;
-    pthread_mutex_lock(&rb->ringbuf_lock);
-
-    space_length = rt_ringbuffer_space_len(rb);
-
-    if (length > space_length)
-        length = rb->buffer_size;
+        if (length > rb->buffer_size)
+            return 0;
 
-    if (rb->buffer_size - rb->write_index > length)
-    {
-        /* read_index - write_index = empty space */
-        memcpy(&rb->buffer_ptr[rb->write_index], ptr, length);
-        /* this should not cause overflow because there is enough space for
-         * length of data in current mirror */
-        rb->write_index += length;
-
-        if (length > space_length)
-            rb->read_index = rb->write_index;
-
-        pthread_cond_signal(&rb->notempty);
-        pthread_mutex_unlock(&rb->ringbuf_lock);
-        return length;
+        while (space < length)
+        {
+            /* flag ourselves before the last look, so get cannot free
+             * space without seeing the flag */
+            __atomic_store_n(&rb->write_waiting, 1, __ATOMIC_SEQ_CST);
+            uint32_t r = __atomic_load_n(&rb->read_index, __ATOMIC_SEQ_CST);
+            rb->read_cache = r;
+            space = rb->buffer_size - (w - r);
+            if (space < length)
+                rt_ringbuffer_wait(&rb->read_index, r);
+        }
+        __atomic_store_n(&rb->write_waiting, 0, __ATOMIC_RELAXED);
     }
 
-    memcpy(&rb->buffer_ptr[rb->write_index],
-           &ptr[0],
-           rb->buffer_size - rb->write_index);
-    memcpy(&rb->buffer_ptr[0],
-           &ptr[rb->buffer_size - rb->write_index],
-           length - (rb->buffer_size - rb->write_index));
-
-    /* we are going into the other side of the mirror */
-    rb->write_mirror = ~rb->write_mirror;
-    rb->write_index = length - (rb->buffer_size - rb->write_index);
+    rt_ringbuffer_copy_in(rb, w, ptr, length);
 
-    if (length > space_length)
-    {
-        rb->read_mirror = ~rb->read_mirror;
-        rb->read_index = rb->write_index;
+    if (POLL_TYPE == rb->ringbuffer_type) {
+        __atomic_store_n(&rb->write_index, w + length, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&rb->write_index, w + length, __ATOMIC_SEQ_CST);
+        /* one wake per sleep: the sleeper re-arms the flag if it must wait again */
+        if (__atomic_load_n(&rb->read_waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&rb->read_waiting, 0, __ATOMIC_SEQ_CST))
+            rt_ringbuffer_wake(&rb->write_index);
     }
 
-    pthread_cond_signal(&rb->notempty);
-    pthread_mutex_unlock(&rb->ringbuf_lock);
     return length;
 }
 
 /**
- *  get data from ring buffer
+ *  get data from ring buffer, consumer side only
  */
 uint32_t rt_ringbuffer_get(struct rt_ringbuffer *rb,
                            uint8_t           *ptr,
-                           uint16_t          length)
+                           uint32_t          length)
 {
-    uint32_t size;
-    pthread_mutex_lock(&rb->ringbuf_lock);
+    uint32_t r = rb->read_index;
+    uint32_t size = rb->write_cache - r;
 
-    //dbg_print(PRINT_LEVEL_INFO,"write idx = %d, read idx = %d\n",rb->write_index, rb->read_index);
-    /* whether has enough data  */
-    size = rt_ringbuffer_data_len(rb);
+    if (size < length) {
+        rb->write_cache = __atomic_load_n(&rb->write_index, __ATOMIC_ACQUIRE);
+        size = rb->write_cache - r;
+    }
 
-    if(POLL_TYPE == rb->ringbuffer_type)
+    if (POLL_TYPE == rb->ringbuffer_type)
     {
         /* no data */
         if (size == 0)
-        {
-            pthread_mutex_unlock(&rb->ringbuf_lock);
             return 0;
-        }
 
         /* less data */
         if (size < length)
             length = size;
-    }else if(BLOCK_TYPE == rb->ringbuffer_type)
+    }
+    else
     {
-        while(size < length)
+        if (length > rb->buffer_size)
+            return 0;
+
+        while (size < length)
         {
-            pthread_cond_wait(&rb->notempty, &rb->ringbuf_lock);
-            size = rt_ringbuffer_data_len(rb);
+            __atomic_store_n(&rb->read_waiting, 1, __ATOMIC_SEQ_CST);
+            uint32_t w = __atomic_load_n(&rb->write_index, __ATOMIC_SEQ_CST);
+            rb->write_cache = w;
+            size = w - r;
+            if (size < length)
+                rt_ringbuffer_wait(&rb->write_index, w);
         }
+        __atomic_store_n(&rb->read_waiting, 0, __ATOMIC_RELAXED);
     }
 
-    if (rb->buffer_size - rb->read_index > length)
-    {
-        /* copy all of data */
-        memcpy(ptr, &rb->buffer_ptr[rb->read_index], length);
-        /* this should not cause overflow because there is enough space for
-         * length of data in current mirror */
-        rb->read_index += length;
-        pthread_mutex_unlock(&rb->ringbuf_lock);
-        pthread_cond_signal(&rb->notfull);
-        return length;
+    rt_ringbuffer_copy_out(rb, r, ptr, length);
+
+    if (POLL_TYPE == rb->ringbuffer_type) {
+        __atomic_store_n(&rb->read_index, r + length, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&rb->read_index, r + length, __ATOMIC_SEQ_CST);
+        /* one wake per sleep: the sleeper re-arms the flag if it must wait again */
+        if (__atomic_load_n(&rb->write_waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&rb->write_waiting, 0, __ATOMIC_SEQ_CST))
+            rt_ringbuffer_wake(&rb->read_index);
     }
 
-    memcpy(&ptr[0],
-           &rb->buffer_ptr[rb->read_index],
-           rb->buffer_size - rb->read_index);
-    memcpy(&ptr[rb->buffer_size - rb->read_index],
-           &rb->buffer_ptr[0],
-           length - (rb->buffer_size - rb->read_index));
-
-    /* we are going into the other side of the mirror */
-    rb->read_mirror = ~rb->read_mirror;
-    rb->read_index = length - (rb->buffer_size - rb->read_index);
-    pthread_cond_signal(&rb->notfull);
-    pthread_mutex_unlock(&rb->ringbuf_lock);
     return length;
 }
 
 /**
- *  get data from ring buffer
+ *  copy data out of ring buffer without consuming it, consumer side only
  */
 uint32_t rt_ringbuffer_prefetch(struct rt_ringbuffer *rb,
                                  uint8_t           *ptr,
-                                 uint16_t          length)
+                                 uint32_t          length)
 {
-    uint32_t size;
-
-    /* whether has enough data  */
-    size = rt_ringbuffer_data_len(rb);
+    uint32_t r = rb->read_index;
+    uint32_t size = __atomic_load_n(&rb->write_index, __ATOMIC_ACQUIRE) - r;
 
     /* no data */
     if (size == 0)
@@ -277,21 +261,6 @@ uint32_t rt_ringbuffer_prefetch(struct rt_ringbuffer *rb,
     if (size < length)
         length = size;
 
-    if (rb->buffer_size - rb->read_index > length)
-    {
-        /* copy all of data */
-        memcpy(ptr, &rb->buffer_ptr[rb->read_index], length);
-        return length;
-    }
-    
-    memcpy(&ptr[0],
-           &rb->buffer_ptr[rb->read_index],
-           rb->buffer_size - rb->read_index);
-    memcpy(&ptr[rb->buffer_size - rb->read_index],
-           &rb->buffer_ptr[0],
-           length - (rb->buffer_size - rb->read_index));
-
+    rt_ringbuffer_copy_out(rb, r, ptr, length);
     return length;
 }
-
-
@@ -8,10 +8,10 @@
 #ifndef __MT_RINGBUFFER_H__
 #define __MT_RINGBUFFER_H__
 
-#include <pthread.h>
 #include <stdint.h>
 #define RT_ALIGN_DOWN(size, align)  ((size) & ~((align)-1))
 #define RT_ALIGN_SIZE 4
+#define RT_CACHE_LINE 64
 
 typedef enum ringbuffer_type
 {
@@ -19,24 +19,35 @@ typedef enum ringbuffer_type
     POLL_TYPE
 }ringbuffer_type_t;
 
-/* ring buffer */
+/*
+ * Single-producer/single-consumer ring buffer.
+ *
+ * Exactly one thread may put and exactly one thread may get (or prefetch)
+ * at a time; callers with several producers or consumers must serialise
+ * them. The indices run freely over 32 bits and are masked on access, so
+ * buffer_size is always a power of two. Each side owns a cache line; a
+ * BLOCK_TYPE reader or writer sleeps on the other side's index (futex on
+ * linux) and is woken only when it flagged itself as waiting.
+ */
 struct rt_ringbuffer
 {
     unsigned char * buffer_ptr;
-    unsigned short read_mirror : 1;
-    unsigned short read_index  : 15;
-    unsigned short write_mirror : 1;
-    unsigned short write_index  : 15;
+    uint32_t buffer_size;
+    uint32_t buffer_mask;
 
     int block_flag;
-    
-    unsigned short buffer_size;
-    pthread_mutex_t  ringbuf_lock;
-    pthread_cond_t notfull;
-    pthread_cond_t notempty;
-
     ringbuffer_type_t ringbuffer_type;
-};
+
+    /* producer side: written by put, read by get */
+    uint32_t write_index __attribute__((aligned(RT_CACHE_LINE)));
+    uint32_t read_waiting;      /* set by a consumer blocked on write_index */
+    uint32_t read_cache;        /* producer's last view of read_index */
+
+    /* consumer side: written by get, read by put */
+    uint32_t read_index __attribute__((aligned(RT_CACHE_LINE)));
+    uint32_t write_waiting;     /* set by a producer blocked on read_index */
+    uint32_t write_cache;       /* consumer's last view of write_index */
+} __attribute__((aligned(RT_CACHE_LINE)));
 
 typedef enum rt_ringbuffer_state
 {
@@ -46,28 +57,22 @@ typedef enum rt_ringbuffer_state
     RT_RINGBUFFER_HALFFULL,
 }RINGBUFFER_STATE;
 
+uint32_t rt_ringbuffer_roundup(uint32_t size);
 void rt_ringbuffer_init(struct rt_ringbuffer *rb,
                         uint8_t           *pool,
-                        int16_t            size,
+                        uint32_t           size,
                         ringbuffer_type_t ringbuffer_type);
 void rt_ringbuffer_lock_destory(struct rt_ringbuffer *rb);
 
-uint16_t rt_ringbuffer_data_len(struct rt_ringbuffer *rb);
-unsigned rt_ringbuffer_prefetch(struct rt_ringbuffer *rb,
-                            unsigned char           *ptr,
-                            unsigned short         length);
+uint32_t rt_ringbuffer_data_len(struct rt_ringbuffer *rb);
 uint32_t rt_ringbuffer_put(struct rt_ringbuffer *rb,
                            const uint8_t     *ptr,
-                           uint16_t           length);
-uint32_t rt_ringbuffer_put_force(struct rt_ringbuffer *rb,
-                                 const uint8_t     *ptr,
-                                 uint16_t           length);
+                           uint32_t           length);
 uint32_t rt_ringbuffer_get(struct rt_ringbuffer *rb,
                            uint8_t           *ptr,
-                           uint16_t          length);
+                           uint32_t          length);
 uint32_t rt_ringbuffer_prefetch(struct rt_ringbuffer *rb,
                                  uint8_t           *ptr,
-                                 uint16_t          length);
+                                 uint32_t          length);
 
 #endif
-
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "logging.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+
+#define TRACE_PAD           0x80000000u     /* size flag: skip to ring start */
+#define TRACE_DRAIN_US      10000
+
+bool g_trace_on = false;
+
+static uint8_t *g_ring = NULL;
+/* producers reserve at head with a CAS, the drain thread frees at tail */
+static uint64_t g_head __attribute__((aligned(64)));
+static uint64_t g_tail __attribute__((aligned(64)));
+static struct trace_stats g_stats __attribute__((aligned(64)));
+static uint8_t g_fd_chain[TRACE_MAX_FD];
+
+static int g_file = -1;
+static uint8_t *g_map = NULL;
+static uint64_t g_map_len = 0;
+static uint64_t g_file_off = 0;
+static pthread_t g_drain;
+static int g_drain_run = 0;
+
+static uint64_t trace_now_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void trace_set_chain(int fd, uint8_t chain)
+{
+    if (fd >= 0 && fd < TRACE_MAX_FD)
+        g_fd_chain[fd] = chain;
+}
+
+void _trace_uart(int dir, int fd, const uint8_t *buf, size_t len)
+{
+    const uint64_t mask = TRACE_RING_SIZE - 1;
+    struct trace_rec *rec;
+    uint64_t head, tail, off, pad;
+    uint32_t need;
+
+    if (!g_ring || !len)
+        return;
+    if (len > 0xffff)
+        len = 0xffff;
+    need = (sizeof(*rec) + len + 7) & ~7u;
+
+    head = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+    do {
+        /* a record never wraps, pad up to the ring start instead */
+        off = head & mask;
+        pad = off + need > TRACE_RING_SIZE ? TRACE_RING_SIZE - off : 0;
+        tail = __atomic_load_n(&g_tail, __ATOMIC_ACQUIRE);
+        if (head + pad + need - tail > TRACE_RING_SIZE) {
+            __atomic_add_fetch(&g_stats.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&g_head, &head, head + pad + need, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (pad)
+        __atomic_store_n((uint32_t *)&g_ring[off], (uint32_t)pad | TRACE_PAD,
+                         __ATOMIC_RELEASE);
+
+    rec = (struct trace_rec *)&g_ring[(head + pad) & mask];
+    rec->len   = len;
+    rec->dir   = dir;
+    rec->chain = fd >= 0 && fd < TRACE_MAX_FD ? g_fd_chain[fd] : 0xff;
+    rec->ts_ns = trace_now_ns(CLOCK_MONOTONIC);
+    memcpy(rec + 1, buf, len);
+    /* size last: the drain thread takes a record once it is non-zero */
+    __atomic_store_n(&rec->size, need, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&g_stats.records, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_stats.bytes, len, __ATOMIC_RELAXED);
+}
+
+static int trace_file_write(const void *ptr, uint64_t len)
+{
+    if (g_file_off + len > g_map_len) {
+        uint64_t new_len = g_map_len + TRACE_FILE_CHUNK;
+        uint8_t *map;
+
+        while (g_file_off + len > new_len)
+            new_len += TRACE_FILE_CHUNK;
+        if (ftruncate(g_file, new_len) < 0)
+            return -1;
+        map = mmap(NULL, new_len, PROT_READ | PROT_WRITE, MAP_SHARED, g_file, 0);
+        if (map == MAP_FAILED)
+            return -1;
+        if (g_map)
+            munmap(g_map, g_map_len);
+        g_map = map;
+        g_map_len = new_len;
+    }
+
+    memcpy(g_map + g_file_off, ptr, len);
+    g_file_off += len;
+    return 0;
+}
+
+static void *trace_drain_thread(void *arg)
+{
+    const uint64_t mask = TRACE_RING_SIZE - 1;
+    (void)arg;
+
+    while (1) {
+        uint64_t tail = g_tail;
+        uint8_t *p = &g_ring[tail & mask];
+        uint32_t size = __atomic_load_n((uint32_t *)p, __ATOMIC_ACQUIRE);
+
+        if (!size) {
+            if (!__atomic_load_n(&g_drain_run, __ATOMIC_ACQUIRE)
+                && __atomic_load_n(&g_head, __ATOMIC_ACQUIRE) == tail)
+                break;
+            usleep(TRACE_DRAIN_US);
+            continue;
+        }
+
+        if (!(size & TRACE_PAD) && trace_file_write(p, size) < 0) {
+            applog(LOG_ERR, "uart trace: write failed, tracing stopped");
+            __atomic_store_n(&g_trace_on, false, __ATOMIC_RELAXED);
+        }
+
+        size &= ~TRACE_PAD;
+        /* hand the space back zeroed, so unfinished records read as 0 */
+        memset(p, 0, size);
+        __atomic_store_n(&g_tail, tail + size, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+int trace_start(const char *path)
+{
+    struct trace_file_hdr hdr;
+
+    /* once stopped the ring stays around for late producers */
+    if (g_ring) {
+        if (g_file < 0)
+            return -1;
+        trace_enable(true);
+        return 0;
+    }
+
+    memset(g_fd_chain, 0xff, sizeof(g_fd_chain));
+    if (posix_memalign((void **)&g_ring, 64, TRACE_RING_SIZE)) {
+        g_ring = NULL;
+        return -1;
+    }
+    memset(g_ring, 0, TRACE_RING_SIZE);
+
+    g_file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (g_file < 0) {
+        applog(LOG_ERR, "uart trace: can't open %s", path);
+        free(g_ring);
+        g_ring = NULL;
+        return -1;
+    }
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.realtime_ns = trace_now_ns(CLOCK_REALTIME);
+    hdr.monotonic_ns = trace_now_ns(CLOCK_MONOTONIC);
+    trace_file_write(&hdr, sizeof(hdr));
+
+    g_drain_run = 1;
+    if (pthread_create(&g_drain, NULL, trace_drain_thread, NULL)) {
+        close(g_file);
+        g_file = -1;
+        free(g_ring);
+        g_ring = NULL;
+        return -1;
+    }
+
+    trace_enable(true);
+    applog(LOG_INFO, "uart trace to %s", path);
+    return 0;
+}
+
+/* flush everything recorded so far and close the file */
+void trace_stop(void)
+{
+    if (!g_ring)
+        return;
+
+    trace_enable(false);
+    __atomic_store_n(&g_drain_run, 0, __ATOMIC_RELEASE);
+    pthread_join(g_drain, NULL);
+
+    if (g_map)
+        munmap(g_map, g_map_len);
+    if (ftruncate(g_file, g_file_off) < 0)
+        applog(LOG_WARNING, "uart trace: can't trim file");
+    close(g_file);
+    g_file = -1;
+    g_map = NULL;
+    g_map_len = g_file_off = 0;
+    /* late producers may still hold a reservation, keep the ring */
+}
+
+void trace_enable(bool on)
+{
+    __atomic_store_n(&g_trace_on, on && g_ring && g_file >= 0, __ATOMIC_RELEASE);
+}
+
+void trace_get_stats(struct trace_stats *st)
+{
+    st->records = __atomic_load_n(&g_stats.records, __ATOMIC_RELAXED);
+    st->bytes   = __atomic_load_n(&g_stats.bytes, __ATOMIC_RELAXED);
+    st->dropped = __atomic_load_n(&g_stats.dropped, __ATOMIC_RELAXED);
+}
+
+#else   /* no mmap, tracing is unavailable */
+
+bool g_trace_on = false;
+
+int trace_start(const char *path) { (void)path; return -1; }
+void trace_stop(void) {}
+void trace_enable(bool on) { (void)on; }
+void trace_set_chain(int fd, uint8_t chain) { (void)fd; (void)chain; }
+void trace_get_stats(struct trace_stats *st) { memset(st, 0, sizeof(*st)); }
+void _trace_uart(int dir, int fd, const uint8_t *buf, size_t len)
+{
+    (void)dir; (void)fd; (void)buf; (void)len;
+}
+
+#endif
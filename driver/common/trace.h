@@ -0,0 +1,73 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Binary UART trace.
+ *
+ * Rx/Tx bytes are copied into a lock-free in-memory ring by whichever
+ * thread did the I/O; a background thread drains the ring into a file
+ * through a growing mmap, so tracing never blocks on the disk. When the
+ * ring is full records are dropped and counted rather than waiting.
+ *
+ * File layout: one struct trace_file_hdr, then back to back records of
+ * struct trace_rec followed by len data bytes, padded to 8 bytes. A
+ * record with size 0 ends the file. driver/tools/uart-trace.c decodes it.
+ */
+
+#define TRACE_MAGIC         0x52545050      /* "PPTR" */
+#define TRACE_VERSION       1
+#define TRACE_RING_SIZE     (1 << 22)       /* bytes, power of 2 */
+#define TRACE_FILE_CHUNK    (1 << 24)       /* file grows by this much */
+#define TRACE_MAX_FD        1024
+
+enum trace_dir
+{
+    TRACE_RX = 0,
+    TRACE_TX = 1,
+};
+
+struct trace_file_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t realtime_ns;       /* CLOCK_REALTIME when tracing started */
+    uint64_t monotonic_ns;      /* CLOCK_MONOTONIC at the same moment */
+};
+
+struct trace_rec
+{
+    uint32_t size;              /* whole record incl. padding, 0 = end */
+    uint16_t len;               /* data bytes */
+    uint8_t  dir;               /* enum trace_dir */
+    uint8_t  chain;             /* chain id, 0xff if unknown */
+    uint64_t ts_ns;             /* CLOCK_MONOTONIC */
+};
+
+struct trace_stats
+{
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t dropped;
+};
+
+extern bool g_trace_on;
+
+int trace_start(const char *path);
+void trace_stop(void);
+void trace_enable(bool on);
+void trace_set_chain(int fd, uint8_t chain);
+void trace_get_stats(struct trace_stats *st);
+void _trace_uart(int dir, int fd, const uint8_t *buf, size_t len);
+
+/* one predictable branch when tracing is off */
+static inline void trace_uart(int dir, int fd, const uint8_t *buf, size_t len)
+{
+    if (__builtin_expect(__atomic_load_n(&g_trace_on, __ATOMIC_RELAXED), 0))
+        _trace_uart(dir, fd, buf, len);
+}
+
+#endif
@@ -5,10 +5,13 @@
 #include <stdint.h>
 #include "uart-ubuntu.h"
 #include "comm-api.h"
+#include "trace.h"
 
 
 #if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
 #include <termios.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 static fd_set fs_read;
 
@@ -212,29 +215,48 @@ int uart_recv(int fd, unsigned char *rcv_buf, size_t data_len)
         return read_ret;
     }
 #else	//method 2
-    size_t nbytes = 0;
+    /* drain whatever the tty has buffered, up to data_len; never wait for a
+     * full frame here, the dispatcher reassembles frames from the stream */
+    int nbytes = 0;
     int len = 0;
-    if(ioctl(fd, FIONREAD, &nbytes) == 0)
+    if(ioctl(fd, FIONREAD, &nbytes) == 0 && nbytes > 0)
     {
-        if(nbytes < data_len)
-        {
-            len = 0;
-        }
-        else
-        {
-            len = read(fd, rcv_buf, data_len);
-        }
-    }
-    else
-    {
-        len = 0;
+        if((size_t)nbytes > data_len)
+            nbytes = data_len;
+        len = read(fd, rcv_buf, nbytes);
     }
 
-    if (len > 0) uart_log("Rx", fd, rcv_buf, len);
+    if (len > 0)
+        trace_uart(TRACE_RX, fd, rcv_buf, len);
     return len;
 #endif
 }
 
+/*******************************************************************
+* 名称： uart_poll
+* 功能： 等待串口可读
+* 入口参数： fd :文件描述符
+* timeout_ms :超时时间(毫秒), <0 一直等待
+* 出口参数： 可读返回1，超时返回0，错误返回-1
+*******************************************************************/
+int uart_poll(int fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return errno == EINTR ? 0 : -1;
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) && !(pfd.revents & POLLIN))
+        return -1;
+
+    return ret > 0 ? 1 : 0;
+}
+
 /*******************************************************************
 * 名称： uart_send
 * 功能： 发送数据
@@ -245,7 +267,7 @@ int uart_recv(int fd, unsigned char *rcv_buf, size_t data_len)
 *******************************************************************/
 int uart_send(int fd, unsigned char *send_buf, size_t data_len)
 {
-    uart_log("Tx", fd, send_buf, data_len);
+    trace_uart(TRACE_TX, fd, send_buf, data_len);
     size_t ret = write(fd,send_buf,data_len);
     if (data_len == ret )
     {
@@ -433,6 +455,20 @@ int uart_recv(int fd, unsigned char *rcv_buf, size_t data_len)
   return(n);
 }
 
+/* the port is opened with ReadIntervalTimeout = MAXDWORD so ReadFile never
+ * blocks; just pace the dispatcher instead of spinning */
+int uart_poll(int fd, int timeout_ms)
+{
+  COMSTAT stat;
+  DWORD errors;
+
+  if(ClearCommError(Cport[fd], &errors, &stat) && stat.cbInQue > 0)
+    return(1);
+
+  Sleep(timeout_ms == 0 ? 0 : 1);
+  return(0);
+}
+
 int uart_send(int fd, unsigned char *send_buf, size_t data_len)
 {
   int n;
@@ -16,6 +16,7 @@ int uart_open(char* port, void *arg);
 //int uart_init(int fd);
 int uart_close(int fd);
 int uart_recv(int fd, unsigned char *rcv_buf, size_t data_len);
+int uart_poll(int fd, int timeout_ms);
 int uart_recv_normal(int fd, unsigned char *rcv_buf, size_t data_len);
 int uart_send(int fd, unsigned char *send_buf, size_t data_len);
 #endif
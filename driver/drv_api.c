@@ -8,6 +8,7 @@
 #include <inttypes.h>
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include "platform-driver.h"
 #include "util.h"
 #include "midd-api.h"
@@ -16,6 +17,8 @@
 #include "logging.h"
 #include "ioctl-type.h"
 #include "crc.h"
+#include "drv_api.h"
+#include "trace.h"
 #if defined(__linux__)
 #include "endian.h"
 #endif
@@ -23,7 +26,12 @@
 
 #define DRV_CHIP_BC           0xff
 #define CHIP_DEFAULT_ADDR     0x80
-#define MAX_CHAIN_NUM         1
+#define DRV_MAX_CHAIN_NUM     255
+/* addresses from CHIP_DEFAULT_ADDR up would clash with unassigned chips */
+#define DRV_MAX_CHIP_NUM      CHIP_DEFAULT_ADDR
+#define DRV_ACK_FIRST_MS      1000
+#define DRV_ACK_GAP_MS        50
+#define DRV_ENUM_TRIES        3
 #define UART_BAUDRATE         9600
 #define UART_DEV_CMD          "ttyUSB1"
 
@@ -31,23 +39,76 @@
 extern struct midd_api g_midd_api;
 extern struct comm_api g_comm_api;
 
-struct std_chain_info g_chain[MAX_CHAIN_NUM];
+static struct std_chain_info **g_chain = NULL;
+static int g_chain_num = 0;
+static int g_nonce_next = 0;
+static uint32_t g_region_size = 0;
+/* the chain rings are single producer/single consumer: these keep the
+ * miner threads to one producer on the work rings and one consumer on
+ * the nonce rings */
+static pthread_mutex_t g_nonce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_work_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void _chip_init(int chain_idx) {
+void _chip_init(struct std_chain_info *chain) {
 
   struct cmd_header frame;
   frame.data_len  = 0;
   frame.chip_addr = DRV_CHIP_BC;
-  g_midd_api.ioctl(g_chain[chain_idx].fd, CMD_INIT, &frame);
+  g_midd_api.ioctl(chain->fd, CMD_INIT, &frame);
 }
 
-void _chip_setAddr(int chain_idx, uint8_t addr) {
+void _chip_setAddr(struct std_chain_info *chain, uint8_t addr) {
 
   struct cmd_header frame;
   frame.data_len = 1;
   frame.chip_addr = CHIP_DEFAULT_ADDR;
   frame.data[0] = addr;
-  g_midd_api.ioctl(g_chain[chain_idx].fd, CMD_SET_CHIP_ADDR, &frame);
+  g_midd_api.ioctl(chain->fd, CMD_SET_CHIP_ADDR, &frame);
+}
+
+/* chip searches nonces start..end (inclusive), whatever the work is */
+void _chip_setRegion(struct std_chain_info *chain, uint8_t addr,
+                     uint32_t start, uint32_t end) {
+
+  struct cmd_header frame;
+  frame.data_len = 8;
+  frame.chip_addr = addr;
+  for (int i = 0; i < 4; i++) {
+    frame.data[i]     = start >> (8 * i);
+    frame.data[4 + i] = end >> (8 * i);
+  }
+  g_midd_api.ioctl(chain->fd, CMD_SET_NONCE_REGION, &frame);
+}
+
+/*
+ * Split the 32 bit nonce space into one disjoint region per chip over all
+ * chains, so no two chips ever hash the same header and nonce.
+ */
+void _set_nonce_regions(void)
+{
+  uint64_t total = 0, width, start = 0;
+
+  for (int i = 0; i < g_chain_num; i++)
+    total += g_chain[i]->chip_num;
+  if (!total)
+    return;
+
+  width = 0x100000000ULL / total;
+  g_region_size = (uint32_t)(width > 0xffffffffULL ? 0xffffffffULL : width);
+
+  for (int i = 0; i < g_chain_num; i++) {
+    struct std_chain_info *chain = g_chain[i];
+
+    for (int j = 0; j < chain->chip_num; j++) {
+      /* the very last chip also takes the remainder */
+      uint64_t end = (i == g_chain_num - 1 && j == chain->chip_num - 1)
+                     ? 0xffffffffULL : start + width - 1;
+      _chip_setRegion(chain, j, (uint32_t)start, (uint32_t)end);
+      start = end + 1;
+    }
+  }
+  applog(LOG_INFO, "nonce space split over %d chip(s), %u nonces each",
+         (int)total, g_region_size);
 }
 
 int _open_tty(struct std_chain_info *chain)
@@ -69,16 +130,35 @@ int _open_tty(struct std_chain_info *chain)
   }
 
   chain->fd = fd;
+  trace_set_chain(fd, chain->chain_id);
   return 0;
 }
 
-uint8_t _get_ack(uint8_t *buf, uint8_t *chain_idx) {
+static int _sem_wait_ms(sem_t *sem, int timeout_ms)
+{
+  struct timespec ts;
+
+  if (timeout_ms < 0)
+    return sem_wait(sem);
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec  += timeout_ms / 1000;
+  ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  return sem_timedwait(sem, &ts);
+}
+
+uint8_t _get_ack(struct std_chain_info *chain, uint8_t *buf) {
 
   struct ack_header frame;
+  uint8_t chain_idx;
 
-  g_midd_api.recv_regdata((uint8_t *)&frame, BM_ACK_HEADER_LEN);
-  g_midd_api.recv_regdata(frame.data, frame.data_len);
-  g_midd_api.recv_regdata(chain_idx, 1);
+  g_midd_api.recv_regdata(chain, (uint8_t *)&frame, BM_ACK_HEADER_LEN);
+  g_midd_api.recv_regdata(chain, frame.data, frame.data_len);
+  g_midd_api.recv_regdata(chain, &chain_idx, 1);
 
   if (buf)
     memcpy(buf, (uint8_t *)&frame, frame.data_len + BM_ACK_HEADER_LEN);
@@ -86,110 +166,372 @@ uint8_t _get_ack(uint8_t *buf, uint8_t *chain_idx) {
   return frame.data_len;
 }
 
-uint8_t _get_nonce(uint8_t *buf, uint8_t *chain_idx) {
+/* next register frame of the chain, -1 if none came within timeout_ms */
+static int _wait_ack(struct std_chain_info *chain, struct ack_header *frame,
+                     int timeout_ms) {
 
-  struct ack_header frame;
+  if (_sem_wait_ms(&chain->reg_sem, timeout_ms) != 0)
+    return -1;
+  _get_ack(chain, (uint8_t *)frame);
+  return 0;
+}
 
-  g_midd_api.recv_work((uint8_t *)&frame, BM_ACK_HEADER_LEN);
-  g_midd_api.recv_work(frame.data, frame.data_len);
-  g_midd_api.recv_work(chain_idx, 1);
+/* wire time of len bytes, 10 bits a byte, rounded up */
+static int _frame_ms(struct std_chain_info *chain, int len) {
 
-  if (buf)
-    memcpy(buf, frame.data, frame.data_len);
+  return len * 10 * 1000 / chain->bandrate + 1;
+}
 
-  return frame.data_len;
+static double _now_ms(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Reset the chain and count the chips answering CMD_INIT. The first ack
+ * may take a while, after that they come back to back, so the chain is
+ * done once no ack arrived for a frame time plus DRV_ACK_GAP_MS.
+ */
+static int _enum_chips(struct std_chain_info *chain) {
+
+  struct ack_header ack;
+  int timeout = DRV_ACK_FIRST_MS;
+  int gap = DRV_ACK_GAP_MS + _frame_ms(chain, BM_ACK_HEADER_LEN + 4);
+  int n = 0;
+
+  /* leftovers of an earlier try must not be counted */
+  while (sem_trywait(&chain->reg_sem) == 0)
+    _get_ack(chain, NULL);
+
+  _chip_init(chain);
+  while (n < DRV_MAX_CHIP_NUM && _wait_ack(chain, &ack, timeout) == 0) {
+    timeout = gap;
+    if (ack.cmd == CMD_INIT)
+      n++;
+  }
+  return n;
+}
+
+/*
+ * Hand out addresses 0..n-1 without waiting in between, then collect the
+ * acks. Returns how many addresses from 0 up were acked without a gap.
+ */
+static int _assign_addrs(struct std_chain_info *chain, int n) {
+
+  struct ack_header ack;
+  uint8_t acked[DRV_MAX_CHIP_NUM] = { 0 };
+  int timeout = DRV_ACK_FIRST_MS;
+  int gap = DRV_ACK_GAP_MS + _frame_ms(chain, BM_CMD_HEADER_LEN + 1)
+                           + _frame_ms(chain, BM_ACK_HEADER_LEN + 1);
+  int got = 0, ok = 0;
+
+  for (int j = 0; j < n; j++)
+    _chip_setAddr(chain, j);
+
+  while (got < n && _wait_ack(chain, &ack, timeout) == 0) {
+    timeout = gap;
+    if (ack.cmd != CMD_SET_CHIP_ADDR || ack.ack || ack.chip_addr >= n
+        || acked[ack.chip_addr])
+      continue;
+    acked[ack.chip_addr] = 1;
+    got++;
+  }
+
+  while (ok < n && acked[ok])
+    ok++;
+  return ok;
+}
+
+/* enumerate one chain, runs in a thread of its own */
+static void *_chain_enum(void *arg) {
+
+  struct std_chain_info *chain = (struct std_chain_info *)arg;
+  double t0, t1 = 0, t2 = 0;
+  int chips = 0, addrs = 0;
+
+  for (int try = 1; try <= DRV_ENUM_TRIES; try++) {
+    t0 = _now_ms();
+    chips = _enum_chips(chain);
+    t1 = _now_ms() - t0;
+    addrs = chips ? _assign_addrs(chain, chips) : 0;
+    t2 = _now_ms() - t0 - t1;
+    if (addrs == chips)
+      break;
+    applog(LOG_WARNING, "chain %d: %d of %d chip(s) acked their address, try %d",
+           chain->chain_id, addrs, chips, try);
+  }
+
+  chain->chip_num = addrs;
+  applog(LOG_NOTICE, "chain %d: %d chip(s), enumerate %.1f ms, address %.1f ms",
+         chain->chain_id, addrs, t1, t2);
+  return NULL;
+}
+
+uint8_t _get_nonce(struct std_chain_info *chain, struct ack_header *frame) {
+
+  uint8_t chain_idx;
+
+  g_midd_api.recv_work(chain, (uint8_t *)frame, BM_ACK_HEADER_LEN);
+  g_midd_api.recv_work(chain, frame->data, frame->data_len);
+  g_midd_api.recv_work(chain, &chain_idx, 1);
+
+  return frame->data_len;
+}
+
+/*
+ * Register one chain, or a comma separated list of them. Each entry is
+ * a device name as used by bm_open, optionally followed by ":baudrate",
+ * e.g. "ttyUSB0:115200,ttyUSB1:115200".
+ */
+int drv_add_chain(const char *spec)
+{
+  char *list, *tok, *save = NULL;
+  int ret = 0;
+
+  list = strdup(spec);
+  if (!list)
+    return -1;
+
+  for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    struct std_chain_info *chain, **tbl;
+    char *baud = strchr(tok, ':');
+    int speed = UART_BAUDRATE;
+
+    if (baud) {
+      *baud++ = '\0';
+      speed = atoi(baud);
+    }
+
+    if (!*tok || strlen(tok) >= sizeof(chain->devname) || speed <= 0) {
+      applog(LOG_ERR, "invalid chain \"%s\", expected dev[:baudrate]", tok);
+      ret = -1;
+      break;
+    }
+
+    if (g_chain_num >= DRV_MAX_CHAIN_NUM) {
+      applog(LOG_ERR, "too many chains, at most %d are supported", DRV_MAX_CHAIN_NUM);
+      ret = -1;
+      break;
+    }
+
+    /* the rings in it are cache line aligned, more than calloc promises */
+    if (posix_memalign((void **)&chain, RT_CACHE_LINE, sizeof(*chain)))
+      chain = NULL;
+    tbl = (struct std_chain_info **)realloc(g_chain, (g_chain_num + 1) * sizeof(*tbl));
+    if (!chain || !tbl) {
+      free(chain);
+      ret = -1;
+      break;
+    }
+    memset(chain, 0, sizeof(*chain));
+
+    strcpy(chain->devname, tok);
+    chain->bandrate = speed;
+    chain->chain_id = g_chain_num;
+    chain->fd = -1;
+    g_chain = tbl;
+    g_chain[g_chain_num++] = chain;
+  }
+
+  free(list);
+  return ret;
+}
+
+int drv_get_chain_num(void)
+{
+  return g_chain_num;
 }
 
-int _chain_init(int chain_id)
+int drv_get_chip_num(int chain)
 {
-  const char *dev[MAX_CHAIN_NUM] = {
-    #ifdef UART_DEV_CMD
-    UART_DEV_CMD,
-    #else
-    NULL,
-    #endif
-  };
+  return chain >= 0 && chain < g_chain_num ? g_chain[chain]->chip_num : 0;
+}
 
+int drv_get_baudrate(int chain)
+{
+  return chain >= 0 && chain < g_chain_num ? g_chain[chain]->bandrate : 0;
+}
 
-  if (chain_id >= MAX_CHAIN_NUM) return -1;
-  if (!dev[chain_id]) return -1;
+uint32_t drv_get_region_size(void)
+{
+  return g_region_size;
+}
 
-  struct std_chain_info *chain = &g_chain[chain_id];
-  strcpy(chain->devname, dev[chain_id]);
-  applog(LOG_INFO, "open dev\'s name of the chain %d : %s", chain_id, chain->devname);
-  chain->bandrate = UART_BAUDRATE;
-  chain->chain_id = chain_id;
+int _chain_init(struct std_chain_info *chain)
+{
+  applog(LOG_INFO, "open dev\'s name of the chain %d : %s", chain->chain_id, chain->devname);
 
-  _open_tty(chain);
-  start_dispatch_packet(chain);
-  start_send_work(chain);
+  midd_chain_init(chain);
+  if (_open_tty(chain) < 0) {
+    midd_chain_exit(chain);
+    return -1;
+  }
 
   return 0;
 }
 
-void drv_init(void)
+/*
+ * Drop the chains that did not open. Nothing would ever drain their work
+ * rings, and drv_send_work would block on them for good once full. The
+ * rest are renumbered so chain ids stay indices into g_chain.
+ */
+static int _drop_dead_chains(const int *opened)
 {
-  uint32_t chip_num, rb_len;
-  uint8_t tmp;
+  int n = 0;
+
+  for (int i = 0; i < g_chain_num; i++) {
+    struct std_chain_info *chain = g_chain[i];
+
+    if (!opened[i]) {
+      applog(LOG_ERR, "chain %d: %s could not be opened, not used",
+             chain->chain_id, chain->devname);
+      free(chain);
+      continue;
+    }
+    chain->chain_id = n;
+    trace_set_chain(chain->fd, n);
+    g_chain[n++] = chain;
+  }
+  g_chain_num = n;
+  return n;
+}
+
+int drv_init(void)
+{
+  pthread_t tid[DRV_MAX_CHAIN_NUM];
+  uint8_t started[DRV_MAX_CHAIN_NUM];
+  int opened[DRV_MAX_CHAIN_NUM];
+  double t0, t_open, t_enum, t_region;
 
   chip_api_init(0);
   comm_api_init(COMM_TYPE_UART);
   midd_api_init();
 
-  for(int i = 0; i < MAX_CHAIN_NUM; i++)
-    _chain_init(i);
+  if (!g_chain_num)
+    drv_add_chain(UART_DEV_CMD);
 
+  t0 = _now_ms();
+  for(int i = 0; i < g_chain_num; i++)
+    opened[i] = _chain_init(g_chain[i]) == 0;
+  if (!_drop_dead_chains(opened)) {
+    applog(LOG_ERR, "no ASIC chain could be opened");
+    return -1;
+  }
+  for(int i = 0; i < g_chain_num; i++) {
+    start_dispatch_packet(g_chain[i]);
+    start_send_work(g_chain[i]);
+  }
+  t_open = _now_ms();
+
+  /* chains are independent, enumerate them all at once */
+  for(int i = 0; i < g_chain_num; i++) {
+    started[i] = 0;
+    if (g_chain[i]->fd < 0)
+      continue;
+    if (pthread_create(&tid[i], NULL, _chain_enum, g_chain[i]) == 0)
+      started[i] = 1;
+    else
+      _chain_enum(g_chain[i]);
+  }
+  for(int i = 0; i < g_chain_num; i++)
+    if (started[i])
+      pthread_join(tid[i], NULL);
+  t_enum = _now_ms();
 
-  for(int i = 0; i < MAX_CHAIN_NUM; i++) {
-    _chip_init(i);
-    sleep(1);
-    rb_len = rt_ringbuffer_data_len(&g_midd_api.bm_reg_rb);
-    chip_num = rb_len / (BM_ACK_HEADER_LEN + 4 + 1);
-    printf("%s, %d: found chip num:%d\n", __FUNCTION__, __LINE__, chip_num);
-    for(int j = 0; j < chip_num; j++)
-      _get_ack(NULL, &tmp);
+  _set_nonce_regions();
+  t_region = _now_ms();
 
-    for(int j = 0; j < chip_num; j++) {
-      _chip_setAddr(i, j);
-      usleep(100000);
-    }
-  }
+  applog(LOG_NOTICE, "driver init %.1f ms: open %.1f ms, enumerate %.1f ms, regions %.1f ms",
+         t_region - t0, t_open - t0, t_enum - t_open, t_region - t_enum);
+  return 0;
 }
 
-void drv_send_work(uint8_t msg_id, uint8_t diff, uint8_t *nonce,
+/* diff holds the nonce difficulty of each chain, indexed by chain id */
+void drv_send_work(uint8_t msg_id, const uint8_t *diff, uint8_t *nonce,
                     uint32_t n_len, uint8_t *msg, uint32_t m_len) {
 
   struct cmd_header frame;
   uint32_t m = 0;
 
-  for (int i = 0; i < MAX_CHAIN_NUM; i++) {
-    nonce[n_len - 1] += i;
-
-    frame.chip_addr = DRV_CHIP_BC;
-    frame.data[m++] = msg_id;
-    frame.data[m++] = diff;
-    frame.data[m++] = n_len;
-    memcpy(&frame.data[m], nonce, n_len);
-    m += n_len;
-    frame.data[m++] = m_len;
-    memcpy(&frame.data[m], msg, m_len);
-    m += m_len;
-    frame.data_len = m;
-    g_midd_api.ioctl(g_chain[i].fd, CMD_SET_MSG, &frame);
+  frame.cmd       = CMD_SET_MSG;
+  frame.chip_addr = DRV_CHIP_BC;
+  frame.data[m++] = msg_id;
+  frame.data[m++] = diff[0];
+  frame.data[m++] = n_len;
+  memcpy(&frame.data[m], nonce, n_len);
+  m += n_len;
+  frame.data[m++] = m_len;
+  memcpy(&frame.data[m], msg, m_len);
+  m += m_len;
+  frame.data_len = m;
+
+  /* every chain gets the same message, the chips' nonce regions keep
+   * them apart; the frame is only queued here and sent by that chain's
+   * send thread */
+  pthread_mutex_lock(&g_work_lock);
+  for (int i = 0; i < g_chain_num; i++) {
+    frame.data[1] = diff[i];
+    g_midd_api.send_work(g_chain[i], (uint8_t *)&frame, BM_CMD_HEADER_LEN + frame.data_len);
   }
+  pthread_mutex_unlock(&g_work_lock);
 }
 
-int drv_get_nonce(uint8_t *msg_id, uint8_t *buf) {
-
-  uint8_t chain_idx, n_cnt = 0, len;
-  uint8_t tmp[1024];
-  len = _get_nonce(tmp, &chain_idx);
+/*
+ * Wait up to timeout_ms (<0 forever) for a nonce frame from any chain.
+ * Returns the number of nonces in pkg, 0 on timeout or drv_wakeup().
+ */
+int drv_get_nonce(struct drv_nonce_pkg *pkg, int timeout_ms) {
 
-  if (len > 2) {
-    *msg_id = tmp[0];
-    n_cnt   = tmp[1];
-    memcpy(buf, &tmp[2], len - 2);
+  struct ack_header frame;
+  uint8_t len = 0;
+
+  pkg->n_cnt = 0;
+  if (_sem_wait_ms(&g_midd_api.nonce_sem, timeout_ms) != 0)
+    return 0;
+
+  pthread_mutex_lock(&g_nonce_lock);
+  /* a frame is queued on some chain; start after the last one served so
+   * a busy chain cannot starve the others */
+  for (int i = 0; i < g_chain_num; i++) {
+    struct std_chain_info *chain = g_chain[(g_nonce_next + i) % g_chain_num];
+
+    if (rt_ringbuffer_data_len(&chain->nonce_rb) >= BM_ACK_HEADER_LEN) {
+      len = _get_nonce(chain, &frame);
+      g_nonce_next = (chain->chain_id + 1) % g_chain_num;
+      pkg->chain_id = chain->chain_id;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_nonce_lock);
+
+  /* data: msg_id, n_cnt, then n_cnt little endian nonces; older firmware
+   * pads each nonce to 8 bytes, so derive the stride from the length */
+  if (len > 2 && frame.data[1]) {
+    uint32_t n_cnt = frame.data[1];
+    uint32_t stride = (len - 2) / n_cnt;
+
+    if (stride < 4)
+      return 0;
+    if (n_cnt > DRV_MAX_NONCE_CNT)
+      n_cnt = DRV_MAX_NONCE_CNT;
+
+    pkg->chip_addr = frame.chip_addr;
+    pkg->msg_id = frame.data[0];
+    for (uint32_t i = 0; i < n_cnt; i++) {
+      uint8_t *p = &frame.data[2 + i * stride];
+      pkg->nonce[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    pkg->n_cnt = n_cnt;
   }
 
-  return n_cnt;
+  return pkg->n_cnt;
+}
+
+/* make a pending drv_get_nonce() return early */
+void drv_wakeup(void) {
+
+  sem_post(&g_midd_api.nonce_sem);
 }
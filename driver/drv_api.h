@@ -1,10 +1,30 @@
-
-#ifndef __DRV_API_H__
-#define __DRV_API_H__
-
-void drv_init(void);
-void drv_send_work(uint8_t msg_id, uint8_t diff, uint8_t *nonce,
-                    uint32_t n_len, uint8_t *msg, uint32_t m_len);
-int drv_get_nonce(uint8_t *msg_id, uint8_t *buf);
-
-#endif
+
+#ifndef __DRV_API_H__
+#define __DRV_API_H__
+
+#include <stdint.h>
+
+#define DRV_MAX_NONCE_CNT     64
+
+/* one CMD_RETURN_NONCE frame as returned by drv_get_nonce() */
+struct drv_nonce_pkg
+{
+    uint8_t chain_id;
+    uint8_t chip_addr;
+    uint8_t msg_id;
+    uint8_t n_cnt;
+    uint32_t nonce[DRV_MAX_NONCE_CNT];
+};
+
+int drv_add_chain(const char *spec);
+int drv_get_chain_num(void);
+int drv_get_chip_num(int chain);
+int drv_get_baudrate(int chain);
+uint32_t drv_get_region_size(void);
+int drv_init(void);
+void drv_send_work(uint8_t msg_id, const uint8_t *diff, uint8_t *nonce,
+                    uint32_t n_len, uint8_t *msg, uint32_t m_len);
+int drv_get_nonce(struct drv_nonce_pkg *pkg, int timeout_ms);
+void drv_wakeup(void);
+
+#endif
@@ -0,0 +1,510 @@
+/*
+ * Software ASIC chain emulator.
+ *
+ * Opens a pseudo-terminal and answers the cmd_header/ack_header protocol
+ * of driver/plat/driver.h like a chain of lyra2rev2 chips would:
+ *
+ *   CMD_INIT           every chip resets its address and reports itself
+ *   CMD_SET_CHIP_ADDR  the first chip without an address takes data[0]
+ *                      and acks from it
+ *   CMD_SET_NONCE_REGION  the chip only searches start..end from now on
+ *   CMD_SET_MSG        chips search their nonce slice of the job and
+ *                      return nonces meeting the requested leading zeros
+ *
+ * Nonces are real lyra2rev2 results, so the miner accepts them as shares.
+ * Point the miner at the printed device to load the whole driver and
+ * miner pipeline without boards:
+ *
+ *   asic-emu -n 8 -r 20 &
+ *   ppminer -a lyra2rev2 --asic --chain=pts/3 -o stratum+tcp://...
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <mm_malloc.h>
+#include "driver.h"
+#include "crc.h"
+#include "algo/blake/sph_blake.h"
+#include "algo/keccak/sph_keccak.h"
+#include "algo/cubehash/sph_cubehash.h"
+#include "algo/skein/sph_skein.h"
+#include "algo/bmw/sph_bmw.h"
+#include "algo/lyra2/lyra2.h"
+
+#define EMU_MAX_CHIPS       255
+#define EMU_UNASSIGNED      0x80
+#define EMU_STAT_SECS       10
+
+struct emu_job
+{
+    uint32_t edata[20] __attribute__((aligned(64)));  /* big endian header */
+    uint32_t nonce0;
+    uint8_t  msg_id;
+    uint8_t  diff;
+    struct timespec t_recv;
+};
+
+struct emu_chip
+{
+    uint8_t  addr;
+    int      has_region;
+    uint32_t region_start;
+    uint32_t region_end;
+    uint32_t nonce;             /* next nonce this chip will hash */
+    uint64_t left;              /* nonces left in its range for this job */
+    double   next_ok;           /* earliest time its next nonce may leave */
+};
+
+static int opt_chips = 4;
+static int opt_threads = 1;
+static double opt_rate = 0;     /* nonces/s per chip, 0 = as fast as found */
+static int opt_verbose = 0;
+
+static int g_master = -1;
+static struct emu_chip g_chip[EMU_MAX_CHIPS];
+static struct emu_job g_job;
+static uint32_t g_job_gen = 0;  /* 0: no job yet */
+static pthread_mutex_t g_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_tx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t g_hashes, g_nonces, g_jobs;
+static uint64_t g_first_lat_ns, g_first_cnt;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int zero_bits(const uint32_t *hash)
+{
+    int bits = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        if (hash[i])
+            return bits + __builtin_clz(hash[i]);
+        bits += 32;
+    }
+    return bits;
+}
+
+static void lyra2rev2_hash(uint64_t *matrix, void *state, const void *input)
+{
+    sph_blake256_context     blake;
+    sph_keccak256_context    keccak;
+    sph_cubehash256_context  cube;
+    sph_skein256_context     skein;
+    sph_bmw256_context       bmw;
+    uint32_t hashA[8] __attribute__((aligned(64)));
+    uint32_t hashB[8] __attribute__((aligned(64)));
+
+    sph_blake256_init(&blake);
+    sph_blake256(&blake, input, 80);
+    sph_blake256_close(&blake, hashA);
+
+    sph_keccak256_init(&keccak);
+    sph_keccak256(&keccak, hashA, 32);
+    sph_keccak256_close(&keccak, hashB);
+
+    sph_cubehash256_init(&cube);
+    sph_cubehash256(&cube, hashB, 32);
+    sph_cubehash256_close(&cube, hashA);
+
+    LYRA2REV2(matrix, hashA, 32, hashA, 32, hashA, 32, 1, 4, 4);
+
+    sph_skein256_init(&skein);
+    sph_skein256(&skein, hashA, 32);
+    sph_skein256_close(&skein, hashB);
+
+    sph_cubehash256_init(&cube);
+    sph_cubehash256(&cube, hashB, 32);
+    sph_cubehash256_close(&cube, hashA);
+
+    sph_bmw256_init(&bmw);
+    sph_bmw256(&bmw, hashA, 32);
+    sph_bmw256_close(&bmw, hashB);
+
+    memcpy(state, hashB, 32);
+}
+
+static void emu_send_ack(uint8_t cmd, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+    struct ack_header frame;
+    int total = BM_ACK_HEADER_LEN + len;
+
+    frame.header_aa = BM_HEADER_AA;
+    frame.header_55 = BM_HEADER_55;
+    frame.cmd       = cmd;
+    frame.chip_addr = addr;
+    frame.ack       = 0;
+    frame.data_len  = len;
+    frame.chksum    = 0;
+    memcpy(frame.data, data, len);
+    frame.chksum    = checksum((uint8_t *)&frame, total);
+
+    pthread_mutex_lock(&g_tx_lock);
+    for (int off = 0; off < total; ) {
+        int n = write(g_master, (uint8_t *)&frame + off, total - off);
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+        if (n > 0)
+            off += n;
+    }
+    pthread_mutex_unlock(&g_tx_lock);
+}
+
+static void emu_send_nonce(uint8_t addr, uint8_t msg_id, uint32_t nonce)
+{
+    uint8_t data[6] = { msg_id, 1, nonce, nonce >> 8, nonce >> 16, nonce >> 24 };
+
+    emu_send_ack(CMD_RETURN_NONCE, addr, data, sizeof(data));
+}
+
+static void emu_cmd_init(void)
+{
+    for (int i = 0; i < opt_chips; i++) {
+        uint8_t id[4] = { 0x52, 0x4c, 0x32, i };    /* chip id "RL2" + index */
+
+        g_chip[i].addr = EMU_UNASSIGNED;
+        g_chip[i].has_region = 0;
+        emu_send_ack(CMD_INIT, EMU_UNASSIGNED, id, sizeof(id));
+    }
+}
+
+static void emu_cmd_set_addr(const struct cmd_header *cmd)
+{
+    if (cmd->data_len < 1 || cmd->chip_addr != EMU_UNASSIGNED)
+        return;
+
+    for (int i = 0; i < opt_chips; i++) {
+        if (g_chip[i].addr == EMU_UNASSIGNED) {
+            g_chip[i].addr = cmd->data[0];
+            if (opt_verbose)
+                printf("chip %d: address %d\n", i, cmd->data[0]);
+            emu_send_ack(CMD_SET_CHIP_ADDR, cmd->data[0], cmd->data, 1);
+            return;
+        }
+    }
+}
+
+/* data: start, end, both little endian and inclusive */
+static void emu_cmd_set_region(const struct cmd_header *cmd)
+{
+    const uint8_t *d = cmd->data;
+    uint32_t start = 0, end = 0;
+
+    if (cmd->data_len < 8)
+        return;
+    for (int i = 0; i < 4; i++) {
+        start |= (uint32_t)d[i] << (8 * i);
+        end   |= (uint32_t)d[4 + i] << (8 * i);
+    }
+
+    for (int i = 0; i < opt_chips; i++) {
+        if (g_chip[i].addr == cmd->chip_addr) {
+            g_chip[i].region_start = start;
+            g_chip[i].region_end = end;
+            g_chip[i].has_region = 1;
+            if (opt_verbose)
+                printf("chip %d: region %08x-%08x\n", i, start, end);
+            return;
+        }
+    }
+}
+
+/* data: msg_id, diff, n_len, nonce[n_len] (le), m_len, msg[m_len] */
+static void emu_cmd_set_msg(const struct cmd_header *cmd)
+{
+    const uint8_t *d = cmd->data;
+    uint32_t data[20], nonce0 = 0;
+    uint8_t n_len, m_len;
+
+    if (cmd->data_len < 3)
+        return;
+    n_len = d[2];
+    if (n_len > 4 || 3 + n_len + 1 > cmd->data_len)
+        return;
+    m_len = d[3 + n_len];
+    if (m_len != 80 || 4 + n_len + m_len > cmd->data_len)
+        return;
+
+    for (int i = 0; i < n_len; i++)
+        nonce0 |= (uint32_t)d[3 + i] << (8 * i);
+    memcpy(data, &d[4 + n_len], 80);
+
+    pthread_mutex_lock(&g_job_lock);
+    for (int i = 0; i < 20; i++)
+        g_job.edata[i] = __builtin_bswap32(data[i]);
+    g_job.nonce0 = nonce0;
+    g_job.msg_id = d[0];
+    g_job.diff   = d[1];
+    clock_gettime(CLOCK_MONOTONIC, &g_job.t_recv);
+    __atomic_add_fetch(&g_job_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_job_lock);
+
+    __atomic_add_fetch(&g_jobs, 1, __ATOMIC_RELAXED);
+    if (opt_verbose)
+        printf("job msg %d diff %d nonce0 %08x\n", d[0], d[1], nonce0);
+}
+
+static void emu_handle_cmd(const struct cmd_header *cmd)
+{
+    switch (cmd->cmd) {
+    case CMD_INIT:
+        emu_cmd_init();
+        break;
+    case CMD_SET_CHIP_ADDR:
+        emu_cmd_set_addr(cmd);
+        break;
+    case CMD_SET_MSG:
+        emu_cmd_set_msg(cmd);
+        break;
+    case CMD_SET_NONCE_REGION:
+        emu_cmd_set_region(cmd);
+        break;
+    default:
+        if (opt_verbose)
+            printf("ignored cmd %d\n", cmd->cmd);
+        break;
+    }
+}
+
+/*
+ * Hash worker: serves chips thread, thread + threads, ... one nonce at a
+ * time each. A chip with a region searches it from region start + nonce0,
+ * otherwise chip i takes the i-th slice of the 2^24 nonces above nonce0.
+ * A chip that ran through its range idles until the next job.
+ */
+static void *emu_hash_thread(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    uint64_t *matrix = _mm_malloc(BLOCK_LEN_INT64 * 4 * 8 * 4, 64);
+    struct emu_job job;
+    uint32_t gen = 0, hash[8] __attribute__((aligned(64)));
+    uint32_t slice = 0x01000000u / opt_chips;
+    int first = 1;              /* first nonce of the job already sent */
+
+    while (1) {
+        uint32_t cur = __atomic_load_n(&g_job_gen, __ATOMIC_ACQUIRE);
+        int idle = 1;
+        double t;
+
+        if (!cur) {
+            usleep(10000);
+            continue;
+        }
+        if (cur != gen) {
+            pthread_mutex_lock(&g_job_lock);
+            job = g_job;
+            gen = g_job_gen;
+            pthread_mutex_unlock(&g_job_lock);
+            for (int i = id; i < opt_chips; i += opt_threads) {
+                struct emu_chip *chip = &g_chip[i];
+
+                if (chip->has_region) {
+                    chip->nonce = chip->region_start + job.nonce0;
+                    chip->left = (uint64_t)chip->region_end - chip->nonce + 1;
+                    if (chip->nonce < chip->region_start || chip->nonce > chip->region_end)
+                        chip->left = 0;
+                } else {
+                    chip->nonce = job.nonce0 + i * slice;
+                    chip->left = slice;
+                }
+            }
+            first = 0;
+        }
+
+        t = now_sec();
+        for (int i = id; i < opt_chips; i += opt_threads) {
+            struct emu_chip *chip = &g_chip[i];
+
+            if (!chip->left || t < chip->next_ok)
+                continue;
+            idle = 0;
+
+            job.edata[19] = __builtin_bswap32(chip->nonce);
+            lyra2rev2_hash(matrix, hash, job.edata);
+            __atomic_add_fetch(&g_hashes, 1, __ATOMIC_RELAXED);
+
+            if (zero_bits(hash) >= job.diff) {
+                emu_send_nonce(chip->addr, job.msg_id, chip->nonce);
+                __atomic_add_fetch(&g_nonces, 1, __ATOMIC_RELAXED);
+                if (!first) {
+                    struct timespec ts;
+
+                    clock_gettime(CLOCK_MONOTONIC, &ts);
+                    __atomic_add_fetch(&g_first_lat_ns,
+                        (ts.tv_sec - job.t_recv.tv_sec) * 1000000000ull
+                        + ts.tv_nsec - job.t_recv.tv_nsec, __ATOMIC_RELAXED);
+                    __atomic_add_fetch(&g_first_cnt, 1, __ATOMIC_RELAXED);
+                    first = 1;
+                }
+                if (opt_rate > 0)
+                    chip->next_ok = t + 1.0 / opt_rate;
+            }
+            chip->nonce++;
+            chip->left--;
+        }
+
+        if (idle)
+            usleep(1000);
+    }
+
+    return NULL;
+}
+
+static void *emu_stat_thread(void *arg)
+{
+    uint64_t last_h = 0, last_n = 0;
+
+    (void)arg;
+    while (1) {
+        sleep(EMU_STAT_SECS);
+
+        uint64_t h = __atomic_load_n(&g_hashes, __ATOMIC_RELAXED);
+        uint64_t n = __atomic_load_n(&g_nonces, __ATOMIC_RELAXED);
+        uint64_t fc = __atomic_load_n(&g_first_cnt, __ATOMIC_RELAXED);
+        uint64_t fl = __atomic_load_n(&g_first_lat_ns, __ATOMIC_RELAXED);
+
+        printf("jobs %llu, %.1f H/s, %.2f nonces/s, job to first nonce %.1f ms\n",
+               (unsigned long long)__atomic_load_n(&g_jobs, __ATOMIC_RELAXED),
+               (double)(h - last_h) / EMU_STAT_SECS,
+               (double)(n - last_n) / EMU_STAT_SECS,
+               fc ? fl / 1e6 / fc : 0.0);
+        fflush(stdout);
+        last_h = h;
+        last_n = n;
+    }
+
+    return NULL;
+}
+
+/* same byte-wise framing as bm_parse_respond_len, for cmd frames */
+static void emu_rx_loop(void)
+{
+    struct cmd_header cmd;
+    uint8_t *p = (uint8_t *)&cmd;
+    uint32_t have = 0;
+    uint8_t buf[1024];
+
+    while (1) {
+        int n = read(g_master, buf, sizeof(buf));
+
+        if (n < 0) {
+            /* EIO while no one holds the slave open */
+            if (errno == EINTR || errno == EIO || errno == EAGAIN) {
+                usleep(10000);
+                continue;
+            }
+            perror("read");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            p[have++] = buf[i];
+
+            if (have == 1 && p[0] != BM_HEADER_55)
+                have = 0;
+            else if (have == 2 && p[1] != BM_HEADER_AA)
+                have = p[1] == BM_HEADER_55 ? 1 : 0;
+            else if (have >= BM_CMD_HEADER_LEN
+                     && have == (uint32_t)BM_CMD_HEADER_LEN + cmd.data_len) {
+                uint8_t sum = cmd.chksum;
+
+                cmd.chksum = 0;
+                if ((uint8_t)checksum(p, have) == sum)
+                    emu_handle_cmd(&cmd);
+                else if (opt_verbose)
+                    printf("bad checksum on cmd %d\n", cmd.cmd);
+                have = 0;
+            }
+        }
+    }
+}
+
+static int emu_open_pty(void)
+{
+    struct termios tio;
+    char *slave;
+    int sfd;
+
+    g_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (g_master < 0 || grantpt(g_master) < 0 || unlockpt(g_master) < 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    slave = ptsname(g_master);
+    /* keep one slave handle open so the master never sees a hangup when
+     * the miner closes and reopens the device */
+    sfd = open(slave, O_RDWR | O_NOCTTY);
+    if (sfd < 0 || tcgetattr(sfd, &tio) < 0) {
+        perror(slave);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(sfd, TCSANOW, &tio);
+
+    /* uart_open() prefixes the chain name with /dev/ */
+    printf("emulating %d chip(s) on %s, use --chain=%s\n", opt_chips, slave,
+           strncmp(slave, "/dev/", 5) ? slave : slave + 5);
+    fflush(stdout);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "  -n N   number of emulated chips (default 4, max %d)\n"
+           "  -r R   at most R nonces per second per chip (default 0: unlimited)\n"
+           "  -t N   hashing threads (default 1)\n"
+           "  -v     log every command\n", name, EMU_MAX_CHIPS);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t th;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:t:vh")) != -1) {
+        switch (c) {
+        case 'n': opt_chips = atoi(optarg); break;
+        case 'r': opt_rate = atof(optarg); break;
+        case 't': opt_threads = atoi(optarg); break;
+        case 'v': opt_verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opt_chips < 1 || opt_chips > EMU_MAX_CHIPS || opt_threads < 1 || opt_rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt_threads > opt_chips)
+        opt_threads = opt_chips;
+
+    for (int i = 0; i < opt_chips; i++)
+        g_chip[i].addr = EMU_UNASSIGNED;
+
+    if (emu_open_pty() < 0)
+        return 1;
+
+    for (int i = 0; i < opt_threads; i++)
+        pthread_create(&th, NULL, emu_hash_thread, (void *)(intptr_t)i);
+    pthread_create(&th, NULL, emu_stat_thread, NULL);
+
+    emu_rx_loop();
+    return 1;
+}
@@ -0,0 +1,432 @@
+/*
+ * Replay a UART byte stream into the ASIC receive path over a pty.
+ *
+ * Opens a pseudo-terminal, attaches one chain of the real driver stack
+ * (uart_open, the dispatch thread, midd_parse_stream and the chain's
+ * nonce and register rings) to its slave side, and writes the stream to
+ * the master in random 1..maxchunk byte pieces, so frames are split over
+ * reads and several frames arrive in one read. Every frame the chain
+ * queues is checked against an independent parse of the same stream:
+ * same frames, same order, nothing extra, and the bad frame and dropped
+ * byte counters must match too.
+ *
+ * Without a file the stream is generated: nonce and register acks, some
+ * with a bad checksum, with junk bytes in between that sometimes end in
+ * a lone 0xaa right before a frame. With a file the Rx records of one
+ * chain of a ppminer --uart-trace capture are replayed.
+ *
+ *   uart-replay [-n frames] [-k maxchunk] [-s seed]
+ *   uart-replay [-c chain] [-k maxchunk] [-s seed] trace.bin
+ *
+ * Exits 0 if everything matched.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <termios.h>
+#include <time.h>
+#include <errno.h>
+#include "driver.h"
+#include "crc.h"
+#include "trace.h"
+#include "chip-api.h"
+#include "comm-api.h"
+#include "midd-api.h"
+#include "uart-ubuntu.h"
+
+#define REPLAY_MAX_FRAME    (BM_ACK_HEADER_LEN + 255)
+#define REPLAY_IDLE_MS      2000
+
+extern struct midd_api g_midd_api;
+extern struct comm_api g_comm_api;
+
+/* logging.h wants this from the program, ppminer has it in pp-miner.c */
+bool use_syslog = false;
+
+struct frame_list
+{
+    uint8_t **frame;
+    uint32_t n;
+    uint32_t cap;
+};
+
+struct replay_queue
+{
+    const char *name;
+    struct std_chain_info *chain;
+    struct rt_ringbuffer *rb;
+    sem_t *sem;
+    struct frame_list *want;
+    uint32_t got;
+    uint32_t wrong;
+};
+
+static uint8_t *g_stream;
+static uint32_t g_stream_len;
+static uint32_t g_stream_cap;
+
+static struct frame_list g_nonces, g_regs;
+static uint64_t g_bad, g_dropped;
+
+static void stream_put(const uint8_t *p, uint32_t len)
+{
+    if (g_stream_len + len > g_stream_cap) {
+        g_stream_cap = (g_stream_len + len) * 2;
+        g_stream = realloc(g_stream, g_stream_cap);
+        if (!g_stream) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(g_stream + g_stream_len, p, len);
+    g_stream_len += len;
+}
+
+static void list_add(struct frame_list *l, const uint8_t *p, uint32_t len)
+{
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->frame = realloc(l->frame, l->cap * sizeof(*l->frame));
+        if (!l->frame) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->frame[l->n] = malloc(len);
+    memcpy(l->frame[l->n++], p, len);
+}
+
+/*
+ * What the dispatcher has to make of the stream, worked out without the
+ * chip state machine: a frame is 0xaa 0x55, five more header bytes and
+ * data_len data bytes; a 0xaa not followed by 0x55 is dropped and the
+ * byte after it looked at again; a frame with a bad checksum is counted
+ * and skipped whole; a partial frame at the end stays pending.
+ */
+static void reference_parse(void)
+{
+    uint32_t i = 0;
+
+    while (i < g_stream_len) {
+        uint8_t *p = g_stream + i;
+        uint32_t len;
+
+        if (p[0] != BM_HEADER_AA) {
+            g_dropped++;
+            i++;
+            continue;
+        }
+        if (i + 1 >= g_stream_len)
+            break;
+        if (p[1] != BM_HEADER_55) {
+            g_dropped++;
+            i++;
+            continue;
+        }
+        if (i + BM_ACK_HEADER_LEN > g_stream_len)
+            break;
+        len = BM_ACK_HEADER_LEN + p[5];
+        if (i + len > g_stream_len)
+            break;
+
+        uint8_t frame[REPLAY_MAX_FRAME];
+        uint8_t sum = p[6];
+
+        memcpy(frame, p, len);
+        frame[6] = 0;
+        if ((uint8_t)checksum(frame, len) != sum)
+            g_bad++;
+        else
+            list_add(p[2] == CMD_RETURN_NONCE ? &g_nonces : &g_regs, p, len);
+        i += len;
+    }
+}
+
+static void generate(int frames)
+{
+    /* built in a whole ack_header, its data[] is longer than any frame */
+    struct ack_header frame;
+    struct ack_header *a = &frame;
+    uint8_t *f = (uint8_t *)&frame;
+
+    for (int i = 0; i < frames; i++) {
+        int junk = rand() % 4 ? 0 : 1 + rand() % 8;
+        uint32_t len;
+
+        for (int j = 0; j < junk; j++) {
+            uint8_t b = rand();
+
+            /* the only 0xaa is a lone one right before the frame, which
+             * the dispatcher has to drop and then find the frame behind */
+            if (b == BM_HEADER_AA)
+                b = 0;
+            if (j == junk - 1 && rand() % 2)
+                b = BM_HEADER_AA;
+            stream_put(&b, 1);
+        }
+
+        a->header_aa = BM_HEADER_AA;
+        a->header_55 = BM_HEADER_55;
+        a->chip_addr = rand() % 64;
+        a->ack = 0;
+        if (rand() % 4) {
+            int n = 1 + rand() % 8;
+
+            a->cmd = CMD_RETURN_NONCE;
+            a->data_len = 2 + 4 * n;
+            a->data[0] = rand();
+            a->data[1] = n;
+            for (int j = 2; j < a->data_len; j++)
+                a->data[j] = rand();
+        } else {
+            a->cmd = rand() % 2 ? CMD_INIT : CMD_SET_CHIP_ADDR;
+            a->data_len = rand() % 5;
+            for (int j = 0; j < a->data_len; j++)
+                a->data[j] = rand();
+        }
+        len = BM_ACK_HEADER_LEN + a->data_len;
+        a->chksum = 0;
+        a->chksum = checksum(f, len);
+        if (rand() % 20 == 0)
+            a->chksum ^= 1 + rand() % 0xff;
+        stream_put(f, len);
+    }
+}
+
+static int load_trace(const char *path, int chain)
+{
+    struct trace_file_hdr hdr;
+    struct trace_rec rec;
+    uint8_t data[0x10000];
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC
+        || hdr.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d uart trace\n", path, TRACE_VERSION);
+        fclose(f);
+        return -1;
+    }
+    while (fread(&rec, sizeof(rec), 1, f) == 1 && rec.size) {
+        if (rec.size < sizeof(rec) + rec.len
+            || fread(data, 1, rec.len, f) != rec.len)
+            break;
+        if (rec.size > sizeof(rec) + rec.len
+            && fseek(f, rec.size - sizeof(rec) - rec.len, SEEK_CUR))
+            break;
+        if (rec.dir == TRACE_RX && rec.chain == chain)
+            stream_put(data, rec.len);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int sem_wait_ms(sem_t *sem, int ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    while (sem_timedwait(sem, &ts) != 0)
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+/* take the frames of one ring as the dispatcher queues them and compare */
+static void *check_queue(void *arg)
+{
+    struct replay_queue *q = (struct replay_queue *)arg;
+    /* a frame and the chain id behind it, in a whole ack_header */
+    struct ack_header frame;
+    struct ack_header *a = &frame;
+    uint8_t *rec = (uint8_t *)&frame;
+
+    while (q->got < q->want->n) {
+        uint32_t len;
+
+        if (sem_wait_ms(q->sem, REPLAY_IDLE_MS) != 0)
+            break;
+        rt_ringbuffer_get(q->rb, rec, BM_ACK_HEADER_LEN);
+        rt_ringbuffer_get(q->rb, a->data, a->data_len);
+        len = BM_ACK_HEADER_LEN + a->data_len;
+        rt_ringbuffer_get(q->rb, rec + len, 1);
+
+        if (rec[len] != q->chain->chain_id
+            || memcmp(rec, q->want->frame[q->got], len)) {
+            if (!q->wrong++)
+                fprintf(stderr, "%s frame %u differs\n", q->name, q->got);
+        }
+        q->got++;
+    }
+    return NULL;
+}
+
+static int open_pty(struct std_chain_info *chain, int *master)
+{
+    struct termios tio;
+    struct uart_info u;
+    char *slave;
+    int sfd;
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    slave = ptsname(*master);
+    sfd = open(slave, O_RDWR | O_NOCTTY);
+    if (sfd < 0 || tcgetattr(sfd, &tio) < 0) {
+        perror(slave);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(sfd, TCSANOW, &tio);
+
+    /* uart_open() prefixes the chain name with /dev/ */
+    snprintf(chain->devname, sizeof(chain->devname), "%s",
+             strncmp(slave, "/dev/", 5) ? slave : slave + 5);
+    u.speed = chain->bandrate;
+    u.flow_ctrl = 0;
+    u.databits = 8;
+    u.stopbits = 1;
+    u.parity = 'N';
+    u.cc_vtime = 0;
+    u.cc_vmin = 1024;
+    chain->fd = g_comm_api.bm_open(chain->devname, &u);
+    return chain->fd < 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n frames] [-k maxchunk] [-s seed]\n"
+            "       %s [-c chain] [-k maxchunk] [-s seed] trace.bin\n"
+            "  -n frames    frames to generate (default 5000)\n"
+            "  -k maxchunk  largest piece written at once (default 50)\n"
+            "  -s seed      random seed (default time)\n"
+            "  -c chain     chain of the trace to replay (default 0)\n",
+            prog, prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct std_chain_info *chain;
+    struct replay_queue qn, qr;
+    struct midd_rx_stats st;
+    pthread_t tn, tr;
+    int frames = 5000, maxchunk = 50, tchain = 0, master;
+    unsigned seed = time(NULL);
+    int c, ok;
+
+    while ((c = getopt(argc, argv, "n:k:s:c:h")) != -1) {
+        switch (c) {
+        case 'n': frames = atoi(optarg); break;
+        case 'k': maxchunk = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 'c': tchain = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind < argc - 1 || frames < 0 || maxchunk < 1)
+        usage(argv[0]);
+    srand(seed);
+
+    if (optind == argc - 1) {
+        if (load_trace(argv[optind], tchain))
+            return 1;
+    } else {
+        generate(frames);
+    }
+    reference_parse();
+
+    chip_api_init(0);
+    comm_api_init(COMM_TYPE_UART);
+    midd_api_init();
+
+    /* the rings in std_chain_info want their cache line alignment */
+    if (posix_memalign((void **)&chain, RT_CACHE_LINE, sizeof(*chain))) {
+        perror("posix_memalign");
+        return 1;
+    }
+    memset(chain, 0, sizeof(*chain));
+    chain->chain_id = 7;
+    chain->bandrate = 115200;
+    midd_chain_init(chain);
+    if (open_pty(chain, &master))
+        return 1;
+
+    qn = (struct replay_queue){ "nonce", chain, &chain->nonce_rb,
+                                &g_midd_api.nonce_sem, &g_nonces, 0, 0 };
+    qr = (struct replay_queue){ "register", chain, &chain->reg_rb,
+                                &chain->reg_sem, &g_regs, 0, 0 };
+    pthread_create(&tn, NULL, check_queue, &qn);
+    pthread_create(&tr, NULL, check_queue, &qr);
+    start_dispatch_packet(chain);
+
+    for (uint32_t pos = 0; pos < g_stream_len; ) {
+        uint32_t n = 1 + rand() % maxchunk;
+        ssize_t w;
+
+        if (n > g_stream_len - pos)
+            n = g_stream_len - pos;
+        w = write(master, g_stream + pos, n);
+        if (w < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("write");
+            return 1;
+        }
+        pos += w;
+        /* now and then let the dispatcher catch up, so reads vary from a
+         * single piece to many of them */
+        if (rand() % 8 == 0)
+            usleep(rand() % 200);
+    }
+
+    pthread_join(tn, NULL);
+    pthread_join(tr, NULL);
+    /* bad frames and junk may trail the last good frame, wait until the
+     * dispatcher has read everything and then for its parse of it */
+    for (int ms = 0; ms < REPLAY_IDLE_MS; ms += 10) {
+        midd_get_rx_stats(chain, &st);
+        if (st.bytes == g_stream_len)
+            break;
+        usleep(10000);
+    }
+    usleep(50000);
+    midd_get_rx_stats(chain, &st);
+
+    ok = qn.got == g_nonces.n && qr.got == g_regs.n && !qn.wrong && !qr.wrong
+         && st.bytes == g_stream_len && st.bad_frames == g_bad
+         && st.dropped_bytes == g_dropped
+         && st.frames == g_nonces.n + g_regs.n
+         && st.nonce_frames == g_nonces.n;
+
+    printf("seed %u, %u bytes in pieces of 1..%d\n", seed, g_stream_len, maxchunk);
+    printf("nonce frames     %u/%u, %u wrong\n", qn.got, g_nonces.n, qn.wrong);
+    printf("register frames  %u/%u, %u wrong\n", qr.got, g_regs.n, qr.wrong);
+    printf("bytes            %llu/%u\n", (unsigned long long)st.bytes, g_stream_len);
+    printf("bad frames       %llu/%llu\n", (unsigned long long)st.bad_frames,
+           (unsigned long long)g_bad);
+    printf("dropped bytes    %llu/%llu\n", (unsigned long long)st.dropped_bytes,
+           (unsigned long long)g_dropped);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
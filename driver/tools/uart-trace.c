@@ -0,0 +1,145 @@
+/*
+ * Decoder for the binary UART trace written by ppminer --uart-trace.
+ *
+ * Prints one line per recorded read or write:
+ *
+ *   2026-10-17 12:00:01.123456  +1.234567  chain 0  Tx  86  SET_MSG  55 aa 03 ...
+ *
+ * The record time is the monotonic capture time moved onto the wall clock
+ * saved in the file header. Records are raw uart reads, so a frame may be
+ * split over several Rx lines; the command name is only shown for records
+ * that start with a cmd or ack header.
+ *
+ *   uart-trace [-c chain] [-n maxbytes] trace.bin
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "driver.h"
+#include "trace.h"
+
+static const char *cmd_names[] =
+{
+    [CMD_INIT]             = "INIT",
+    [CMD_SET_NONCE_DIFF]   = "SET_NONCE_DIFF",
+    [CMD_SET_SEED]         = "SET_SEED",
+    [CMD_SET_MSG]          = "SET_MSG",
+    [CMD_RETURN_NONCE]     = "RETURN_NONCE",
+    [CMD_SET_NONCE_REGION] = "SET_NONCE_REGION",
+    [CMD_UPDATA_FIR]       = "UPDATA_FIR",
+    [CMD_UPDATA_FIR_END]   = "UPDATA_FIR_END",
+    [CMD_TEST]             = "TEST",
+    [CMD_GET_BOARD_TMP]    = "GET_BOARD_TMP",
+    [CMD_GET_CHIP_TMP]     = "GET_CHIP_TMP",
+    [CMD_READ_MEM]         = "READ_MEM",
+    [CMD_WRITE_MEM]        = "WRITE_MEM",
+    [CMD_SET_CHIP_ADDR]    = "SET_CHIP_ADDR",
+};
+
+static const char *frame_name(const uint8_t *p, int len)
+{
+    if (len < 3)
+        return "-";
+    if (!((p[0] == BM_HEADER_55 && p[1] == BM_HEADER_AA)
+          || (p[0] == BM_HEADER_AA && p[1] == BM_HEADER_55)))
+        return "-";
+    if (p[2] < sizeof(cmd_names) / sizeof(cmd_names[0]) && cmd_names[p[2]])
+        return cmd_names[p[2]];
+    return "?";
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c chain] [-n maxbytes] trace.bin\n"
+            "  -c chain     only show records of this chain\n"
+            "  -n maxbytes  hex dump at most this many bytes per record\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct trace_file_hdr hdr;
+    struct trace_rec rec;
+    uint8_t data[0x10000];
+    uint64_t first = 0, n = 0;
+    int chain = -1, maxbytes = 0xffff;
+    FILE *f;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "c:n:h")) != -1) {
+        switch (c) {
+        case 'c': chain = atoi(optarg); break;
+        case 'n': maxbytes = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC) {
+        fprintf(stderr, "%s: not a uart trace\n", argv[optind]);
+        return 1;
+    }
+    if (hdr.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: trace version %u, expected %u\n", argv[optind],
+                hdr.version, TRACE_VERSION);
+        return 1;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1 && rec.size) {
+        uint64_t wall, rel;
+        time_t sec;
+        struct tm tm;
+        char tbuf[32];
+        int pad;
+
+        if (rec.size < sizeof(rec) + rec.len) {
+            fprintf(stderr, "corrupt record at offset %ld\n",
+                    ftell(f) - (long)sizeof(rec));
+            return 1;
+        }
+        if (fread(data, 1, rec.len, f) != rec.len)
+            break;
+        pad = rec.size - sizeof(rec) - rec.len;
+        if (pad && fseek(f, pad, SEEK_CUR))
+            break;
+
+        if (!n++)
+            first = rec.ts_ns;
+        if (chain >= 0 && rec.chain != chain)
+            continue;
+
+        wall = hdr.realtime_ns + (rec.ts_ns - hdr.monotonic_ns);
+        rel = rec.ts_ns - first;
+        sec = wall / 1000000000ull;
+        localtime_r(&sec, &tm);
+        strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+
+        printf("%s.%06u  +%llu.%06u  chain %3d  %s  %4u  %-16s ",
+               tbuf, (unsigned)(wall % 1000000000ull / 1000),
+               (unsigned long long)(rel / 1000000000ull),
+               (unsigned)(rel % 1000000000ull / 1000),
+               rec.chain == 0xff ? -1 : rec.chain,
+               rec.dir == TRACE_TX ? "Tx" : "Rx", rec.len,
+               frame_name(data, rec.len));
+        for (i = 0; i < rec.len && i < maxbytes; i++)
+            printf(" %02x", data[i]);
+        if (i < rec.len)
+            printf(" ...");
+        printf("\n");
+    }
+
+    fclose(f);
+    return 0;
+}
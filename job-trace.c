@@ -0,0 +1,236 @@
+/*
+ * Job switch latency, see job-trace.h.
+ *
+ * The stratum thread publishes the traced job, its notify and restart
+ * times and the snapshot its work went out in, under a sequence counter
+ * that also numbers the jobs: odd while being written, twice the job
+ * number after. Miner threads read it like a seqlock and keep what they
+ * saw of it in thread locals, so tracing takes no lock and adds no
+ * shared write to the scan loop besides a histogram update per job.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include "miner.h"
+#include "job-trace.h"
+
+// Bucket b counts latencies of [2^b, 2^(b+1)) us, the first one also
+// anything shorter and the last anything longer, 8 s and up.
+#define JT_BUCKETS  24
+
+// A thread slower than this to see a restart is logged in debug mode.
+#define JT_SLOW_NS  1000000000ULL
+
+enum
+{
+   JT_GEN,
+   JT_RESTART,
+   JT_SWITCH,
+   JT_TOTAL,
+   JT_STAGES
+};
+
+static const char *stage_names[JT_STAGES] =
+{
+   [JT_GEN]     = "gen",
+   [JT_RESTART] = "restart",
+   [JT_SWITCH]  = "switch",
+   [JT_TOTAL]   = "total",
+};
+
+struct jt_hist
+{
+   uint64_t n;
+   uint64_t sum;
+   uint64_t max;
+   uint64_t bucket[JT_BUCKETS];
+};
+
+struct jt_algo
+{
+   struct jt_hist stage[JT_STAGES];
+   uint64_t jobs;
+   uint64_t stale_hashes;
+};
+
+static struct jt_algo jt_algos[ ALGO_COUNT ];
+
+// Current job, written by the stratum thread only.
+static uint64_t jt_ver = 0;
+static uint64_t jt_notify_ns = 0;
+static uint64_t jt_restart_ns = 0;
+static uint64_t jt_seq = 0;
+static uint64_t jt_pending_ns = 0;   // notify of the job not yet published
+
+// What the calling miner thread saw of it.
+static __thread bool     jt_started = false;
+static __thread uint64_t jt_seen = 0;      // job whose restart it saw
+static __thread uint64_t jt_seen_ns = 0;
+static __thread uint64_t jt_done = 0;      // job it hashed last
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hist_add( int stage, uint64_t ns )
+{
+   struct jt_hist *h = &jt_algos[ opt_algo ].stage[ stage ];
+   uint64_t us = ns / 1000;
+   uint64_t max = __atomic_load_n( &h->max, __ATOMIC_RELAXED );
+   int b = 63 - __builtin_clzll( us | 1 );
+
+   if ( b >= JT_BUCKETS )
+      b = JT_BUCKETS - 1;
+   __atomic_fetch_add( &h->bucket[b], 1, __ATOMIC_RELAXED );
+   __atomic_fetch_add( &h->sum, us, __ATOMIC_RELAXED );
+   while ( us > max && !__atomic_compare_exchange_n( &h->max, &max, us,
+                           true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+   __atomic_fetch_add( &h->n, 1, __ATOMIC_RELEASE );
+}
+
+// The traced job, false if there is none or it changed while reading.
+static bool jt_current( uint64_t *id, uint64_t *notify, uint64_t *restart,
+                        uint64_t *seq )
+{
+   uint64_t ver = __atomic_load_n( &jt_ver, __ATOMIC_ACQUIRE );
+
+   if ( !ver || ( ver & 1 ) )
+      return false;
+   *notify  = __atomic_load_n( &jt_notify_ns, __ATOMIC_RELAXED );
+   *restart = __atomic_load_n( &jt_restart_ns, __ATOMIC_RELAXED );
+   *seq     = __atomic_load_n( &jt_seq, __ATOMIC_RELAXED );
+   __atomic_thread_fence( __ATOMIC_ACQUIRE );
+   *id = ver >> 1;
+   return __atomic_load_n( &jt_ver, __ATOMIC_RELAXED ) == ver;
+}
+
+void job_trace_notify()
+{
+   jt_pending_ns = now_ns();
+}
+
+void job_trace_restart( uint64_t seq )
+{
+   uint64_t now = now_ns();
+   // jsonrpc 2 jobs come without a notify
+   uint64_t notify = jt_pending_ns ? jt_pending_ns : now;
+
+   jt_pending_ns = 0;
+   hist_add( JT_GEN, now - notify );
+   __atomic_fetch_add( &jt_algos[ opt_algo ].jobs, 1, __ATOMIC_RELAXED );
+
+   __atomic_fetch_add( &jt_ver, 1, __ATOMIC_RELAXED );
+   __atomic_thread_fence( __ATOMIC_RELEASE );
+   __atomic_store_n( &jt_notify_ns, notify, __ATOMIC_RELAXED );
+   __atomic_store_n( &jt_restart_ns, now, __ATOMIC_RELAXED );
+   __atomic_store_n( &jt_seq, seq, __ATOMIC_RELAXED );
+   __atomic_fetch_add( &jt_ver, 1, __ATOMIC_RELEASE );
+}
+
+void job_trace_observed( int thr_id )
+{
+   uint64_t id, notify, restart, seq, now, ns;
+
+   if ( !jt_started || !jt_current( &id, &notify, &restart, &seq )
+        || id <= jt_seen || id <= jt_done )
+      return;
+   now = now_ns();
+   ns = now > restart ? now - restart : 0;
+   hist_add( JT_RESTART, ns );
+   __atomic_fetch_add( &jt_algos[ opt_algo ].stale_hashes,
+                       (uint64_t)( thr_hashrate( thr_id ) * ns * 1e-9 ),
+                       __ATOMIC_RELAXED );
+   if ( opt_debug && ns >= JT_SLOW_NS )
+      applog( LOG_DEBUG, "CPU #%d: hashed stale work %.3f s after restart",
+              thr_id, ns * 1e-9 );
+   jt_seen = id;
+   jt_seen_ns = now;
+}
+
+void job_trace_scan( int thr_id, uint64_t seq )
+{
+   uint64_t id, notify, restart, jseq, now;
+
+   if ( !seq || !jt_current( &id, &notify, &restart, &jseq )
+        || id <= jt_done || seq < jseq )
+      return;
+   // the thread's first job includes its startup, not counted
+   if ( !jt_started )
+   {
+      jt_started = true;
+      jt_done = id;
+      return;
+   }
+   now = now_ns();
+   hist_add( JT_TOTAL, now - notify );
+   if ( jt_seen == id )
+      hist_add( JT_SWITCH, now - jt_seen_ns );
+   jt_done = id;
+}
+
+// Upper bound of the bucket holding the p-th fraction of h, at most max.
+static uint64_t hist_pct( const struct jt_hist *h, uint64_t n, double p )
+{
+   uint64_t want = (uint64_t)( n * p + 0.5 ), seen = 0;
+
+   if ( want < 1 )
+      want = 1;
+   for ( int b = 0; b < JT_BUCKETS; b++ )
+   {
+      seen += h->bucket[b];
+      if ( seen >= want )
+      {
+         uint64_t top = b == JT_BUCKETS - 1 ? h->max : 2ULL << b;
+         return top < h->max ? top : h->max;
+      }
+   }
+   return h->max;
+}
+
+int job_trace_report( char *buf, int size )
+{
+   char *p = buf, *end = buf + size;
+
+   *buf = '\0';
+   for ( int a = 0; a < ALGO_COUNT && p < end; a++ )
+   {
+      struct jt_algo *ja = &jt_algos[a];
+
+      if ( !__atomic_load_n( &ja->jobs, __ATOMIC_RELAXED ) )
+         continue;
+      p += snprintf( p, end - p, "ALGO=%s;JOBS=%" PRIu64 ";STALEHASHES=%"
+                     PRIu64 "|", algo_names[a], ja->jobs, ja->stale_hashes );
+      for ( int s = 0; s < JT_STAGES && p < end; s++ )
+      {
+         const struct jt_hist *h = &ja->stage[s];
+         uint64_t n = __atomic_load_n( &h->n, __ATOMIC_ACQUIRE );
+
+         if ( !n )
+            continue;
+         p += snprintf( p, end - p, "ALGO=%s;STAGE=%s;N=%" PRIu64 ";AVG=%"
+                        PRIu64 ";P50=%" PRIu64 ";P99=%" PRIu64 ";MAX=%"
+                        PRIu64 ";H=", algo_names[a], stage_names[s], n,
+                        h->sum / n, hist_pct( h, n, 0.5 ),
+                        hist_pct( h, n, 0.99 ), h->max );
+         for ( int b = 0; b < JT_BUCKETS && p < end; b++ )
+            p += snprintf( p, end - p, b ? ",%" PRIu64 : "%" PRIu64,
+                           h->bucket[b] );
+         if ( p < end )
+            p += snprintf( p, end - p, "|" );
+      }
+   }
+   if ( p > end )
+      p = end;
+   return (int)( p - buf );
+}
@@ -0,0 +1,42 @@
+#ifndef JOB_TRACE_H__
+#define JOB_TRACE_H__
+
+#include <stdint.h>
+
+// Job switch latency.
+//
+// A clean stratum job is traced from the notify to the first hash each
+// miner thread does on it, in four stages:
+//
+//   gen       notify received     -> work generated and threads restarted
+//   restart   threads restarted   -> a thread's scanhash returned
+//   switch    scanhash returned   -> first hash of the thread on new work
+//   total     notify received     -> first hash of the thread on new work
+//
+// restart is how long scanhash keeps hashing stale work before it polls
+// work_restart, so an algo with a long restart check interval stands out
+// there, and its hashes are counted as stale exposure. A thread that was
+// between scans when the job came only shows in switch and total.
+//
+// Latencies go to log2 histograms of microseconds per algo, see the
+// "jobtrace" API command.
+
+// Notify of a clean job parsed, stratum thread.
+void job_trace_notify();
+
+// Work of the clean job published as seq and threads about to be
+// restarted, stratum thread.
+void job_trace_restart( uint64_t seq );
+
+// Miner thread's scanhash returned with work_restart set.
+void job_trace_observed( int thr_id );
+
+// Miner thread about to scan work from snapshot seq, 0 if not stratum.
+void job_trace_scan( int thr_id, uint64_t seq );
+
+// One record per algo and stage that saw any job, like
+// "ALGO=x;STAGE=restart;N=;AVG=;P50=;P99=;MAX=;H=b0,b1,..|" in
+// microseconds, and one "ALGO=x;JOBS=;STALEHASHES=|" per algo.
+int job_trace_report( char *buf, int size );
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Line receive buffer, see line-buf.h.
+ *
+ * One flat buffer rather than a ring that wraps: lines are handed out in
+ * place, so each must be contiguous. The front is reclaimed instead by
+ * moving the pending bytes down, only when the room behind them gets
+ * short, which moves every byte at most a few times.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "line-buf.h"
+
+bool line_buf_init( struct line_buf *lb )
+{
+   lb->buf = (char*) malloc( LINE_BUF_SIZE );
+   lb->size = lb->buf ? LINE_BUF_SIZE : 0;
+   lb->head = lb->scan = lb->tail = 0;
+   return lb->buf != NULL;
+}
+
+void line_buf_free( struct line_buf *lb )
+{
+   free( lb->buf );
+   lb->buf = NULL;
+   lb->size = lb->head = lb->scan = lb->tail = 0;
+}
+
+void line_buf_reset( struct line_buf *lb )
+{
+   lb->head = lb->scan = lb->tail = 0;
+}
+
+char *line_buf_next( struct line_buf *lb, size_t *len )
+{
+   while ( lb->scan < lb->tail )
+   {
+      char *line = lb->buf + lb->head;
+      char *nl = (char*) memchr( lb->buf + lb->scan, '\n',
+                                 lb->tail - lb->scan );
+      char *end;
+
+      if ( !nl )
+      {
+         lb->scan = lb->tail;
+         return NULL;
+      }
+      lb->head = lb->scan = nl + 1 - lb->buf;
+      end = nl;
+      if ( end > line && end[-1] == '\r' )
+         end--;
+      if ( end == line )
+         continue;
+      *end = '\0';
+      if ( len )
+         *len = end - line;
+      return line;
+   }
+   return NULL;
+}
+
+char *line_buf_space( struct line_buf *lb, size_t *room )
+{
+   if ( lb->head == lb->tail )
+      lb->head = lb->scan = lb->tail = 0;
+   else if ( lb->size - lb->tail < LINE_BUF_RECV && lb->head )
+   {
+      memmove( lb->buf, lb->buf + lb->head, lb->tail - lb->head );
+      lb->scan -= lb->head;
+      lb->tail -= lb->head;
+      lb->head = 0;
+   }
+
+   while ( lb->size - lb->tail < LINE_BUF_RECV && lb->size < LINE_BUF_MAX )
+   {
+      size_t size = lb->size ? lb->size * 2 : LINE_BUF_SIZE;
+      char *buf;
+
+      if ( size > LINE_BUF_MAX )
+         size = LINE_BUF_MAX;
+      if ( !( buf = (char*) realloc( lb->buf, size ) ) )
+         break;
+      lb->buf = buf;
+      lb->size = size;
+   }
+
+   *room = lb->size - lb->tail;
+   return *room ? lb->buf + lb->tail : NULL;
+}
+
+void line_buf_commit( struct line_buf *lb, size_t n )
+{
+   lb->tail += n;
+}
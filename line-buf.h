@@ -0,0 +1,59 @@
+#ifndef LINE_BUF_H__
+#define LINE_BUF_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Receive buffer of a line based protocol, stratum.
+//
+// Data is received straight into the buffer, see line_buf_space and
+// line_buf_commit, and lines are handed out in place: the newline is
+// overwritten with a NUL and the caller gets a pointer into the buffer.
+// The search for the next newline resumes where the last one stopped, so
+// a line that arrives in many pieces is scanned only once.
+//
+// What was handed out is only moved or dropped by the next
+// line_buf_space, the unconsumed rest is moved to the front then if the
+// room behind it ran short, and the buffer doubles if that is not enough,
+// up to LINE_BUF_MAX. So a line stays valid until the caller receives
+// again and copying stays linear however long the lines get.
+
+// Initial size, and the least room line_buf_space makes for a receive.
+#define LINE_BUF_SIZE   ( 64 * 1024 )
+#define LINE_BUF_RECV   ( 16 * 1024 )
+// Longest line accepted, GBT templates can take a few MiB.
+#define LINE_BUF_MAX    ( 64 * 1024 * 1024 )
+
+struct line_buf
+{
+   char   *buf;
+   size_t  size;
+   size_t  head;     // first byte not handed out
+   size_t  scan;     // no newline in [head, scan)
+   size_t  tail;     // end of the data received
+};
+
+bool line_buf_init( struct line_buf *lb );
+void line_buf_free( struct line_buf *lb );
+
+// Drop everything, on reconnect.
+void line_buf_reset( struct line_buf *lb );
+
+// Anything received that was not handed out yet, a whole line or not.
+static inline bool line_buf_pending( const struct line_buf *lb )
+{
+   return lb->tail > lb->head;
+}
+
+// Next complete line without its "\n" or "\r\n", NUL terminated, NULL if
+// there is none yet. Empty lines are skipped.
+char *line_buf_next( struct line_buf *lb, size_t *len );
+
+// Room to receive into, at least LINE_BUF_RECV bytes unless the pending
+// line already takes up LINE_BUF_MAX, NULL then.
+char *line_buf_space( struct line_buf *lb, size_t *room );
+
+// n bytes were received at line_buf_space.
+void line_buf_commit( struct line_buf *lb, size_t n );
+
+#endif
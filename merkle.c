@@ -0,0 +1,234 @@
+/*
+ * Merkle roots of stratum jobs, see merkle.h.
+ *
+ * Lanes are interleaved word by word the way sha256_transform_4way and
+ * _8way want them, word i of lane l at [ i * ways + l ], and a single
+ * lane is just the scalar layout, so the same code drives all three.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <string.h>
+#include "miner.h"
+#include "merkle.h"
+
+static int merkle_ways = 0;
+
+// Widest SHA-256 there is, sha256_use_4way also picks its code.
+static int get_ways()
+{
+   int ways = __atomic_load_n( &merkle_ways, __ATOMIC_RELAXED );
+
+   if ( ways )
+      return ways;
+   ways = 1;
+#ifdef HAVE_SHA256_4WAY
+   if ( sha256_use_4way() )
+      ways = 4;
+#endif
+#ifdef HAVE_SHA256_8WAY
+   if ( sha256_use_8way() )
+      ways = 8;
+#endif
+   __atomic_store_n( &merkle_ways, ways, __ATOMIC_RELAXED );
+   return ways;
+}
+
+static void transform( uint32_t *state, const uint32_t *block, int ways )
+{
+#ifdef HAVE_SHA256_8WAY
+   if ( ways == 8 )
+   {
+      sha256_transform_8way( state, block, 0 );
+      return;
+   }
+#endif
+#ifdef HAVE_SHA256_4WAY
+   if ( ways == 4 )
+   {
+      sha256_transform_4way( state, block, 0 );
+      return;
+   }
+#endif
+   sha256_transform( state, block, 0 );
+}
+
+static void init_lanes( uint32_t *state, const uint32_t *init, int ways )
+{
+   for ( int i = 0; i < 8; i++ )
+      for ( int l = 0; l < ways; l++ )
+         state[ i * ways + l ] = init[i];
+}
+
+// Second SHA-256 of sha256d, over the 32 byte first hash in state.
+static void hash_again( uint32_t *state, uint32_t *block, int ways )
+{
+   uint32_t init[8];
+
+   sha256_init( init );
+   memcpy( block, state, 8 * ways * sizeof(uint32_t) );
+   for ( int l = 0; l < ways; l++ )
+   {
+      block[ 8 * ways + l ] = 0x80000000;
+      for ( int i = 9; i < 15; i++ )
+         block[ i * ways + l ] = 0;
+      block[ 15 * ways + l ] = 256;
+   }
+   init_lanes( state, init, ways );
+   transform( state, block, ways );
+}
+
+// Block at pos of the padded coinbase with extranonce2 xn.
+static void coinbase_block( unsigned char *blk, const struct stratum_job *job,
+                            size_t pos, const unsigned char *xn,
+                            size_t xn_off, size_t xn_size, bool last )
+{
+   size_t size = job->coinbase_size;
+   size_t n = pos < size ? size - pos : 0;
+
+   if ( n > 64 )
+      n = 64;
+   memcpy( blk, job->coinbase + pos, n );
+   memset( blk + n, 0, 64 - n );
+   if ( pos <= size && size < pos + 64 )
+      blk[ size - pos ] = 0x80;
+   // the part of extranonce2 in this block
+   for ( size_t i = 0; i < xn_size; i++ )
+      if ( xn_off + i >= pos && xn_off + i < pos + n )
+         blk[ xn_off + i - pos ] = xn[i];
+   if ( last )
+   {
+      uint64_t bits = (uint64_t)size * 8;
+
+      be32enc( blk + 56, (uint32_t)( bits >> 32 ) );
+      be32enc( blk + 60, (uint32_t)bits );
+   }
+}
+
+static void xnonce2_inc( unsigned char *xn, size_t size )
+{
+   for ( size_t t = 0; t < size && !( ++xn[t] ); t++ );
+}
+
+static void prepare( struct merkle_cache *mc, const struct stratum_job *job )
+{
+   uint32_t block[16];
+
+   mc->mid_len = (int)( job->xnonce2 - job->coinbase ) & ~63;
+   sha256_init( mc->midstate );
+   for ( int pos = 0; pos < mc->mid_len; pos += 64 )
+   {
+      for ( int i = 0; i < 16; i++ )
+         block[i] = be32dec( job->coinbase + pos + 4 * i );
+      sha256_transform( mc->midstate, block, 0 );
+   }
+   mc->count = mc->next = 0;
+   mc->ready = true;
+}
+
+// Roots for ways extranonce2 values from xn on, into mc->root.
+static void compute( struct merkle_cache *mc, const struct stratum_job *job,
+                     const unsigned char *xn, size_t xn_size, bool dbl,
+                     int ways )
+{
+   uint32_t _ALIGN(64) state[ 8 * MERKLE_WAYS ];
+   uint32_t _ALIGN(64) block[ 16 * MERKLE_WAYS ];
+   unsigned char lane_xn[ MERKLE_WAYS ][ MERKLE_XNONCE2_MAX ];
+   unsigned char blk[64];
+   uint32_t init[8];
+   size_t xn_off = job->xnonce2 - job->coinbase;
+   size_t tail = job->coinbase_size - mc->mid_len;
+   int blocks = (int)( ( tail + 9 + 63 ) / 64 );
+
+   for ( int l = 0; l < ways; l++ )
+   {
+      memcpy( lane_xn[l], l ? lane_xn[ l - 1 ] : xn, xn_size );
+      if ( l )
+         xnonce2_inc( lane_xn[l], xn_size );
+   }
+   sha256_init( init );
+
+   // coinbase tail, from the midstate on
+   init_lanes( state, mc->midstate, ways );
+   for ( int b = 0; b < blocks; b++ )
+   {
+      for ( int l = 0; l < ways; l++ )
+      {
+         coinbase_block( blk, job, mc->mid_len + b * 64, lane_xn[l], xn_off,
+                         xn_size, b == blocks - 1 );
+         for ( int i = 0; i < 16; i++ )
+            block[ i * ways + l ] = be32dec( blk + 4 * i );
+      }
+      transform( state, block, ways );
+   }
+   if ( dbl )
+      hash_again( state, block, ways );
+
+   // sha256d( root | branch ), the root is still in state as words
+   for ( int m = 0; m < job->merkle_count; m++ )
+   {
+      memcpy( block, state, 8 * ways * sizeof(uint32_t) );
+      for ( int i = 0; i < 8; i++ )
+      {
+         uint32_t w = be32dec( job->merkle[m] + 4 * i );
+
+         for ( int l = 0; l < ways; l++ )
+            block[ ( 8 + i ) * ways + l ] = w;
+      }
+      init_lanes( state, init, ways );
+      transform( state, block, ways );
+      for ( int l = 0; l < ways; l++ )
+      {
+         block[l] = 0x80000000;
+         for ( int i = 1; i < 15; i++ )
+            block[ i * ways + l ] = 0;
+         block[ 15 * ways + l ] = 512;
+      }
+      transform( state, block, ways );
+      hash_again( state, block, ways );
+   }
+
+   for ( int l = 0; l < ways; l++ )
+      for ( int i = 0; i < 8; i++ )
+         be32enc( mc->root[l] + 4 * i, state[ i * ways + l ] );
+   mc->dbl = dbl;
+   mc->count = ways;
+   mc->next = 0;
+   memcpy( mc->expect, xn, xn_size );
+}
+
+void merkle_get_root( unsigned char *root, struct stratum_ctx *sctx, bool dbl )
+{
+   struct stratum_job *job = &sctx->job;
+   struct merkle_cache *mc = &job->merkle_cache;
+   size_t xn_size = sctx->xnonce2_size;
+   bool next;
+   int ways = 1;
+
+   if ( xn_size > MERKLE_XNONCE2_MAX )
+   {
+      struct merkle_cache one;
+
+      prepare( &one, job );
+      compute( &one, job, job->xnonce2, 0, dbl, 1 );
+      memcpy( root, one.root[0], 32 );
+      return;
+   }
+   if ( !mc->ready )
+      prepare( mc, job );
+
+   next = mc->count && mc->dbl == dbl
+          && !memcmp( job->xnonce2, mc->expect, xn_size );
+   if ( !next || mc->next == mc->count )
+   {
+      // a job that is rolling extranonce2 gets the next roots with it
+      if ( next )
+         ways = get_ways();
+      compute( mc, job, job->xnonce2, xn_size, dbl, ways );
+   }
+   memcpy( root, mc->root[ mc->next++ ], 32 );
+   xnonce2_inc( mc->expect, xn_size );
+}
@@ -0,0 +1,47 @@
+#ifndef MERKLE_H__
+#define MERKLE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Merkle roots of stratum jobs.
+//
+// Within a job only extranonce2 changes in the coinbase, so the SHA-256
+// state after the whole 64 byte blocks ahead of it, coinb1 and xnonce1,
+// is computed once per notify and only the tail from there on is hashed
+// for each root.
+//
+// Work is generated for consecutive extranonce2 values, so once a job
+// starts rolling, the roots for the next MERKLE_WAYS values are computed
+// together with the 4 or 8 way SHA-256 of sha2-x64.S, coinbase tail and
+// every branch, and handed out one at a time from the job's cache.
+
+#define MERKLE_WAYS         8
+#define MERKLE_XNONCE2_MAX  16
+
+struct merkle_cache
+{
+   bool     ready;          // midstate is for the current coinbase
+   bool     dbl;            // roots hash the coinbase with sha256d
+   int      mid_len;        // coinbase bytes in midstate
+   uint32_t midstate[8];
+   int      count;          // roots computed
+   int      next;           // next root to hand out
+   unsigned char expect[ MERKLE_XNONCE2_MAX ];   // extranonce2 of next
+   unsigned char root[ MERKLE_WAYS ][32];
+};
+
+struct stratum_ctx;
+
+// The job's coinbase changed, a notify.
+static inline void merkle_reset( struct merkle_cache *mc )
+{
+   mc->ready = false;
+   mc->count = mc->next = 0;
+}
+
+// Merkle root for the current extranonce2 of sctx->job, the coinbase
+// hashed with sha256d if dbl, else with a single SHA-256.
+void merkle_get_root( unsigned char *root, struct stratum_ctx *sctx, bool dbl );
+
+#endif
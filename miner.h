@@ -105,6 +105,8 @@ static inline bool is_windows(void)
 }
  
 #include "compat.h"
+#include "line-buf.h"
+#include "merkle.h"
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -245,6 +247,17 @@ struct work;
 
 void work_free(struct work *w);
 void work_copy(struct work *dest, const struct work *src);
+void work_set_job_id(struct work *w, const char *job_id);
+void work_set_xnonce2(struct work *w, const unsigned char *xnonce2, size_t len);
+
+// Allocation counters of the work handoff. Command objects are recycled,
+// so in steady state only reused grows.
+struct work_alloc_stats {
+	uint64_t cmd_allocs;   // workio commands malloc'd
+	uint64_t cmd_reused;   // workio commands taken from the free list
+	uint64_t heap;         // work strings too long for the inline buffers
+};
+void work_get_alloc_stats(struct work_alloc_stats *st);
 
 
 
@@ -346,6 +359,11 @@ void   cpu_brand_string( char* s );
 
 float cpu_temp( int core );
 
+// Inline storage in struct work, stratum job ids and extranonce2 fit so
+// copying a work does not allocate.
+#define WORK_JOB_ID_SIZE  64
+#define WORK_XNONCE2_SIZE 16
+
 struct work {
 	uint32_t data[48];
 	uint32_t target[8];
@@ -353,6 +371,7 @@ struct work {
 	double targetdiff;
 	double shareratio;
 	double sharediff;
+	uint32_t submit_id;	// id of its mining.submit, see share-track.h
 
 	int height;
 	char *txs;
@@ -362,6 +381,9 @@ struct work {
 	size_t xnonce2_len;
 	unsigned char *xnonce2;
         uint32_t nonces[80];
+	// job_id and xnonce2 point here when they fit, see work_set_job_id
+	char job_id_buf[WORK_JOB_ID_SIZE];
+	unsigned char xnonce2_buf[WORK_XNONCE2_SIZE];
 };
 
 struct stratum_job {
@@ -372,12 +394,14 @@ struct stratum_job {
 	unsigned char *coinbase;
 	unsigned char *xnonce2;
 	int merkle_count;
+	int merkle_max;		// room in merkle, see stratum_job_merkle_room
 	unsigned char **merkle;
 	unsigned char version[4];
 	unsigned char nbits[4];
 	unsigned char ntime[4];
 	bool clean;
 	double diff;
+	struct merkle_cache merkle_cache;
 };
 
 struct stratum_ctx {
@@ -387,12 +411,10 @@ struct stratum_ctx {
 	char *curl_url;
 	char curl_err_str[CURL_ERROR_SIZE];
 	curl_socket_t sock;
-	size_t sockbuf_size;
-	char *sockbuf;
+	struct line_buf rbuf;
 	pthread_mutex_t sock_lock;
 
 	double next_diff;
-	double sharediff;
 
 	char *session_id;
 	size_t xnonce1_size;
@@ -403,17 +425,26 @@ struct stratum_ctx {
 	pthread_mutex_t work_lock;
 
 	int bloc_height;
+
+	bool standby;		// hot standby connection, see pools.h
 };
 
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout);
+bool stratum_socket_full_ms(struct stratum_ctx *sctx, int ms);
 bool stratum_send_line(struct stratum_ctx *sctx, char *s);
+// Next line received, in place in sctx->rbuf: do not free it, it is only
+// valid until the next stratum_recv_line or stratum_disconnect.
 char *stratum_recv_line(struct stratum_ctx *sctx);
 bool stratum_connect(struct stratum_ctx *sctx, const char *url);
 void stratum_disconnect(struct stratum_ctx *sctx);
+void stratum_swap(struct stratum_ctx *a, struct stratum_ctx *b);
 bool stratum_subscribe(struct stratum_ctx *sctx);
 bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *pass);
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s);
 
+struct thr_info;
+bool submit_work(struct thr_info *thr, const struct work *work_in);
+
 /* rpc 2.0 (xmr) */
 
 
@@ -425,6 +456,9 @@ extern size_t rpc2_bloblen;
 extern uint32_t rpc2_target;
 extern char *rpc2_job_id;
 extern char *rpc_user;
+extern char *rpc_pass;
+extern char *rpc_url;
+extern int opt_fail_pause;
 extern char *short_url;
 
 json_t *json_rpc2_call(CURL *curl, const char *url, const char *userpass, const char *rpc_req, int *curl_err, int flags);
@@ -442,6 +476,7 @@ bool tq_push(struct thread_q *tq, void *data);
 void *tq_pop(struct thread_q *tq, const struct timespec *abstime);
 void tq_freeze(struct thread_q *tq);
 void tq_thaw(struct thread_q *tq);
+bool tq_frozen(struct thread_q *tq);
 
 void parse_arg(int key, char *arg);
 void parse_config(json_t *config, char *ref);
@@ -477,6 +512,8 @@ struct workio_cmd {
         union {
                 struct work *work;
         } u;
+        struct work work;               // u.work points here
+        struct workio_cmd *next;        // free list
 };
 
 uint32_t* get_stratum_job_ntime();
@@ -660,8 +697,15 @@ extern bool opt_protocol;
 extern bool opt_showdiff;
 extern bool opt_extranonce;
 extern bool opt_quiet;
+extern bool opt_huge_pages;
+extern bool opt_lock_pages;
+// Cryptonight hashes interleaved per call, per miner thread.
+#define CN_MAX_WAYS 4
+extern int opt_cn_ways[];
+extern int opt_cn_ways_count;
 extern bool opt_redirect;
 extern int opt_timeout;
+extern int opt_scantime;
 extern bool want_longpoll;
 extern bool have_longpoll;
 extern bool have_gbt;
@@ -682,11 +726,31 @@ extern struct thr_info *thr_info;
 extern int longpoll_thr_id;
 extern int stratum_thr_id;
 extern int api_thr_id;
+extern struct stratum_ctx stratum;
 extern int opt_n_threads;
 extern struct work_restart *work_restart;
 extern uint32_t opt_work_size;
-extern double *thr_hashrates;
 extern double global_hashrate;
+
+// Hashrates are averaged over about this many seconds of scanning.
+#define THR_STATS_TAU 10.
+
+// Per miner thread hash counters, a cache line each. Only the owning
+// thread writes them, with relaxed atomics and no lock; the API and the
+// logger sum them when they need a total.
+struct thr_stats {
+	double hashrate;	// H/s, EWMA over THR_STATS_TAU
+	double hashcount;	// hashes of the last scan
+	uint64_t hashes;	// since start
+	double avg_hashes;	// decayed sums the EWMA is the ratio of,
+	double avg_secs;	// owner only
+} __attribute__ ((aligned (64)));
+
+extern struct thr_stats *thr_stats;
+
+void   thr_stats_update(int thr_id, uint64_t hashes, double secs);
+double thr_hashrate(int thr_id);
+void   thr_stats_total(double *hashcount, double *hashrate);
 extern double stratum_diff;
 extern double net_diff;
 extern double net_hashrate;
@@ -827,12 +891,32 @@ Options:\n\
       --benchmark       run in offline benchmark mode\n\
       --cputest         debug hashes from cpu algorithms\n\
       --cpu-affinity    set process affinity to cpu core(s), mask 0x3 for cores 0 and 1\n\
+      --cpu-placement=P place miner threads by CPU topology (linux): compact,\n\
+                        scatter (spread over nodes and L3 caches first), core\n\
+                        (one per physical core first) or l3 (one per L3 cache)\n\
+      --cn-ways=N[,N..] cryptonight hashes interleaved per thread, 1 to 4,\n\
+                        one value for all threads or one per thread\n\
+      --submit-window=N stratum shares sent ahead of their answers, 1 to 256\n\
+                        (default: 32)\n\
+      --backup-url=URL  stratum pool to fail over to, kept connected as a\n\
+                        standby, repeat for more in order of preference\n\
+      --failover-ms=N   deadline for a pool to answer mining.ping before it\n\
+                        is failed over from (default: 1000)\n\
+      --no-huge-pages   back scratchpads with normal pages only\n\
+      --lock-pages      lock scratchpads in memory (linux)\n\
       --cpu-priority    set process priority (default: 0 idle, 2 normal to 5 highest)\n\
   -b, --api-bind        IP/Port for the miner API (default: 127.0.0.1:4048)\n\
       --api-remote      Allow remote control\n\
       --max-temp=N      Only mine if cpu temp is less than specified value (linux)\n\
       --max-rate=N[KMG] Only mine if net hashrate is less than specified value\n\
       --max-diff=N      Only mine if net difficulty is less than specified value\n\
+      --chain=DEV[:BAUD] ASIC chain device, repeat or comma separate for more\n\
+                          chains (default: ttyUSB1:9600)\n\
+      --asic            mine on the ASIC chains (stratum pools only)\n\
+      --asic-verify=N   threads re-hashing ASIC nonces (default: 1)\n\
+      --uart-trace=FILE record raw ASIC UART traffic to FILE (binary)\n\
+      --asic-nonce-rate=N nonces/s per chip the chip difficulty aims\n\
+                          for, the UART speed permitting (default: 1)\n\
   -c, --config=FILE     load a JSON-format configuration file\n\
   -V, --version         display version information and exit\n\
   -h, --help            display this help text and exit\n\
@@ -858,10 +942,22 @@ static struct option const options[] = {
         { "benchmark", 0, NULL, 1005 },
         { "cputest", 0, NULL, 1006 },
         { "cert", 1, NULL, 1001 },
+        { "chain", 1, NULL, 1070 },
+        { "asic", 0, NULL, 1071 },
+        { "asic-verify", 1, NULL, 1072 },
+        { "uart-trace", 1, NULL, 1073 },
+        { "asic-nonce-rate", 1, NULL, 1074 },
         { "coinbase-addr", 1, NULL, 1016 },
         { "coinbase-sig", 1, NULL, 1015 },
         { "config", 1, NULL, 'c' },
         { "cpu-affinity", 1, NULL, 1020 },
+        { "cpu-placement", 1, NULL, 1075 },
+        { "no-huge-pages", 0, NULL, 1076 },
+        { "lock-pages", 0, NULL, 1077 },
+        { "cn-ways", 1, NULL, 1078 },
+        { "submit-window", 1, NULL, 1079 },
+        { "backup-url", 1, NULL, 1080 },
+        { "failover-ms", 1, NULL, 1081 },
         { "cpu-priority", 1, NULL, 1021 },
         { "no-color", 0, NULL, 1002 },
         { "debug", 0, NULL, 'D' },
@@ -0,0 +1,68 @@
+/*
+ * Shared nonce range scheduler, see nonce-sched.h.
+ *
+ * The state is one 64 bit word, a 24 bit generation tag over a 40 bit
+ * cursor, so restarting for new work and claiming a chunk are the same
+ * compare and swap and a claim can never land in the wrong generation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdbool.h>
+#include "nonce-sched.h"
+
+#define SCHED_CUR_BITS  40
+#define SCHED_CUR_MASK  ( ( 1ULL << SCHED_CUR_BITS ) - 1 )
+#define SCHED_TAG_MASK  0xffffffULL
+
+static uint64_t sched_state = 0;
+
+enum nonce_claim nonce_sched_claim( uint64_t gen, uint32_t size,
+                                    uint32_t *start, uint32_t *end )
+{
+   uint64_t tag = gen & SCHED_TAG_MASK;
+   uint64_t old = __atomic_load_n( &sched_state, __ATOMIC_ACQUIRE );
+
+   while ( 1 )
+   {
+      uint64_t otag = old >> SCHED_CUR_BITS;
+      uint64_t cur = old & SCHED_CUR_MASK;
+      uint64_t next;
+
+      if ( otag != tag )
+      {
+         // tags wrap, compare them as a signed 24 bit difference
+         if ( ( ( tag - otag ) & SCHED_TAG_MASK ) & 0x800000 )
+            return NONCE_STALE;
+         cur = 0;
+      }
+      if ( cur >= NONCE_SCHED_END )
+         return NONCE_DONE;
+      next = cur + size;
+      if ( next > NONCE_SCHED_END )
+         next = NONCE_SCHED_END;
+      if ( __atomic_compare_exchange_n( &sched_state, &old,
+                                        ( tag << SCHED_CUR_BITS ) | next,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE ) )
+      {
+         *start = (uint32_t)cur;
+         *end = (uint32_t)next;
+         return NONCE_CHUNK;
+      }
+   }
+}
+
+uint32_t nonce_sched_size( double hashrate )
+{
+   double n = hashrate * NONCE_SCHED_MS / 1000.;
+
+   if ( n < NONCE_SCHED_MIN )
+      return NONCE_SCHED_MIN;
+   if ( n > NONCE_SCHED_END / 16 )
+      n = NONCE_SCHED_END / 16;
+   return ( (uint32_t)n + NONCE_SCHED_ALIGN - 1 ) & ~( NONCE_SCHED_ALIGN - 1 );
+}
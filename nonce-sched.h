@@ -0,0 +1,43 @@
+#ifndef NONCE_SCHED_H__
+#define NONCE_SCHED_H__
+
+#include <stdint.h>
+
+// Shared nonce range scheduler.
+//
+// Threads mining the same work no longer split its nonce range into equal
+// fixed slices. They claim chunks from one shared cursor instead, sized from
+// their own measured hashrate, so a fast thread just claims more chunks and
+// none sits idle while a slow one still holds half its slice. Chunks are
+// handed out in order from 0, aligned to NONCE_SCHED_ALIGN, with no gaps
+// and no overlap.
+//
+// The cursor is tagged with the generation of the work it belongs to. The
+// first claim for a newer generation restarts it at 0, a claim for an older
+// one is refused so the thread picks up the new work first.
+
+// Claims stop short of the top like the fixed slices did.
+#define NONCE_SCHED_END    ( 0xffffffffU - 0x20 )
+// Chunk sizes are a multiple of this so n-way scanhash stays aligned.
+#define NONCE_SCHED_ALIGN  64
+// Smallest chunk, also used until a thread's hashrate is known.
+#define NONCE_SCHED_MIN    0x400
+// Chunks are sized to take a thread about this long.
+#define NONCE_SCHED_MS     250
+
+enum nonce_claim
+{
+   NONCE_CHUNK,      // [start, end) is the caller's
+   NONCE_DONE,       // the whole range of gen was handed out
+   NONCE_STALE       // newer work is being mined, gen is out of date
+};
+
+// Claim the next chunk of up to size nonces of the work generation gen,
+// gen increases by 1 or more with each new work.
+enum nonce_claim nonce_sched_claim( uint64_t gen, uint32_t size,
+                                    uint32_t *start, uint32_t *end );
+
+// Chunk size for a thread hashing at hashrate.
+uint32_t nonce_sched_size( double hashrate );
+
+#endif
@@ -0,0 +1,529 @@
+/*
+ * Stratum pool failover, see pools.h.
+ *
+ * The standby thread owns the standby context and holds sb_lock while it
+ * uses it, except when it waits for the socket, so the stratum thread can
+ * only swap contexts between two lines of the standby. It takes sb_lock
+ * with a trylock: a standby busy connecting is not ready anyway, and the
+ * stratum thread never waits on it. pl_lock covers the pool table, the
+ * probes and the counters and is held briefly by everyone, inside
+ * sb_lock when both are needed.
+ *
+ * A switch bumps sb_gen, which tells the standby thread that the context
+ * it had is gone and it should connect again, to the best pool other
+ * than the active one.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "miner.h"
+#include "pools.h"
+
+// The id of probes, so answers are told from share answers.
+#define POOL_PING_ID  "pp-ping"
+
+// Probes a pool gets without ever answering before it is not probed.
+#define POOL_PROBE_TRIES  3
+
+// The standby thread looks for a switch this often while idle.
+#define POOL_STANDBY_POLL_MS  100
+
+struct pool
+{
+   char    *url;          // NULL for pool 0, rpc_url
+   uint64_t pings;
+   uint64_t answers;
+   uint64_t misses;
+   uint64_t rtt_us;       // of the last answer
+};
+
+// Probe state of a connection.
+struct probe
+{
+   uint64_t sent;         // us, probe waiting for its answer since
+   uint64_t next;         // us, next probe due
+   uint64_t heard;        // us, last line received
+};
+
+static pthread_mutex_t sb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct stratum_ctx standby;
+static uint64_t sb_gen = 0;
+
+static struct pool pools[ POOL_MAX ];
+static int pool_count = 1;
+static int active_idx = 0;
+static int sb_idx = -1;
+static bool sb_ready = false;
+static uint64_t sb_ready_since = 0;
+static struct probe probe_active, probe_sb;
+
+static uint64_t failovers = 0;
+static uint64_t failbacks = 0;
+static uint64_t outages = 0;
+static bool     had_work = false;
+static uint64_t nowork_since = 0;    // us, 0 while there is work
+static uint64_t nowork_total = 0;
+static uint64_t nowork_last = 0;
+static uint64_t nowork_max = 0;
+
+static uint64_t now_us()
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const char *pool_url( int idx )
+{
+   return idx ? pools[ idx ].url : rpc_url;
+}
+
+static const char *pool_short_url( int idx )
+{
+   const char *url = pool_url( idx );
+   const char *p = strstr( url, "://" );
+
+   return p ? p + 3 : url;
+}
+
+bool pool_add_backup( const char *url )
+{
+   char *u;
+
+   if ( pool_count == POOL_MAX )
+      return false;
+   if ( strstr( url, "://" ) )
+   {
+      if ( strncasecmp( url, "stratum+tcp://", 14 ) || !url[14] )
+         return false;
+      u = strdup( url );
+   }
+   else
+   {
+      if ( !*url )
+         return false;
+      u = (char*) malloc( strlen( url ) + 15 );
+      sprintf( u, "stratum+tcp://%s", url );
+   }
+   pools[ pool_count++ ].url = u;
+   return true;
+}
+
+// Probes, under pl_lock.
+
+static void probe_send( struct stratum_ctx *sctx, struct probe *p, int idx,
+                        uint64_t now )
+{
+   char s[] = "{\"id\":\"" POOL_PING_ID "\",\"method\":\"mining.ping\","
+              "\"params\":[]}";
+
+   p->next = now + POOL_PROBE_MS * 1000ULL;
+   if ( !pools[ idx ].answers && pools[ idx ].pings >= POOL_PROBE_TRIES )
+      return;
+   p->sent = now;
+   pools[ idx ].pings++;
+   stratum_send_line( sctx, s );
+}
+
+static bool probe_heard( struct probe *p, int idx, const char *s,
+                         uint64_t now )
+{
+   p->heard = now;
+   if ( !strstr( s, "\"" POOL_PING_ID "\"" ) )
+      return false;
+   if ( p->sent )
+   {
+      pools[ idx ].rtt_us = now - p->sent;
+      pools[ idx ].answers++;
+      p->sent = 0;
+   }
+   return true;
+}
+
+// A probe of a pool that answers them has gone unheard for too long.
+static bool probe_late( const struct probe *p, int idx )
+{
+   return p->sent && pools[ idx ].answers && p->heard < p->sent;
+}
+
+static bool probe_missed( const struct probe *p, int idx, uint64_t now )
+{
+   return probe_late( p, idx )
+          && now - p->sent >= (uint64_t)opt_failover_ms * 1000;
+}
+
+// Swap the standby in for the active connection, failback or not.
+static bool pool_switch( bool failback )
+{
+   bool ok;
+   int from;
+
+   if ( pthread_mutex_trylock( &sb_lock ) )
+      return false;
+   pthread_mutex_lock( &pl_lock );
+   from = active_idx;
+   ok = sb_ready && ( !failback || sb_idx < active_idx );
+   if ( ok )
+   {
+      stratum_swap( &stratum, &standby );
+      active_idx = sb_idx;
+      sb_idx = -1;
+      sb_ready = false;
+      __atomic_add_fetch( &sb_gen, 1, __ATOMIC_RELEASE );
+      probe_active = probe_sb;
+      memset( &probe_sb, 0, sizeof probe_sb );
+      failback ? failbacks++ : failovers++;
+   }
+   pthread_mutex_unlock( &pl_lock );
+   // what the standby has now is the old active connection
+   if ( ok )
+      stratum_disconnect( &standby );
+   pthread_mutex_unlock( &sb_lock );
+
+   if ( ok )
+      applog( LOG_BLUE, "%s from %s to %s", failback ? "Back" : "Failover",
+              pool_short_url( from ), pool_short_url( active_idx ) );
+   return ok;
+}
+
+int pool_wait( struct stratum_ctx *sctx, int timeout )
+{
+   uint64_t now = now_us();
+   uint64_t end = now + timeout * 1000000ULL;
+
+   if ( pool_count < 2 )
+   {
+      if ( stratum_socket_full( sctx, timeout ) )
+         return POOL_LINE;
+      applog( LOG_ERR, "Stratum connection timeout" );
+      return POOL_DEAD;
+   }
+
+   while ( 1 )
+   {
+      uint64_t wake = end;
+      bool failback;
+
+      pthread_mutex_lock( &pl_lock );
+      if ( probe_missed( &probe_active, active_idx, now ) )
+      {
+         pools[ active_idx ].misses++;
+         pthread_mutex_unlock( &pl_lock );
+         applog( LOG_WARNING, "%s missed its %d ms deadline",
+                 pool_short_url( active_idx ), opt_failover_ms );
+         return POOL_DEAD;
+      }
+      if ( now >= probe_active.next )
+         probe_send( sctx, &probe_active, active_idx, now );
+      if ( probe_active.next < wake )
+         wake = probe_active.next;
+      if ( probe_late( &probe_active, active_idx ) )
+      {
+         uint64_t due = probe_active.sent + opt_failover_ms * 1000ULL;
+
+         if ( due < wake )
+            wake = due;
+      }
+      failback = sb_ready && sb_idx < active_idx
+                 && now - sb_ready_since >= POOL_FAILBACK_S * 1000000ULL;
+      pthread_mutex_unlock( &pl_lock );
+
+      if ( failback && pool_switch( true ) )
+         return POOL_SWITCHED;
+      if ( now >= end )
+      {
+         applog( LOG_ERR, "Stratum connection timeout" );
+         return POOL_DEAD;
+      }
+      if ( stratum_socket_full_ms( sctx,
+                                   (int)( ( wake - now + 999 ) / 1000 ) ) )
+         return POOL_LINE;
+      now = now_us();
+   }
+}
+
+bool pool_line( const char *s )
+{
+   bool probe;
+
+   if ( pool_count < 2 )
+      return false;
+   pthread_mutex_lock( &pl_lock );
+   probe = probe_heard( &probe_active, active_idx, s, now_us() );
+   pthread_mutex_unlock( &pl_lock );
+   return probe;
+}
+
+bool pool_failover()
+{
+   return pool_count > 1 && pool_switch( false );
+}
+
+void pool_reset_active()
+{
+   pthread_mutex_lock( &pl_lock );
+   if ( active_idx )
+   {
+      active_idx = 0;
+      memset( &probe_active, 0, sizeof probe_active );
+      // the standby may be on the -o pool too
+      if ( sb_idx == 0 )
+      {
+         sb_ready = false;
+         __atomic_add_fetch( &sb_gen, 1, __ATOMIC_RELEASE );
+      }
+   }
+   pthread_mutex_unlock( &pl_lock );
+}
+
+void pool_work_lost()
+{
+   pthread_mutex_lock( &pl_lock );
+   memset( &probe_active, 0, sizeof probe_active );
+   if ( had_work && !nowork_since )
+   {
+      nowork_since = now_us();
+      outages++;
+   }
+   pthread_mutex_unlock( &pl_lock );
+}
+
+void pool_work_valid()
+{
+   pthread_mutex_lock( &pl_lock );
+   had_work = true;
+   if ( nowork_since )
+   {
+      nowork_last = now_us() - nowork_since;
+      nowork_total += nowork_last;
+      if ( nowork_last > nowork_max )
+         nowork_max = nowork_last;
+      nowork_since = 0;
+   }
+   pthread_mutex_unlock( &pl_lock );
+}
+
+// Standby thread.
+
+// Pool for the standby, the best one other than the active one, the
+// tries-th best after failures.
+static int standby_target( int tries )
+{
+   int n = pool_count - 1;
+   int k = tries % n;
+
+   for ( int i = 0; i < pool_count; i++ )
+      if ( i != active_idx && !k-- )
+         return i;
+   return active_idx ? 0 : 1;
+}
+
+static bool socket_readable( curl_socket_t sock, int ms )
+{
+   struct timeval tv;
+   fd_set rd;
+
+   FD_ZERO( &rd );
+   FD_SET( sock, &rd );
+   tv.tv_sec = ms / 1000;
+   tv.tv_usec = ( ms % 1000 ) * 1000;
+   return select( (int)( sock + 1 ), &rd, NULL, NULL, &tv ) > 0;
+}
+
+// Keep the standby connection of generation gen warm until it is lost or
+// swapped away. Holds sb_lock on entry and exit.
+static void standby_warm( int idx, uint64_t gen )
+{
+   // gone with client.reconnect too, it is reconnected to idx
+   while ( __atomic_load_n( &sb_gen, __ATOMIC_ACQUIRE ) == gen && standby.curl )
+   {
+      curl_socket_t sock = standby.sock;
+      bool readable = line_buf_pending( &standby.rbuf );
+      bool lost = false;
+      uint64_t now;
+
+      pthread_mutex_unlock( &sb_lock );
+      if ( !readable )
+         readable = socket_readable( sock, POOL_STANDBY_POLL_MS );
+      pthread_mutex_lock( &sb_lock );
+      if ( __atomic_load_n( &sb_gen, __ATOMIC_ACQUIRE ) != gen )
+         return;
+
+      now = now_us();
+      if ( readable )
+      {
+         char *s = stratum_recv_line( &standby );
+         bool probe;
+
+         if ( !s )
+            return;
+         pthread_mutex_lock( &pl_lock );
+         probe = probe_heard( &probe_sb, idx, s, now );
+         pthread_mutex_unlock( &pl_lock );
+         // answers other than to probes are of no interest
+         if ( !probe )
+            stratum_handle_method( &standby, s );
+      }
+
+      pthread_mutex_lock( &pl_lock );
+      if ( probe_missed( &probe_sb, idx, now ) )
+      {
+         pools[ idx ].misses++;
+         lost = true;
+      }
+      else
+      {
+         if ( now >= probe_sb.next )
+            probe_send( &standby, &probe_sb, idx, now );
+         // ready once it has a job to mine
+         if ( !sb_ready && standby.job.job_id )
+         {
+            sb_ready = true;
+            sb_ready_since = now;
+            if ( opt_debug )
+               applog( LOG_DEBUG, "Standby ready on %s",
+                       pool_short_url( idx ) );
+         }
+      }
+      pthread_mutex_unlock( &pl_lock );
+      if ( lost )
+      {
+         applog( LOG_WARNING, "Standby %s missed its %d ms deadline",
+                 pool_short_url( idx ), opt_failover_ms );
+         return;
+      }
+   }
+}
+
+static void *standby_thread( void *userdata )
+{
+   int failures = 0;
+
+   while ( 1 )
+   {
+      uint64_t gen;
+      char *url;
+      bool ok;
+      int idx;
+
+      pthread_mutex_lock( &sb_lock );
+      pthread_mutex_lock( &pl_lock );
+      gen = __atomic_load_n( &sb_gen, __ATOMIC_ACQUIRE );
+      idx = sb_idx = standby_target( failures );
+      sb_ready = false;
+      memset( &probe_sb, 0, sizeof probe_sb );
+      url = strdup( pool_url( idx ) );
+      pthread_mutex_unlock( &pl_lock );
+
+      // a job from an earlier connection is not one to mine
+      pthread_mutex_lock( &standby.work_lock );
+      free( standby.job.job_id );
+      standby.job.job_id = NULL;
+      pthread_mutex_unlock( &standby.work_lock );
+
+      ok = stratum_connect( &standby, url )
+           && stratum_subscribe( &standby )
+           && stratum_authorize( &standby, rpc_user, rpc_pass );
+      free( url );
+      if ( ok )
+      {
+         if ( opt_debug )
+            applog( LOG_DEBUG, "Standby connected to %s",
+                    pool_short_url( idx ) );
+         failures = 0;
+         standby_warm( idx, gen );
+      }
+      else
+         failures++;
+
+      // the context is only still ours if nothing swapped it away
+      if ( __atomic_load_n( &sb_gen, __ATOMIC_ACQUIRE ) == gen )
+      {
+         pthread_mutex_lock( &pl_lock );
+         sb_ready = false;
+         pthread_mutex_unlock( &pl_lock );
+         stratum_disconnect( &standby );
+      }
+      pthread_mutex_unlock( &sb_lock );
+      if ( !ok )
+         sleep( opt_fail_pause );
+   }
+   return NULL;
+}
+
+void pool_start()
+{
+   pthread_t th;
+
+   if ( pool_count < 2 )
+      return;
+   if ( jsonrpc_2 )
+   {
+      applog( LOG_WARNING, "No standby pool with jsonrpc 2" );
+      pool_count = 1;
+      return;
+   }
+   standby.standby = true;
+   pthread_mutex_init( &standby.sock_lock, NULL );
+   pthread_mutex_init( &standby.work_lock, NULL );
+   if ( pthread_create( &th, NULL, standby_thread, NULL ) )
+   {
+      applog( LOG_ERR, "standby pool thread create failed" );
+      pool_count = 1;
+      return;
+   }
+   pthread_detach( th );
+}
+
+int pool_report( char *buf, int size )
+{
+   char *p = buf, *end = buf + size;
+   uint64_t nowork, last;
+
+   *buf = '\0';
+   pthread_mutex_lock( &pl_lock );
+   for ( int i = 0; i < pool_count && p < end; i++ )
+   {
+      const struct pool *pl = &pools[i];
+      const char *role = i == active_idx ? "active"
+                       : i == sb_idx ? ( sb_ready ? "standby" : "connecting" )
+                       : "idle";
+
+      p += snprintf( p, end - p, "POOL=%d;URL=%s;ROLE=%s;PINGS=%" PRIu64
+                     ";ANSWERS=%" PRIu64 ";MISSES=%" PRIu64 ";RTT=%.2f|", i,
+                     pool_short_url( i ), role, pl->pings, pl->answers,
+                     pl->misses, pl->rtt_us / 1e3 );
+   }
+   // an outage going on counts up to now
+   nowork = nowork_total;
+   last = nowork_last;
+   if ( nowork_since )
+   {
+      last = now_us() - nowork_since;
+      nowork += last;
+   }
+   if ( p < end )
+      p += snprintf( p, end - p, "FAILOVERS=%" PRIu64 ";FAILBACKS=%" PRIu64
+                     ";OUTAGES=%" PRIu64 ";NOWORK=%" PRIu64 ";LAST=%" PRIu64
+                     ";MAX=%" PRIu64 "|", failovers, failbacks, outages,
+                     nowork / 1000, last / 1000,
+                     ( last > nowork_max ? last : nowork_max ) / 1000 );
+   pthread_mutex_unlock( &pl_lock );
+   if ( p > end )
+      p = end;
+   return (int)( p - buf );
+}
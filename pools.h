@@ -0,0 +1,73 @@
+#ifndef POOLS_H__
+#define POOLS_H__
+
+#include <stdbool.h>
+
+// Stratum pool failover.
+//
+// The pool of -o comes first, the --backup-url pools after it in the
+// order given. While the stratum thread mines on one of them, a standby
+// thread keeps the best of the others connected, subscribed, authorized
+// and receiving jobs, so switching to it is a swap of two stratum
+// contexts and new work goes out at once.
+//
+// Both connections are probed with mining.ping every POOL_PROBE_MS. A
+// pool that has answered a probe before and then hears nothing on its
+// connection for --failover-ms after one has missed its deadline: the
+// active one is switched away from, the standby one is reconnected.
+// Pools that never answer only fail by dropping the connection or by
+// the usual --timeout. A standby on a better pool than the active one
+// that stays ready for POOL_FAILBACK_S is switched back to.
+//
+// Without backups nothing is probed and there is no standby thread.
+// The time spent without valid stratum work, from losing the active
+// connection to the first work from the next one, is counted either
+// way, see the "pools" API command. jsonrpc 2 pools get no standby.
+
+#define POOL_MAX          8
+#define POOL_PROBE_MS     2000
+#define POOL_FAILBACK_S   30
+
+// What pool_wait saw on the active connection.
+enum
+{
+   POOL_LINE,        // a line to receive
+   POOL_DEAD,        // timed out or missed a deadline
+   POOL_SWITCHED     // moved back to a better pool, the context is new
+};
+
+struct stratum_ctx;
+
+extern int opt_failover_ms;
+
+// --backup-url, false if the list is full or url is not stratum.
+bool pool_add_backup( const char *url );
+
+// Start the standby thread, main thread once the stratum thread runs.
+void pool_start();
+
+// Wait up to timeout seconds for a line on the active connection,
+// probing it meanwhile. Stratum thread.
+int pool_wait( struct stratum_ctx *sctx, int timeout );
+
+// A line received on the active connection, true if it was the answer
+// to a probe and needs nothing else. Stratum thread.
+bool pool_line( const char *s );
+
+// The active connection is down, swap in the standby if it is ready.
+// Stratum thread.
+bool pool_failover();
+
+// The active connection is back on the -o pool, seturl.
+void pool_reset_active();
+
+// No active connection, so no valid work, and work generated again.
+void pool_work_lost();
+void pool_work_valid();
+
+// One "POOL=n;URL=;ROLE=;PINGS=;ANSWERS=;MISSES=;RTT=|" per pool, RTT of
+// the last answer in ms, then "FAILOVERS=;FAILBACKS=;OUTAGES=;NOWORK=;
+// LAST=;MAX=|" with the times without work in ms.
+int pool_report( char *buf, int size );
+
+#endif
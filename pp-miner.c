@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
+#include <math.h>
 #include <signal.h>
 #include <memory.h>
 
@@ -65,6 +66,17 @@
 #pragma comment(lib, "winmm.lib")
 #endif
 #include "drv_api.h"
+#include "asic-miner.h"
+#include "work-snap.h"
+#include "nonce-sched.h"
+#include "topology.h"
+#include "scratch.h"
+#include "job-trace.h"
+#include "stratum-msg.h"
+#include "share-track.h"
+#include "pools.h"
+#include "trace.h"
+#include <mm_malloc.h>
 
 #define LP_SCANTIME		60
 
@@ -90,10 +102,10 @@ static bool opt_background = false;
 bool opt_quiet = false;
 bool opt_randomize = false;
 static int opt_retries = -1;
-static int opt_fail_pause = 10;
+int opt_fail_pause = 10;
 static int opt_time_limit = 0;
 int opt_timeout = 300;
-static int opt_scantime = 5;
+int opt_scantime = 5;
 //static const bool opt_time = true;
 enum algos opt_algo = ALGO_NULL;
 int opt_scrypt_n = 0;
@@ -104,6 +116,13 @@ __int128_t opt_affinity = -1LL;
 #else
 int64_t opt_affinity = -1LL;
 #endif
+int opt_cpu_placement = TOPO_NONE;
+bool opt_huge_pages = true;
+bool opt_lock_pages = false;
+int opt_cn_ways[ 256 ];
+int opt_cn_ways_count = 0;
+int opt_submit_window = 32;
+int opt_failover_ms = 1000;
 int opt_priority = 0;
 int num_cpus;
 char *rpc_url = NULL;;
@@ -136,9 +155,9 @@ bool opt_stratum_stats = false;
 
 uint32_t accepted_count = 0L;
 uint32_t rejected_count = 0L;
+uint32_t dropped_count = 0L;   // shares the submit queue had no room for
 uint32_t solved_count = 0L;
-double *thr_hashrates;
-double *thr_hashcount;
+struct thr_stats *thr_stats;
 double global_hashcount = 0;
 double global_hashrate = 0;
 double stratum_diff = 0.;
@@ -171,6 +190,7 @@ static char const short_options[] =
 static struct work g_work = {{ 0 }};
 //static struct work tmp_work;
 time_t g_work_time = 0;
+static uint64_t g_work_seq = 0;   // bumped when get_work changes g_work
 static        pthread_mutex_t g_work_lock;
 static bool   submit_old = false;
 char*  lp_id;
@@ -204,9 +224,9 @@ static void affine_to_cpu_mask( int id, unsigned long long mask )
 {
    cpu_set_t set;
    CPU_ZERO( &set );
-   uint8_t ncpus = (num_cpus > 256) ? 256 : num_cpus;
+   int ncpus = (num_cpus > 128) ? 128 : num_cpus;
 
-   for ( uint8_t i = 0; i < ncpus; i++ )
+   for ( int i = 0; i < ncpus; i++ )
    {
       // cpu mask
 #if ( __GNUC__ > 4 ) || ( ( __GNUC__ == 4 ) && ( __GNUC_MINOR__ >= 8 ) )
@@ -218,12 +238,12 @@ static void affine_to_cpu_mask( int id, unsigned long long mask )
    if ( id == -1 )
    {
       // process affinity
-      sched_setaffinity(0, sizeof(&set), &set);
+      sched_setaffinity(0, sizeof(set), &set);
    }
    else
    {
       // thread only
-      pthread_setaffinity_np(thr_info[id].pth, sizeof(&set), &set);
+      pthread_setaffinity_np(thr_info[id].pth, sizeof(set), &set);
    }
 }
 
@@ -261,6 +281,7 @@ void proper_exit(int reason)
 		}
 	}
 #endif
+	trace_stop();
 	exit(reason);
 }
 
@@ -269,27 +290,126 @@ uint32_t* get_stratum_job_ntime()
    return (uint32_t*)stratum.job.ntime;
 }
 
+static struct work_alloc_stats work_allocs = { 0 };
+
+static char *work_strdup(const char *s)
+{
+	__atomic_fetch_add(&work_allocs.heap, 1, __ATOMIC_RELAXED);
+	return strdup(s);
+}
+
 void work_free(struct work *w)
 {
 	if (w->txs) free(w->txs);
 	if (w->workid) free(w->workid);
-	if (w->job_id) free(w->job_id);
-	if (w->xnonce2) free(w->xnonce2);
+	if (w->job_id && w->job_id != w->job_id_buf) free(w->job_id);
+	if (w->xnonce2 && w->xnonce2 != w->xnonce2_buf) free(w->xnonce2);
 }
 
 void work_copy(struct work *dest, const struct work *src)
 {
 	memcpy(dest, src, sizeof(struct work));
 	if (src->txs)
-		dest->txs = strdup(src->txs);
+		dest->txs = work_strdup(src->txs);
 	if (src->workid)
-		dest->workid = strdup(src->workid);
+		dest->workid = work_strdup(src->workid);
+	dest->job_id = NULL;
 	if (src->job_id)
-		dest->job_id = strdup(src->job_id);
-	if (src->xnonce2) {
-		dest->xnonce2 = (uchar*) malloc(src->xnonce2_len);
-		memcpy(dest->xnonce2, src->xnonce2, src->xnonce2_len);
+		work_set_job_id(dest, src->job_id);
+	dest->xnonce2 = NULL;
+	dest->xnonce2_len = 0;
+	if (src->xnonce2)
+		work_set_xnonce2(dest, src->xnonce2, src->xnonce2_len);
+}
+
+// Move src into dest without copying its strings, src must not be used
+// or freed after.
+static void work_move(struct work *dest, const struct work *src)
+{
+	memcpy(dest, src, sizeof(struct work));
+	if (src->job_id == src->job_id_buf)
+		dest->job_id = dest->job_id_buf;
+	if (src->xnonce2 == src->xnonce2_buf)
+		dest->xnonce2 = dest->xnonce2_buf;
+}
+
+void work_set_job_id(struct work *w, const char *job_id)
+{
+	size_t len;
+
+	if (w->job_id && !strcmp(w->job_id, job_id))
+		return;
+	if (w->job_id != w->job_id_buf)
+		free(w->job_id);
+	len = strlen(job_id);
+	if (len < sizeof(w->job_id_buf)) {
+		memcpy(w->job_id_buf, job_id, len + 1);
+		w->job_id = w->job_id_buf;
+	} else
+		w->job_id = work_strdup(job_id);
+}
+
+void work_set_xnonce2(struct work *w, const unsigned char *xnonce2, size_t len)
+{
+	if (len <= sizeof(w->xnonce2_buf)) {
+		if (w->xnonce2 != w->xnonce2_buf) {
+			free(w->xnonce2);
+			w->xnonce2 = w->xnonce2_buf;
+		}
+	} else if (w->xnonce2 == w->xnonce2_buf || w->xnonce2_len != len) {
+		if (w->xnonce2 != w->xnonce2_buf)
+			free(w->xnonce2);
+		__atomic_fetch_add(&work_allocs.heap, 1, __ATOMIC_RELAXED);
+		w->xnonce2 = (uchar*) malloc(len);
 	}
+	memcpy(w->xnonce2, xnonce2, len);
+	w->xnonce2_len = len;
+}
+
+void thr_stats_update(int thr_id, uint64_t hashes, double secs)
+{
+	struct thr_stats *st = &thr_stats[thr_id];
+	double decay = exp(-secs / THR_STATS_TAU);
+	double rate, count = hashes;
+
+	/* hashes over time with both decayed, so each scan counts by its
+	 * length and a short first scan doesn't set the rate */
+	st->avg_hashes = st->avg_hashes * decay + hashes;
+	st->avg_secs = st->avg_secs * decay + secs;
+	rate = st->avg_hashes / st->avg_secs;
+	__atomic_store(&st->hashrate, &rate, __ATOMIC_RELAXED);
+	__atomic_store(&st->hashcount, &count, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->hashes, st->hashes + hashes, __ATOMIC_RELAXED);
+}
+
+double thr_hashrate(int thr_id)
+{
+	double rate;
+
+	__atomic_load(&thr_stats[thr_id].hashrate, &rate, __ATOMIC_RELAXED);
+	return rate;
+}
+
+void thr_stats_total(double *hashcount, double *hashrate)
+{
+	double count = 0., rate = 0.;
+
+	for (int i = 0; i < opt_n_threads; i++) {
+		double c;
+
+		__atomic_load(&thr_stats[i].hashcount, &c, __ATOMIC_RELAXED);
+		count += c;
+		rate += thr_hashrate(i);
+	}
+	*hashcount = count;
+	*hashrate = rate;
+}
+
+void work_get_alloc_stats(struct work_alloc_stats *st)
+{
+	st->cmd_allocs = __atomic_load_n(&work_allocs.cmd_allocs, __ATOMIC_RELAXED);
+	st->cmd_reused = __atomic_load_n(&work_allocs.cmd_reused, __ATOMIC_RELAXED);
+	st->heap = __atomic_load_n(&work_allocs.heap, __ATOMIC_RELAXED);
 }
 
 bool jr2_work_decode( const json_t *val, struct work *work )
@@ -776,7 +896,7 @@ void scale_hash_for_display ( double* hashrate, char* units )
      }
 }
 
-static int share_result( int result, struct work *work, const char *reason )
+static int share_result( int result, double sharediff, const char *reason )
 {
    char hc[16];
    char hr[16];
@@ -788,17 +908,11 @@ static int share_result( int result, struct work *work, const char *reason )
    uint32_t total_submits;
    float rate;
    char rate_s[8] = {0};
-   double sharediff = work ? work->sharediff : stratum.sharediff;
    bool solved = result && (net_diff > 0.0 ) && ( sharediff >= net_diff );
    char sol[32] = {0};
-   int i;
 
+   thr_stats_total( &hashcount, &hashrate );
    pthread_mutex_lock(&stats_lock);
-   for (i = 0; i < opt_n_threads; i++)
-   {
-       hashcount += thr_hashcount[i];
-       hashrate += thr_hashrates[i];
-   }
    result ? accepted_count++ : rejected_count++;
 
    if ( solved )
@@ -917,8 +1031,8 @@ void std_le_build_stratum_request( char *req, struct work *work )
    bin2hex( noncestr, (char*)(&nonce), sizeof(uint32_t) );
    xnonce2str = abin2hex( work->xnonce2, work->xnonce2_len );
    snprintf( req, JSON_BUF_LEN,
-        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr );
+        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
+         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr, work->submit_id );
    free( xnonce2str );
 }
 
@@ -934,8 +1048,8 @@ void std_be_build_stratum_request( char *req, struct work *work )
    bin2hex( noncestr, (char*)(&nonce), sizeof(uint32_t) );
    xnonce2str = abin2hex( work->xnonce2, work->xnonce2_len );
    snprintf( req, JSON_BUF_LEN,
-        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr );
+        "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
+         rpc_user, work->job_id, xnonce2str, ntimestr, noncestr, work->submit_id );
    free( xnonce2str );
 }
 
@@ -948,8 +1062,8 @@ void jr2_build_stratum_request( char *req, struct work *work )
    algo_gate.hash_suw( hash, work->data );
    char *hashhex = abin2hex(hash, 32);
    snprintf( req, JSON_BUF_LEN,
-        "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":4}",
-          rpc2_id, work->job_id, noncestr, hashhex );
+        "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":%u}",
+          rpc2_id, work->job_id, noncestr, hashhex, work->submit_id );
    free( hashhex );
 }
 
@@ -981,7 +1095,7 @@ bool std_le_submit_getwork_result( CURL *curl, struct work *work )
    }
    res = json_object_get( val, "result" );
    reason = json_object_get( val, "reject-reason" );
-   share_result( json_is_true( res ), work,
+   share_result( json_is_true( res ), work->sharediff,
                  reason ? json_string_value( reason ) : NULL );
    json_decref( val );
    return true;
@@ -1015,7 +1129,7 @@ bool std_be_submit_getwork_result( CURL *curl, struct work *work )
    }
    res = json_object_get( val, "result" );
    reason = json_object_get( val, "reject-reason" );
-   share_result( json_is_true( res ), work,
+   share_result( json_is_true( res ), work->sharediff,
                  reason ? json_string_value( reason ) : NULL );
    json_decref( val );
    return true;
@@ -1049,13 +1163,13 @@ bool jr2_submit_getwork_result( CURL *curl, struct work *work )
    json_t *status = json_object_get( res, "status" );
    bool valid = !strcmp( status ? json_string_value( status ) : "", "OK" );
    if (valid)
-       share_result( valid, work, NULL );
+       share_result( valid, work->sharediff, NULL );
    else
    {
        json_t *err = json_object_get( res, "error" );
        const char *sreason = json_string_value( json_object_get(
                                                       err, "message" ) );
-       share_result( valid, work, sreason );
+       share_result( valid, work->sharediff, sreason );
        if ( !strcasecmp( "Invalid job id", sreason ) )
        {
             work_free( work );
@@ -1102,7 +1216,35 @@ char* std_malloc_txs_request( struct work *work )
   return req;
 }
 
-static bool submit_upstream_work( CURL *curl, struct work *work )
+// mining.submit lines not sent yet, the workio thread sends them all at
+// once when its queue runs empty, so a burst of shares takes one send.
+static char   submit_batch[ 16 * JSON_BUF_LEN ];
+static size_t submit_batch_len = 0;
+
+static void submit_batch_flush()
+{
+   if ( !submit_batch_len )
+      return;
+   // their shares stay in flight, lost when the connection is reset
+   if ( unlikely( !stratum_send_line( &stratum, submit_batch ) ) )
+      applog( LOG_ERR, "submit_upstream_work stratum_send_line failed" );
+   submit_batch_len = 0;
+}
+
+static void submit_batch_add( const char *req )
+{
+   size_t len = strlen( req );
+
+   // a newline before it and room for the one send_line appends
+   if ( submit_batch_len + len + 2 > sizeof submit_batch )
+      submit_batch_flush();
+   if ( submit_batch_len )
+      submit_batch[ submit_batch_len++ ] = '\n';
+   memcpy( submit_batch + submit_batch_len, req, len + 1 );
+   submit_batch_len += len;
+}
+
+static bool stale_work( struct work *work )
 {
    /* pass if the previous hash is not the current previous hash */
    if ( !submit_old && memcmp( &work->data[1], &g_work.data[1], 32 ) )
@@ -1111,6 +1253,13 @@ static bool submit_upstream_work( CURL *curl, struct work *work )
          applog(LOG_DEBUG, "DEBUG: stale work detected, discarding");
       return true;
    }
+   return false;
+}
+
+static bool submit_upstream_work( CURL *curl, struct work *work )
+{
+   if ( stale_work( work ) )
+      return true;
 
    if ( !have_stratum && allow_mininginfo )
    {
@@ -1127,13 +1276,22 @@ static bool submit_upstream_work( CURL *curl, struct work *work )
    if ( have_stratum )
    {
        char req[JSON_BUF_LEN];
-       stratum.sharediff = work->sharediff;
-       algo_gate.build_stratum_request( req, work, &stratum );
-       if ( unlikely( !stratum_send_line( &stratum, req ) ) )
+
+       if ( share_track_full() )
        {
-          applog(LOG_ERR, "submit_upstream_work stratum_send_line failed");
-          return false;
+          // the answers to wait for may be to shares not sent yet
+          submit_batch_flush();
+          work->submit_id = share_track_begin( work->sharediff );
+          if ( stale_work( work ) )
+          {
+             share_track_cancel( work->submit_id );
+             return true;
+          }
        }
+       else
+          work->submit_id = share_track_begin( work->sharediff );
+       algo_gate.build_stratum_request( req, work, &stratum );
+       submit_batch_add( req );
        return true;
    }
    else if ( work->txs )
@@ -1166,11 +1324,12 @@ static bool submit_upstream_work( CURL *curl, struct work *work )
             iter = json_object_iter_next( res, iter );
          }
          res_str = json_dumps( res, 0 );
-         share_result( sumres, work, res_str );
+         share_result( sumres, work->sharediff, res_str );
          free( res_str );
       }
       else
-         share_result( json_is_null( res ), work, json_string_value( res ) );
+         share_result( json_is_null( res ), work->sharediff,
+                       json_string_value( res ) );
       json_decref( val );
       return true;
    }
@@ -1265,40 +1424,77 @@ start:
    return rc;
 }
 
+/* workio commands are recycled through a free list, each one carries
+ * the storage for its work, so handing work to and from the workio
+ * thread does not allocate once the list is warm. */
+static struct workio_cmd *workio_cmd_pool = NULL;
+static pthread_mutex_t workio_cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct workio_cmd *workio_cmd_alloc(enum workio_commands cmd,
+                                           struct thr_info *thr)
+{
+	struct workio_cmd *wc;
+
+	pthread_mutex_lock(&workio_cmd_lock);
+	wc = workio_cmd_pool;
+	if (wc)
+		workio_cmd_pool = wc->next;
+	pthread_mutex_unlock(&workio_cmd_lock);
+	if (wc)
+		__atomic_fetch_add(&work_allocs.cmd_reused, 1, __ATOMIC_RELAXED);
+	else {
+		wc = (struct workio_cmd *) malloc(sizeof(*wc));
+		if (!wc)
+			return NULL;
+		__atomic_fetch_add(&work_allocs.cmd_allocs, 1, __ATOMIC_RELAXED);
+	}
+	memset(wc, 0, sizeof(*wc));
+	wc->cmd = cmd;
+	wc->thr = thr;
+	wc->u.work = &wc->work;
+	return wc;
+}
+
 static void workio_cmd_free(struct workio_cmd *wc)
 {
 	if (!wc)
 		return;
 
-	switch (wc->cmd) {
-	case WC_SUBMIT_WORK:
+	/* a work fetched by WC_GET_WORK was moved to the requester */
+	if (wc->cmd == WC_SUBMIT_WORK)
 		work_free(wc->u.work);
-		free(wc->u.work);
-		break;
-	default: /* do nothing */
-		break;
-	}
 
-	memset(wc, 0, sizeof(*wc)); /* poison */
-	free(wc);
+	pthread_mutex_lock(&workio_cmd_lock);
+	wc->next = workio_cmd_pool;
+	workio_cmd_pool = wc;
+	pthread_mutex_unlock(&workio_cmd_lock);
+}
+
+/* Fill the free list so the first shares don't allocate either. */
+static void workio_cmd_prealloc(int n)
+{
+	while (n--) {
+		struct workio_cmd *wc =
+			(struct workio_cmd *) calloc(1, sizeof(*wc));
+		if (!wc)
+			return;
+		work_allocs.cmd_allocs++;
+		wc->next = workio_cmd_pool;
+		workio_cmd_pool = wc;
+	}
 }
 
 static bool workio_get_work(struct workio_cmd *wc, CURL *curl)
 {
-   struct work *ret_work;
    int failures = 0;
 
-   ret_work = (struct work*) calloc(1, sizeof(*ret_work));
-   if (!ret_work)
-	return false;
-
    /* obtain new work from bitcoin via JSON-RPC */
-   while (!get_upstream_work(curl, ret_work))
+   while (!get_upstream_work(curl, wc->u.work))
    {
 	if (unlikely((opt_retries >= 0) && (++failures > opt_retries)))
         {
            applog(LOG_ERR, "json_rpc_call failed, terminating workio thread");
-           free(ret_work);
+           workio_cmd_free(wc);
 	   return false;
         }
 
@@ -1308,9 +1504,9 @@ static bool workio_get_work(struct workio_cmd *wc, CURL *curl)
 	sleep(opt_fail_pause);
    }
 
-   /* send work to requesting thread */
-   if (!tq_push(wc->thr->q, ret_work))
-	free(ret_work);
+   /* send the command back with its work to the requesting thread */
+   if (!tq_push(wc->thr->q, wc))
+	workio_cmd_free(wc);
 
    return true;
 }
@@ -1413,10 +1609,18 @@ static void *workio_thread(void *userdata)
 		ok = rpc2_workio_login(curl);
 	while (ok)
         {
+		static const struct timespec poll_only = { 0, 0 };
 		struct workio_cmd *wc;
 
-		/* wait for workio_cmd sent to us, on our queue */
-		wc = (struct workio_cmd *) tq_pop(mythr->q, NULL);
+		/* wait for workio_cmd sent to us, on our queue, only look
+		   while there are shares to send */
+		wc = (struct workio_cmd *) tq_pop(mythr->q,
+				submit_batch_len ? &poll_only : NULL);
+		if (!wc && submit_batch_len)
+		{
+			submit_batch_flush();
+			continue;
+		}
 		if (!wc)
                 {
 			ok = false;
@@ -1427,17 +1631,19 @@ static void *workio_thread(void *userdata)
 		switch (wc->cmd)
                 {
 		case WC_GET_WORK:
+			/* wc is handed back to the requester */
 			ok = workio_get_work(wc, curl);
 			break;
 		case WC_SUBMIT_WORK:
 			ok = workio_submit_work(wc, curl);
+			workio_cmd_free(wc);
 			break;
 
 		default:		/* should never happen */
 			ok = false;
+			workio_cmd_free(wc);
 			break;
 		}
-		workio_cmd_free(wc);
 	}
 	tq_freeze(mythr->q);
 	curl_easy_cleanup(curl);
@@ -1447,7 +1653,6 @@ static void *workio_thread(void *userdata)
 static bool get_work(struct thr_info *thr, struct work *work)
 {
 	struct workio_cmd *wc;
-	struct work *work_heap;
 
 	if (opt_benchmark)
         {
@@ -1465,39 +1670,39 @@ static bool get_work(struct thr_info *thr, struct work *work)
 		return true;
 	}
 	/* fill out work request message */
-	wc = (struct workio_cmd *) calloc(1, sizeof(*wc));
+	wc = workio_cmd_alloc(WC_GET_WORK, thr);
 	if (!wc)
 		return false;
-	wc->cmd = WC_GET_WORK;
-	wc->thr = thr;
-	/* send work request to workio thread */
-	if (!tq_push(thr_info[work_thr_id].q, wc))
-        {
-		workio_cmd_free(wc);
-		return false;
+	/* send work request to workio thread, waiting out a full queue, only
+	 * a frozen one means workio is gone */
+	while (!tq_push(thr_info[work_thr_id].q, wc))
+	{
+		if (tq_frozen(thr_info[work_thr_id].q))
+		{
+			workio_cmd_free(wc);
+			return false;
+		}
+		sleep(1);
 	}
-	/* wait for response, a unit of work */
-	work_heap = (struct work*) tq_pop(thr->q, NULL);
-	if (!work_heap)
+	/* wait for response, the command with a unit of work */
+	wc = (struct workio_cmd *) tq_pop(thr->q, NULL);
+	if (!wc)
 		return false;
-	/* copy returned work into storage provided by caller */
-	memcpy(work, work_heap, sizeof(*work));
-	free(work_heap);
+	/* move returned work into storage provided by caller */
+	work_free(work);
+	work_move(work, wc->u.work);
+	workio_cmd_free(wc);
 	return true;
 }
 
-static bool submit_work(struct thr_info *thr, const struct work *work_in)
+bool submit_work(struct thr_info *thr, const struct work *work_in)
 {
 	struct workio_cmd *wc;
+	uint32_t dropped;
 	/* fill out work request message */
-	wc = (struct workio_cmd *) calloc(1, sizeof(*wc));
+	wc = workio_cmd_alloc(WC_SUBMIT_WORK, thr);
 	if (!wc)
 		return false;
-	wc->u.work = (struct work*) malloc(sizeof(*work_in));
-	if (!wc->u.work)
-		goto err_out;
-	wc->cmd = WC_SUBMIT_WORK;
-	wc->thr = thr;
 	work_copy(wc->u.work, work_in);
 
 	/* send solution to workio thread */
@@ -1506,7 +1711,16 @@ static bool submit_work(struct thr_info *thr, const struct work *work_in)
 	return true;
 err_out:
 	workio_cmd_free(wc);
-	return false;
+	/* a full queue only drops the share, workio is stuck on the pool
+	 * for now and the miner keeps going */
+	if (tq_frozen(thr_info[work_thr_id].q))
+		return false;
+	pthread_mutex_lock(&stats_lock);
+	dropped = ++dropped_count;
+	pthread_mutex_unlock(&stats_lock);
+	applog(LOG_WARNING, "Submit queue full, share dropped (%u so far)",
+		dropped);
+	return true;
 }
 
 bool rpc2_stratum_job( struct stratum_ctx *sctx, json_t *params )
@@ -1577,23 +1791,13 @@ int64_t get_max64_0x1ffff()    { return 0x1ffff;    }
 int64_t get_max64_0xffffLL()   { return 0xffffLL;   };
 
 // default
-void sha256d_gen_merkle_root( char* merkle_root, struct stratum_ctx* sctx )
+void sha256d_gen_merkle_root( char* root, struct stratum_ctx* sctx )
 {
-  sha256d(merkle_root, sctx->job.coinbase, (int) sctx->job.coinbase_size);
-  for ( int i = 0; i < sctx->job.merkle_count; i++ )
-  {
-     memcpy( merkle_root + 32, sctx->job.merkle[i], 32 );
-     sha256d( merkle_root, merkle_root, 64 );
-  }
+  merkle_get_root( (unsigned char*)root, sctx, true );
 }
-void SHA256_gen_merkle_root( char* merkle_root, struct stratum_ctx* sctx )
+void SHA256_gen_merkle_root( char* root, struct stratum_ctx* sctx )
 {
-  SHA256( sctx->job.coinbase, (int)sctx->job.coinbase_size, merkle_root );
-  for ( int i = 0; i < sctx->job.merkle_count; i++ )
-  {
-     memcpy( merkle_root + 32, sctx->job.merkle[i], 32 );
-     sha256d( merkle_root, merkle_root, 64 );
-  }
+  merkle_get_root( (unsigned char*)root, sctx, false );
 }
 
 // default
@@ -1712,6 +1916,18 @@ bool std_ready_to_mine( struct work* work, struct stratum_ctx* stratum,
    return true;
 }
 
+// Log the backing of the thread's largest scratchpad once it grows, only
+// for pads worth a huge page unless debugging.
+static void report_scratchpad( int thr_id, size_t *reported )
+{
+   char pad[64];
+   size_t size = scratch_describe( pad, sizeof pad );
+
+   if ( size > *reported && ( size >= ( 2 << 20 ) || opt_debug ) )
+      applog( LOG_INFO, "Thread %d scratchpad %s", thr_id, pad );
+   *reported = size;
+}
+
 static void *miner_thread( void *userdata )
 {
    struct   thr_info *mythr = (struct thr_info *) userdata;
@@ -1727,8 +1943,15 @@ static void *miner_thread( void *userdata )
                       ? ( 0xffffffffU / opt_n_threads ) * (thr_id + 1) - 0x20
                       : 0;
    time_t   firstwork_time = 0;
-   int  i;
+   uint64_t work_seq = 0;     // snapshot the stratum work came from
+   struct   work_builder builder;
+   bool     own_xnonce2 = false;
+   uint64_t sched_gen = 0;    // work generation mined from nonce_sched
+   uint64_t chunk_gen = 0;    // generation of the chunk being scanned
+   uint32_t chunk_end = 0;
+   size_t   pad_size = 0;     // largest scratchpad reported
    memset( &work, 0, sizeof(work) );
+   memset( &builder, 0, sizeof(builder) );
 
    /* Set worker threads to nice 19 and then preferentially to SCHED_IDLE
     * and if that fails, then SCHED_BATCH. No need for this to be an
@@ -1770,6 +1993,13 @@ static void *miner_thread( void *userdata )
 	   drop_policy();
    }
    // CPU thread affinity
+   if ( opt_cpu_placement != TOPO_NONE && topo_place_thread( thr_id ) )
+   {
+      if ( opt_debug )
+         applog( LOG_DEBUG, "Thread %d placed by %s policy", thr_id,
+                 topo_policy_name( opt_cpu_placement ) );
+   }
+   else
 /*
    if ( num_cpus > 64 )
    {
@@ -1809,11 +2039,13 @@ static void *miner_thread( void *userdata )
       applog( LOG_ERR, "FAIL: thread %u failed to initialize", thr_id );
       exit (1);
    }
+   report_scratchpad( thr_id, &pad_size );
 
    while (1)
    {
        uint64_t hashes_done;
-       struct timeval tv_start, tv_end, diff;
+       struct timespec ts_start, ts_end;
+       double elapsed;
        int64_t max64;
        int nonce_found = 0;
 
@@ -1821,13 +2053,55 @@ static void *miner_thread( void *userdata )
        {
           if ( have_stratum )
           {
+              const struct work_snap *snap;
+              uint32_t *nonceptr = algo_gate.get_nonceptr( work.data );
+
               algo_gate.wait_for_diff( &stratum );
-              pthread_mutex_lock( &g_work_lock );
-              if ( *algo_gate.get_nonceptr( work.data ) >= end_nonce )
-                 algo_gate.stratum_gen_work( &stratum, &g_work );
-              algo_gate.get_new_work( &work, &g_work, thr_id, &end_nonce,
-                                      stratum.job.clean );
-              pthread_mutex_unlock( &g_work_lock );
+              // Out of nonces on the shared work, roll it unless another
+              // thread already replaced the one this thread was using.
+              if ( !own_xnonce2 && *nonceptr >= end_nonce )
+              {
+                 pthread_mutex_lock( &g_work_lock );
+                 if ( work_snap_seq() == work_seq )
+                 {
+                    algo_gate.stratum_gen_work( &stratum, &g_work );
+                    work_snap_publish( &g_work, &stratum );
+                 }
+                 pthread_mutex_unlock( &g_work_lock );
+              }
+              snap = work_snap_acquire( thr_id );
+              if ( snap && snap->seq != work_seq && thr_id < 255
+                   && work_builder_load( &builder, snap, thr_id + 1 ) )
+              {
+                 // New job in an extranonce2 range of this thread's own,
+                 // so the whole nonce range is this thread's too.
+                 own_xnonce2 = true;
+                 work_builder_next( &builder, &work );
+                 *nonceptr = 0;
+                 end_nonce = 0xffffffffU - 0x20;
+                 work_seq = snap->seq;
+              }
+              else if ( own_xnonce2 && snap && snap->seq == work_seq )
+              {
+                 if ( *nonceptr >= end_nonce )
+                 {
+                    work_builder_next( &builder, &work );
+                    *nonceptr = 0;
+                 }
+                 else
+                    ++(*nonceptr);
+              }
+              else if ( snap )
+              {
+                 own_xnonce2 = false;
+                 algo_gate.get_new_work( &work, (struct work*)&snap->work,
+                                         thr_id, &end_nonce, stratum.job.clean );
+                 work_seq = snap->seq;
+              }
+              work_snap_release( thr_id );
+              sched_gen = !own_xnonce2
+                          && algo_gate.get_new_work == std_get_new_work
+                        ? work_seq : 0;
           }
           else
           {
@@ -1837,6 +2111,9 @@ static void *miner_thread( void *userdata )
              if ( time(NULL) - g_work_time >= min_scantime
                   || *algo_gate.get_nonceptr( work.data ) >= end_nonce )
              {
+                uint32_t prev_data[48];
+
+                memcpy( prev_data, g_work.data, sizeof prev_data );
                 if ( unlikely( !get_work( mythr, &g_work ) ) )
                 {
                    applog( LOG_ERR, "work retrieval failed, exiting "
@@ -1845,8 +2122,12 @@ static void *miner_thread( void *userdata )
                    goto out;
                 }
                 g_work_time = time(NULL);
+                if ( memcmp( prev_data, g_work.data, algo_gate.work_cmp_size ) )
+                   g_work_seq++;
             }
             algo_gate.get_new_work( &work, &g_work, thr_id, &end_nonce, true );
+            sched_gen = algo_gate.get_new_work == std_get_new_work
+                      ? g_work_seq : 0;
 
              pthread_mutex_unlock( &g_work_lock );
           }
@@ -1861,6 +2142,36 @@ static void *miner_thread( void *userdata )
           sleep(5);
           continue;
        }
+       // Shared work, scan chunks claimed from its nonce range instead of
+       // a fixed 1/n slice.
+       if ( sched_gen )
+       {
+          uint32_t *nonceptr = algo_gate.get_nonceptr( work.data );
+
+          if ( chunk_gen != sched_gen || *nonceptr >= chunk_end )
+          {
+             uint32_t start;
+
+             switch ( nonce_sched_claim( sched_gen,
+                                 nonce_sched_size( thr_hashrate( thr_id ) ),
+                                 &start, &chunk_end ) )
+             {
+                case NONCE_CHUNK:
+                   chunk_gen = sched_gen;
+                   *nonceptr = start;
+                   break;
+                case NONCE_DONE:
+                   // all handed out, roll or fetch the next work
+                   chunk_gen = 0;
+                   *nonceptr = end_nonce = NONCE_SCHED_END;
+                   continue;
+                case NONCE_STALE:
+                   chunk_gen = 0;
+                   continue;
+             }
+          }
+          end_nonce = NONCE_SCHED_END;
+       }
        // adjust max_nonce to meet target scan time
        if (have_stratum)
           max64 = LP_SCANTIME;
@@ -1897,11 +2208,12 @@ static void *miner_thread( void *userdata )
        }
        // max64
        uint32_t work_nonce = *( algo_gate.get_nonceptr( work.data ) );
-       max64 *= thr_hashrates[thr_id];
+       uint32_t last_nonce = sched_gen ? chunk_end : end_nonce;
+       max64 *= thr_hashrate( thr_id );
        if ( max64 <= 0)
           max64 = (int64_t)algo_gate.get_max64();
-       if ( work_nonce + max64 > end_nonce )
-          max_nonce = end_nonce;
+       if ( work_nonce + max64 > last_nonce )
+          max_nonce = last_nonce;
        else
           max_nonce = work_nonce + (uint32_t)max64;
        // init time
@@ -1909,23 +2221,28 @@ static void *miner_thread( void *userdata )
           firstwork_time = time(NULL);
        work_restart[thr_id].restart = 0;
        hashes_done = 0;
-       gettimeofday( (struct timeval *) &tv_start, NULL );
+       job_trace_scan( thr_id, have_stratum ? work_seq : 0 );
+       clock_gettime( CLOCK_MONOTONIC, &ts_start );
 
        // Scan for nonce
        nonce_found = algo_gate.scanhash( thr_id, &work, max_nonce,
                                          &hashes_done );
 
        // record scanhash elapsed time
-       gettimeofday( &tv_end, NULL );
-       timeval_subtract( &diff, &tv_end, &tv_start );
-       if ( diff.tv_usec || diff.tv_sec )
-       {
-          pthread_mutex_lock( &stats_lock );
-          thr_hashcount[thr_id] = hashes_done;
-          thr_hashrates[thr_id] =
-          hashes_done / ( diff.tv_sec + diff.tv_usec * 1e-6 );
-          pthread_mutex_unlock( &stats_lock );
-       }
+       clock_gettime( CLOCK_MONOTONIC, &ts_end );
+       elapsed = ( ts_end.tv_sec - ts_start.tv_sec )
+               + ( ts_end.tv_nsec - ts_start.tv_nsec ) * 1e-9;
+       if ( elapsed > 0. )
+          thr_stats_update( thr_id, hashes_done, elapsed );
+       if ( work_restart[thr_id].restart )
+          job_trace_observed( thr_id );
+       // some algos only allocate their scratchpad with the first hash
+       if ( scratch_describe( NULL, 0 ) > pad_size )
+          report_scratchpad( thr_id, &pad_size );
+       // scanned through to the end of the chunk, claim the next one
+       if ( sched_gen && max_nonce == chunk_end && !nonce_found
+            && !work_restart[thr_id].restart )
+          chunk_gen = 0;
 
        // if nonce(s) found submit work
        if ( nonce_found && !opt_benchmark )
@@ -1972,8 +2289,8 @@ static void *miner_thread( void *userdata )
           char hr[16];
           char hc_units[2] = {0,0};
           char hr_units[2] = {0,0};
-          double hashcount = thr_hashcount[thr_id];
-          double hashrate  = thr_hashrates[thr_id];
+          double hashcount = thr_stats[thr_id].hashcount;
+          double hashrate  = thr_stats[thr_id].hashrate;
           if ( hashcount )
           {
              scale_hash_for_display( &hashcount, hc_units );
@@ -1987,18 +2304,12 @@ static void *miner_thread( void *userdata )
                                thr_id, hc, hc_units, hr, hr_units );
           }
        }
-       // Display benchmark total
-       // Update hashrate for API if no shares accepted yet.
-       if ( ( opt_benchmark || !accepted_count )
-            && thr_id == opt_n_threads - 1 )
+       // Display benchmark total, the API sums the threads itself.
+       if ( opt_benchmark && thr_id == opt_n_threads - 1 )
        {
-          double hashrate  = 0.;
-          double hashcount = 0.;
-          for ( i = 0; i < opt_n_threads; i++ )
-          {
-              hashrate  += thr_hashrates[i];
-              hashcount += thr_hashcount[i];
-          }
+          double hashrate, hashcount;
+
+          thr_stats_total( &hashcount, &hashrate );
           if ( hashcount )
           {
              global_hashcount = hashcount;
@@ -2206,6 +2517,15 @@ out:
 	return NULL;
 }
 
+// Difficulty of the share answered by request id, 0 if not known.
+static double share_answered( long id, bool valid )
+{
+    double diff = 0.;
+
+    share_track_ack( (uint32_t)id, valid, &diff );
+    return diff;
+}
+
 bool std_stratum_handle_response( json_t *val )
 {
     bool valid = false;
@@ -2214,10 +2534,11 @@ bool std_stratum_handle_response( json_t *val )
     err_val = json_object_get( val, "error" );
     id_val  = json_object_get( val, "id" );
 
-    if ( !res_val || json_integer_value(id_val) < 4 )
+    if ( !res_val || json_integer_value(id_val) < SHARE_ID_FIRST )
          return false;
     valid = json_is_true( res_val );
-    share_result( valid, NULL, err_val ?
+    share_result( valid, share_answered( json_integer_value( id_val ), valid ),
+                  err_val ?
                   json_string_value( json_array_get(err_val, 1) ) : NULL );
     return true;
 }
@@ -2225,9 +2546,10 @@ bool std_stratum_handle_response( json_t *val )
 bool jr2_stratum_handle_response( json_t *val )
 {
     bool valid = false;
-    json_t *err_val, *res_val;
+    json_t *err_val, *res_val, *id_val;
     res_val = json_object_get( val, "result" );
     err_val = json_object_get( val, "error" );
+    id_val  = json_object_get( val, "id" );
 
     if ( !res_val && !err_val )
         return false;
@@ -2239,16 +2561,33 @@ bool jr2_stratum_handle_response( json_t *val )
     }
     else
         valid = json_is_null( err_val );
-    share_result( valid, NULL, err_val ? json_string_value(err_val) : NULL );
+    share_result( valid, share_answered( json_integer_value( id_val ), valid ),
+                  err_val ? json_string_value(err_val) : NULL );
     return true;
 }
 
 static bool stratum_handle_response( char *buf )
 {
+	struct stratum_msg msg;
 	json_t *val, *id_val;
 	json_error_t err;
 	bool ret = false;
 
+	// share answers without a reject reason, what std does with them
+	if ( algo_gate.stratum_handle_response == std_stratum_handle_response
+	     && stratum_msg_parse( &msg, buf )
+	     && ( msg.error.type == STOK_NONE || msg.error.type == STOK_NULL ) )
+	{
+		bool valid = msg.result.type == STOK_TRUE;
+		long id;
+
+		if ( msg.id.type != STOK_NUMBER || msg.result.type == STOK_NONE
+		     || ( id = strtol( msg.id.p, NULL, 10 ) ) < SHARE_ID_FIRST )
+			return false;
+		share_result( valid, share_answered( id, valid ), NULL );
+		return true;
+	}
+
 	val = JSON_LOADS( buf, &err );
 	if (!val)
         {
@@ -2309,16 +2648,26 @@ void std_build_extraheader( struct work* g_work, struct stratum_ctx* sctx )
           le32dec( sctx->job.ntime ), le32dec(sctx->job.nbits) );
 }
 
+// Whether miner threads split the jobs of sctx by the top extranonce2
+// byte. At least 2 bytes stay below it, so the shared counter gets 65536
+// headers per job before it wraps inside owner 0's range.
+static bool work_builder_splits( const struct stratum_ctx *sctx )
+{
+   return sctx->xnonce2_size >= 3
+          && algo_gate.stratum_gen_work == std_stratum_gen_work
+          && algo_gate.get_new_work == std_get_new_work;
+}
+
 void std_stratum_gen_work( struct stratum_ctx *sctx, struct work *g_work )
 {
    pthread_mutex_lock( &sctx->work_lock );
-   free( g_work->job_id );
-   g_work->job_id = strdup( sctx->job.job_id );
-   g_work->xnonce2_len = sctx->xnonce2_size;
-   g_work->xnonce2 = (uchar*) realloc( g_work->xnonce2, sctx->xnonce2_size );
-   memcpy( g_work->xnonce2, sctx->job.xnonce2, sctx->xnonce2_size );
+   work_set_job_id( g_work, sctx->job.job_id );
+   work_set_xnonce2( g_work, sctx->job.xnonce2, sctx->xnonce2_size );
 
    algo_gate.build_extraheader( g_work, sctx );
+   // don't carry into the miner threads' ranges
+   if ( work_builder_splits( sctx ) )
+      sctx->job.xnonce2[ sctx->xnonce2_size - 1 ] = 0;
 
    net_diff = algo_gate.calc_network_diff( g_work );
    algo_gate.set_work_data_endian( g_work );
@@ -2349,6 +2698,45 @@ void std_stratum_gen_work( struct stratum_ctx *sctx, struct work *g_work )
    }
 }
 
+// Take over a snapshot's job for one miner thread. False if the algo or
+// the job's extranonce2 can't be split, the thread then mines the shared
+// stratum work.
+bool work_builder_load( struct work_builder *b, const struct work_snap *snap,
+                        uint8_t owner )
+{
+   work_snap_free_job( &b->sctx );
+   if ( !snap->job || !owner || !work_builder_splits( snap->job ) )
+      return false;
+
+   work_snap_copy_job( &b->sctx, snap->job );
+   memset( b->sctx.job.xnonce2, 0, b->sctx.xnonce2_size );
+   b->sctx.job.xnonce2[ b->sctx.xnonce2_size - 1 ] = owner;
+   b->owner = owner;
+   return true;
+}
+
+// std_stratum_gen_work for the thread's own job copy: no locks and no
+// globals touched.
+void work_builder_next( struct work_builder *b, struct work *work )
+{
+   struct stratum_ctx *sctx = &b->sctx;
+   size_t top = sctx->xnonce2_size - 1;
+
+   work_set_job_id( work, sctx->job.job_id );
+   work_set_xnonce2( work, sctx->job.xnonce2, sctx->xnonce2_size );
+
+   algo_gate.build_extraheader( work, sctx );
+   // the increment carried into the next thread's range, start over
+   if ( sctx->job.xnonce2[top] != b->owner )
+   {
+      memset( sctx->job.xnonce2, 0, top );
+      sctx->job.xnonce2[top] = b->owner;
+   }
+
+   algo_gate.set_work_data_endian( work );
+   algo_gate.set_target( work, sctx->job.diff );
+}
+
 void jr2_stratum_gen_work( struct stratum_ctx *sctx, struct work *g_work )
 {
    pthread_mutex_lock( &sctx->work_lock );
@@ -2357,6 +2745,18 @@ void jr2_stratum_gen_work( struct stratum_ctx *sctx, struct work *g_work )
    pthread_mutex_unlock( &sctx->work_lock );
 }
 
+// The stratum context is a standby's now, its job gets mined at once.
+static void stratum_switched()
+{
+    share_track_flush();
+    pthread_mutex_lock( &g_work_lock );
+    g_work_time = 0;
+    pthread_mutex_unlock( &g_work_lock );
+    pthread_mutex_lock( &stratum.work_lock );
+    stratum.job.clean = true;
+    pthread_mutex_unlock( &stratum.work_lock );
+}
+
 static void *stratum_thread(void *userdata )
 {
     struct thr_info *mythr = (struct thr_info *) userdata;
@@ -2383,10 +2783,18 @@ static void *stratum_thread(void *userdata )
 	   }
            else if ( !opt_quiet )
 		applog(LOG_DEBUG, "Stratum connection reset");
+	   pool_reset_active();
 	}
 
         while ( !stratum.curl )
         {
+           share_track_flush();
+           pool_work_lost();
+           if ( pool_failover() )
+           {
+              stratum_switched();
+              break;
+           }
            pthread_mutex_lock( &g_work_lock );
            g_work_time = 0;
            pthread_mutex_unlock( &g_work_lock );
@@ -2409,8 +2817,11 @@ static void *stratum_thread(void *userdata )
 
            if (jsonrpc_2)
            {
+              pthread_mutex_lock( &g_work_lock );
               work_free(&g_work);
 	      work_copy(&g_work, &stratum.work);
+              work_snap_publish( &g_work, NULL );
+              pthread_mutex_unlock( &g_work_lock );
            }
         }
 
@@ -2419,9 +2830,13 @@ static void *stratum_thread(void *userdata )
         {
            pthread_mutex_lock(&g_work_lock);
            algo_gate.stratum_gen_work( &stratum, &g_work );
+           work_snap_publish( &g_work, &stratum );
            time(&g_work_time);
            pthread_mutex_unlock(&g_work_lock);
+           pool_work_valid();
 //           restart_threads();
+           if ( opt_asic )
+              asic_new_job( stratum.job.clean || jsonrpc_2 );
 
            if (stratum.job.clean || jsonrpc_2)
            {
@@ -2439,6 +2854,7 @@ static void *stratum_thread(void *userdata )
                            algo_names[opt_algo], stratum.bloc_height);
 	         }
               }
+              job_trace_restart( work_snap_seq() );
               restart_threads();
            }
            else if (opt_debug && !opt_quiet)
@@ -2448,22 +2864,27 @@ static void *stratum_thread(void *userdata )
            }
         }  // stratum.job.job_id
 
-       if ( !stratum_socket_full( &stratum, opt_timeout ) )
+       switch ( pool_wait( &stratum, opt_timeout ) )
        {
-          applog(LOG_ERR, "Stratum connection timeout");
-	  s = NULL;
+          case POOL_LINE:
+             s = stratum_recv_line(&stratum);
+             break;
+          case POOL_SWITCHED:
+             stratum_switched();
+             continue;
+          default:
+             s = NULL;
        }
-       else
-           s = stratum_recv_line(&stratum);
        if ( !s )
        {
           stratum_disconnect(&stratum);
 //	  applog(LOG_WARNING, "Stratum connection interrupted");
 	  continue;
        }
+       if ( pool_line( s ) )
+          continue;
        if (!stratum_handle_method(&stratum, s))
           stratum_handle_response(s);
-       free(s);
    }  // loop
 out:
 	return NULL;
@@ -2876,6 +3297,70 @@ void parse_arg(int key, char *arg )
 	case 1024:
 		opt_randomize = true;
 		break;
+	case 1070: /* --chain */
+		if (drv_add_chain(arg))
+			show_usage_and_exit(1);
+		break;
+	case 1071: /* --asic */
+		opt_asic = true;
+		break;
+	case 1072: /* --asic-verify */
+		v = atoi(arg);
+		if (v < 1 || v > ASIC_MAX_VERIFY)
+			show_usage_and_exit(1);
+		opt_asic_verify = v;
+		break;
+	case 1073: /* --uart-trace */
+		free(opt_uart_trace);
+		opt_uart_trace = strdup(arg);
+		break;
+	case 1074: /* --asic-nonce-rate */
+		d = atof(arg);
+		if (d <= 0.)
+			show_usage_and_exit(1);
+		opt_asic_nonce_rate = d;
+		break;
+	case 1075: /* --cpu-placement */
+		v = topo_policy_parse(arg);
+		if (v < 0)
+			show_usage_and_exit(1);
+		opt_cpu_placement = v;
+		break;
+	case 1076: /* --no-huge-pages */
+		opt_huge_pages = false;
+		break;
+	case 1077: /* --lock-pages */
+		opt_lock_pages = true;
+		break;
+	case 1078: /* --cn-ways */
+		opt_cn_ways_count = 0;
+		for (p = arg; *p && opt_cn_ways_count < 256; p++) {
+			v = strtol(p, &p, 10);
+			if (v < 1 || v > CN_MAX_WAYS || (*p && *p != ','))
+				show_usage_and_exit(1);
+			opt_cn_ways[opt_cn_ways_count++] = v;
+			if (!*p)
+				break;
+		}
+		break;
+	case 1079: /* --submit-window */
+		v = atoi(arg);
+		if (v < 1 || v > SHARE_WINDOW_MAX)
+			show_usage_and_exit(1);
+		opt_submit_window = v;
+		break;
+	case 1080: /* --backup-url */
+		if (!pool_add_backup(arg)) {
+			fprintf(stderr, "invalid or too many backup URLs -- '%s'\n", arg);
+			show_usage_and_exit(1);
+		}
+		break;
+	case 1081: /* --failover-ms */
+		v = atoi(arg);
+		if (v < 10 || v > 600000)
+			show_usage_and_exit(1);
+		opt_failover_ms = v;
+		break;
 	case 'V':
 		show_version_and_exit();
 	case 'h':
@@ -2914,6 +3399,14 @@ void parse_config(json_t *config, char *ref)
 			sprintf(buf, "%f", json_real_value(val));
 			parse_arg(options[i].val, buf);
 		}
+		else if (options[i].has_arg && json_is_array(val)) {
+			size_t idx;
+			json_t *item;
+			json_array_foreach(val, idx, item) {
+				if (json_is_string(item))
+					parse_arg(options[i].val, (char*) json_string_value(item));
+			}
+		}
 		else if (!options[i].has_arg) {
 			if (json_is_true(val))
 				parse_arg(options[i].val, "");
@@ -3160,7 +3653,6 @@ int main(int argc, char *argv[])
 	long flags;
 	int i, err;
 
-    drv_init();
 	pthread_mutex_init(&applog_lock, NULL);
 
 	show_credits();
@@ -3236,12 +3728,20 @@ int main(int argc, char *argv[])
         // All options must be set before starting the gate
         if ( !register_algo_gate( opt_algo, &algo_gate ) )
            exit(1);
+        {
+           char pad[64];
+           // algos with one pad for all threads allocate it here
+           if ( scratch_describe( pad, sizeof pad ) )
+              applog( LOG_INFO, "Shared scratchpad %s", pad );
+        }
 
         if ( !check_cpu_capability() )
            exit(1);
 
 	pthread_mutex_init(&stats_lock, NULL);
 	pthread_mutex_init(&g_work_lock, NULL);
+	if (!work_snap_init(opt_n_threads))
+		return 1;
 	pthread_mutex_init(&rpc2_job_lock, NULL);
 	pthread_mutex_init(&rpc2_login_lock, NULL);
 	pthread_mutex_init(&stratum.sock_lock, NULL);
@@ -3310,6 +3810,21 @@ int main(int argc, char *argv[])
    if ( num_cpus != opt_n_threads )
      applog( LOG_INFO,"%u CPU cores available, %u miner threads selected.",
              num_cpus, opt_n_threads );
+   if ( opt_cpu_placement != TOPO_NONE )
+   {
+      if ( topo_init( opt_cpu_placement ) )
+      {
+         char topo[80];
+         topo_describe( topo, sizeof topo );
+         applog( LOG_INFO, "CPU placement %s: %s",
+                 topo_policy_name( opt_cpu_placement ), topo );
+      }
+      else
+      {
+         applog( LOG_WARNING, "CPU topology unavailable, using default affinity" );
+         opt_cpu_placement = TOPO_NONE;
+      }
+   }
    if ( opt_affinity != -1 )
    {
       if ( num_cpus > 64 )
@@ -3326,6 +3841,14 @@ int main(int argc, char *argv[])
       }
    }
 
+   if ( opt_asic )
+   {
+      if ( opt_uart_trace && trace_start( opt_uart_trace ) )
+         applog( LOG_WARNING, "UART trace disabled" );
+      if ( drv_init() )
+         return 1;
+   }
+
 #ifdef HAVE_SYSLOG_H
 	if (use_syslog)
 		openlog("ppminer", LOG_PID, LOG_USER);
@@ -3334,15 +3857,14 @@ int main(int argc, char *argv[])
 	work_restart = (struct work_restart*) calloc(opt_n_threads, sizeof(*work_restart));
 	if (!work_restart)
 		return 1;
-	thr_info = (struct thr_info*) calloc(opt_n_threads + 4, sizeof(*thr));
+	thr_info = (struct thr_info*) calloc(opt_n_threads + 5, sizeof(*thr));
 	if (!thr_info)
 		return 1;
-	thr_hashrates = (double *) calloc(opt_n_threads, sizeof(double));
-	if (!thr_hashrates)
+	thr_stats = (struct thr_stats *)
+	            _mm_malloc(opt_n_threads * sizeof(*thr_stats), 64);
+	if (!thr_stats)
 		return 1;
-        thr_hashcount = (double *) calloc(opt_n_threads, sizeof(double));
-        if (!thr_hashcount)
-                return 1;
+	memset(thr_stats, 0, opt_n_threads * sizeof(*thr_stats));
 
 	/* init workio thread info */
 	work_thr_id = opt_n_threads;
@@ -3351,6 +3873,8 @@ int main(int argc, char *argv[])
 	thr->q = tq_new();
 	if (!thr->q)
 		return 1;
+	/* one get_work and a few shares in flight per miner thread */
+	workio_cmd_prealloc(opt_n_threads * 4 + 4);
 
        if ( rpc_pass && rpc_user )
           opt_stratum_stats = ( strstr( rpc_pass, "stats" ) != NULL )
@@ -3397,7 +3921,26 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 		if (have_stratum)
+		{
 			tq_push(thr_info[stratum_thr_id].q, strdup(rpc_url));
+			pool_start();
+		}
+	}
+
+	if (opt_asic)
+	{
+		/* asic scheduler thread */
+		asic_thr_id = opt_n_threads + 4;
+		thr = &thr_info[asic_thr_id];
+		thr->id = asic_thr_id;
+		thr->q = tq_new();
+		if (!thr->q)
+			return 1;
+		err = thread_create(thr, asic_thread);
+		if (err) {
+			applog(LOG_ERR, "asic thread create failed");
+			return 1;
+		}
 	}
 
 	if (opt_api_listen)
@@ -0,0 +1,216 @@
+/*
+ * Scratchpad allocator for the memory-hard algos, see scratch.h.
+ *
+ * Pads are few and live as long as their thread, so every pad is kept in
+ * a list under a mutex with what scratch_free needs to give it back: the
+ * mapping it was carved from and how it was backed.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <mm_malloc.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "miner.h"
+#include "scratch.h"
+
+#define SCRATCH_2M  ( (size_t)2 << 20 )
+#define SCRATCH_1G  ( (size_t)1 << 30 )
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB    ( 21 << MAP_HUGE_SHIFT )
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB    ( 30 << MAP_HUGE_SHIFT )
+#endif
+
+struct scratch_pad
+{
+   void   *ptr;
+   void   *map;      // mapping to unmap, NULL for heap pads
+   size_t  map_len;
+   struct scratch_pad *next;
+};
+
+static struct scratch_pad *scratch_pads = NULL;
+static pthread_mutex_t scratch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The calling thread's largest pad.
+static __thread size_t scratch_size = 0;
+static __thread int    scratch_backing = SCRATCH_HEAP;
+static __thread bool   scratch_locked = false;
+
+static const char *backing_names[] =
+{
+   [SCRATCH_HEAP]    = "heap pages",
+   [SCRATCH_THP]     = "transparent huge pages",
+   [SCRATCH_HUGE_2M] = "2M pages",
+   [SCRATCH_HUGE_1G] = "1G pages",
+};
+
+#ifdef __linux__
+
+static void *map_anon( size_t len, int flags )
+{
+   void *p = mmap( NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0 );
+   return p == MAP_FAILED ? NULL : p;
+}
+
+static size_t round_up( size_t size, size_t page )
+{
+   return ( size + page - 1 ) & ~( page - 1 );
+}
+
+// Huge page backed mapping for size, NULL and the heap if there is none.
+static void *map_huge( size_t size, void **map, size_t *map_len, int *backing )
+{
+   static bool warned = false;
+   uint8_t *p;
+   size_t len;
+
+   if ( size >= SCRATCH_1G )
+   {
+      len = round_up( size, SCRATCH_1G );
+      if ( ( p = map_anon( len, MAP_HUGETLB | MAP_HUGE_1GB ) ) )
+      {
+         *backing = SCRATCH_HUGE_1G;
+         *map = p;  *map_len = len;
+         return p;
+      }
+   }
+
+   len = round_up( size, SCRATCH_2M );
+   if ( ( p = map_anon( len, MAP_HUGETLB | MAP_HUGE_2MB ) ) )
+   {
+      *backing = SCRATCH_HUGE_2M;
+      *map = p;  *map_len = len;
+      return p;
+   }
+   if ( !warned )
+   {
+      warned = true;
+      applog( LOG_WARNING, "No free huge pages for a %.1f MiB scratchpad, "
+              "see vm.nr_hugepages", size / 1048576. );
+   }
+
+   // THP only collapses 2M aligned ranges, map an extra 2M and trim
+   if ( ( p = map_anon( len + SCRATCH_2M, 0 ) ) )
+   {
+      uint8_t *a = (uint8_t*)round_up( (size_t)p, SCRATCH_2M );
+
+      if ( a > p )
+         munmap( p, a - p );
+      if ( a + len < p + len + SCRATCH_2M )
+         munmap( a + len, ( p + len + SCRATCH_2M ) - ( a + len ) );
+      *backing = madvise( a, len, MADV_HUGEPAGE ) ? SCRATCH_HEAP
+                                                  : SCRATCH_THP;
+      *map = a;  *map_len = len;
+      return a;
+   }
+   return NULL;
+}
+
+#endif
+
+void *scratch_alloc( size_t size )
+{
+   struct scratch_pad *pad = (struct scratch_pad*) calloc( 1, sizeof *pad );
+   int backing = SCRATCH_HEAP;
+   bool locked = false;
+
+   if ( !pad )
+      return NULL;
+
+#ifdef __linux__
+   if ( opt_huge_pages && size >= SCRATCH_2M )
+      pad->ptr = map_huge( size, &pad->map, &pad->map_len, &backing );
+#endif
+   if ( !pad->ptr && !( pad->ptr = _mm_malloc( size, 64 ) ) )
+   {
+      free( pad );
+      return NULL;
+   }
+
+#ifdef __linux__
+   if ( opt_lock_pages )
+   {
+      static bool warned = false;
+
+      locked = !mlock( pad->ptr, size );
+      if ( !locked && !warned )
+      {
+         warned = true;
+         applog( LOG_WARNING, "Failed to lock scratchpad in memory, "
+                 "check ulimit -l" );
+      }
+   }
+#endif
+
+   pthread_mutex_lock( &scratch_lock );
+   pad->next = scratch_pads;
+   scratch_pads = pad;
+   pthread_mutex_unlock( &scratch_lock );
+
+   if ( size > scratch_size )
+   {
+      scratch_size = size;
+      scratch_backing = backing;
+      scratch_locked = locked;
+   }
+   return pad->ptr;
+}
+
+void scratch_free( void *ptr )
+{
+   struct scratch_pad **pp, *pad = NULL;
+
+   if ( !ptr )
+      return;
+
+   pthread_mutex_lock( &scratch_lock );
+   for ( pp = &scratch_pads; *pp; pp = &(*pp)->next )
+      if ( (*pp)->ptr == ptr )
+      {
+         pad = *pp;
+         *pp = pad->next;
+         break;
+      }
+   pthread_mutex_unlock( &scratch_lock );
+   if ( !pad )
+      return;
+
+#ifdef __linux__
+   if ( pad->map )
+      munmap( pad->map, pad->map_len );
+   else
+#endif
+      _mm_free( pad->ptr );
+   free( pad );
+}
+
+size_t scratch_describe( char *buf, int size )
+{
+   if ( !buf )
+      return scratch_size;
+   if ( !scratch_size )
+   {
+      buf[0] = '\0';
+      return 0;
+   }
+   snprintf( buf, size, "%.2f MiB on %s%s", scratch_size / 1048576.,
+             backing_names[ scratch_backing ],
+             scratch_locked ? ", locked" : "" );
+   return scratch_size;
+}
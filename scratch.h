@@ -0,0 +1,40 @@
+#ifndef SCRATCH_H__
+#define SCRATCH_H__
+
+#include <stddef.h>
+
+// Scratchpads of the memory-hard algos.
+//
+// Their inner loops touch the whole pad at random, so with 4 KiB pages
+// nearly every access is a TLB miss. scratch_alloc backs a pad with the
+// largest pages it can get, in this order:
+//
+//   1G    explicit hugetlb pages, pads of 1 GiB or more
+//   2M    explicit hugetlb pages, pads of 2 MiB or more
+//   THP   2 MiB aligned anonymous memory marked MADV_HUGEPAGE
+//   heap  _mm_malloc, also for anything smaller than 2 MiB
+//
+// Explicit huge pages must be reserved beforehand, vm.nr_hugepages or the
+// hugepages= boot option. --no-huge-pages goes straight to the heap and
+// --lock-pages mlocks every pad so it can never be swapped out.
+//
+// Pads are at least 64 byte aligned. Each thread remembers the backing of
+// its largest pad for scratch_describe.
+
+enum scratch_backing
+{
+   SCRATCH_HEAP,
+   SCRATCH_THP,
+   SCRATCH_HUGE_2M,
+   SCRATCH_HUGE_1G
+};
+
+void *scratch_alloc( size_t size );
+void  scratch_free( void *ptr );
+
+// The calling thread's largest pad, like "8.06 MiB on 2M pages, locked".
+// Returns its size, 0 and an empty string if the thread has none. buf
+// may be NULL for just the size.
+size_t scratch_describe( char *buf, int size );
+
+#endif
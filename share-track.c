@@ -0,0 +1,257 @@
+/*
+ * Stratum shares in flight, see share-track.h.
+ *
+ * Shares sit in a table of SHARE_WINDOW_MAX slots indexed by request id,
+ * so an answer finds its share with one lookup however the pool orders
+ * them. Ids only grow, and a slot still taken when its id comes round
+ * again holds a share SHARE_WINDOW_MAX submits old, lost by then.
+ *
+ * One mutex covers the table and the counters. It is taken once per
+ * share on each side, and the workio thread sleeps on a condition under
+ * it while the window is full.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "miner.h"
+#include "share-track.h"
+
+// Bucket b counts latencies of [2^b, 2^(b+1)) us, the first one also
+// anything shorter and the last anything longer, 8 s and up.
+#define ST_BUCKETS  24
+
+struct share_slot
+{
+   bool     used;
+   uint32_t id;
+   double   diff;
+   uint64_t sent_ns;
+};
+
+static pthread_mutex_t st_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  st_room = PTHREAD_COND_INITIALIZER;
+
+static struct share_slot st_slot[ SHARE_WINDOW_MAX ];
+static uint32_t st_next = SHARE_ID_FIRST;     // id of the next share
+static uint32_t st_oldest = SHARE_ID_FIRST;   // none in flight before it
+static int      st_inflight = 0;
+
+static uint64_t st_submitted = 0;
+static uint64_t st_accepted = 0;
+static uint64_t st_rejected = 0;
+static uint64_t st_lost = 0;
+static uint64_t st_unknown = 0;
+
+static uint64_t st_n = 0;
+static uint64_t st_sum = 0;
+static uint64_t st_max = 0;
+static uint64_t st_bucket[ ST_BUCKETS ];
+
+static uint64_t now_ns()
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int window()
+{
+   int w = opt_submit_window;
+
+   return w < 1 ? 1 : w > SHARE_WINDOW_MAX ? SHARE_WINDOW_MAX : w;
+}
+
+static struct share_slot *slot_of( uint32_t id )
+{
+   return &st_slot[ id % SHARE_WINDOW_MAX ];
+}
+
+static void drop( struct share_slot *s )
+{
+   s->used = false;
+   st_inflight--;
+   pthread_cond_signal( &st_room );
+}
+
+static void lose( struct share_slot *s )
+{
+   if ( opt_debug )
+      applog( LOG_DEBUG, "Share %u got no answer, given up", s->id );
+   st_lost++;
+   drop( s );
+}
+
+// Oldest share in flight, NULL if none.
+static struct share_slot *oldest()
+{
+   for ( ; st_oldest != st_next; st_oldest++ )
+   {
+      struct share_slot *s = slot_of( st_oldest );
+
+      if ( s->used && s->id == st_oldest )
+         return s;
+   }
+   return NULL;
+}
+
+bool share_track_full()
+{
+   bool full;
+
+   pthread_mutex_lock( &st_lock );
+   full = st_inflight >= window();
+   pthread_mutex_unlock( &st_lock );
+   return full;
+}
+
+uint32_t share_track_begin( double diff )
+{
+   struct share_slot *s;
+   uint32_t id;
+
+   pthread_mutex_lock( &st_lock );
+   while ( st_inflight >= window() && ( s = oldest() ) )
+   {
+      uint64_t now = now_ns();
+      uint64_t due = s->sent_ns + SHARE_ACK_TIMEOUT * 1000000000ULL;
+      struct timespec abstime;
+
+      if ( now >= due )
+      {
+         lose( s );
+         continue;
+      }
+      clock_gettime( CLOCK_REALTIME, &abstime );
+      abstime.tv_sec += ( due - now ) / 1000000000ULL;
+      abstime.tv_nsec += ( due - now ) % 1000000000ULL;
+      if ( abstime.tv_nsec >= 1000000000L )
+      {
+         abstime.tv_sec++;
+         abstime.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait( &st_room, &st_lock, &abstime );
+   }
+
+   id = st_next++;
+   if ( st_next < SHARE_ID_FIRST )
+      st_next = SHARE_ID_FIRST;
+   s = slot_of( id );
+   if ( s->used )
+      lose( s );
+   s->used = true;
+   s->id = id;
+   s->diff = diff;
+   s->sent_ns = now_ns();
+   st_inflight++;
+   st_submitted++;
+   pthread_mutex_unlock( &st_lock );
+   return id;
+}
+
+void share_track_cancel( uint32_t id )
+{
+   struct share_slot *s = slot_of( id );
+
+   pthread_mutex_lock( &st_lock );
+   if ( s->used && s->id == id )
+   {
+      st_submitted--;
+      drop( s );
+   }
+   pthread_mutex_unlock( &st_lock );
+}
+
+bool share_track_ack( uint32_t id, bool accepted, double *diff )
+{
+   struct share_slot *s = slot_of( id );
+   uint64_t us;
+   int b;
+
+   pthread_mutex_lock( &st_lock );
+   if ( !s->used || s->id != id )
+   {
+      st_unknown++;
+      pthread_mutex_unlock( &st_lock );
+      return false;
+   }
+   us = ( now_ns() - s->sent_ns ) / 1000;
+   b = 63 - __builtin_clzll( us | 1 );
+   if ( b >= ST_BUCKETS )
+      b = ST_BUCKETS - 1;
+   st_bucket[b]++;
+   st_sum += us;
+   if ( us > st_max )
+      st_max = us;
+   st_n++;
+   accepted ? st_accepted++ : st_rejected++;
+   *diff = s->diff;
+   drop( s );
+   pthread_mutex_unlock( &st_lock );
+
+   if ( opt_debug )
+      applog( LOG_DEBUG, "Share %u answered in %.1f ms", id, us / 1e3 );
+   return true;
+}
+
+void share_track_flush()
+{
+   pthread_mutex_lock( &st_lock );
+   for ( struct share_slot *s; ( s = oldest() ); )
+      lose( s );
+   pthread_cond_broadcast( &st_room );
+   pthread_mutex_unlock( &st_lock );
+}
+
+// Upper bound of the bucket holding the p-th fraction, at most the max.
+static uint64_t lat_pct( double p )
+{
+   uint64_t want = (uint64_t)( st_n * p + 0.5 ), seen = 0;
+
+   if ( want < 1 )
+      want = 1;
+   for ( int b = 0; b < ST_BUCKETS; b++ )
+   {
+      seen += st_bucket[b];
+      if ( seen >= want )
+      {
+         uint64_t top = b == ST_BUCKETS - 1 ? st_max : 2ULL << b;
+         return top < st_max ? top : st_max;
+      }
+   }
+   return st_max;
+}
+
+int share_track_report( char *buf, int size )
+{
+   char *p = buf, *end = buf + size;
+
+   pthread_mutex_lock( &st_lock );
+   p += snprintf( p, end - p, "SUBMITTED=%" PRIu64 ";ACCEPTED=%" PRIu64
+                  ";REJECTED=%" PRIu64 ";LOST=%" PRIu64 ";UNKNOWN=%" PRIu64
+                  ";INFLIGHT=%d;WINDOW=%d|", st_submitted, st_accepted,
+                  st_rejected, st_lost, st_unknown, st_inflight, window() );
+   if ( st_n && p < end )
+   {
+      p += snprintf( p, end - p, "N=%" PRIu64 ";AVG=%" PRIu64 ";P50=%" PRIu64
+                     ";P99=%" PRIu64 ";MAX=%" PRIu64 ";H=", st_n,
+                     st_sum / st_n, lat_pct( 0.5 ), lat_pct( 0.99 ), st_max );
+      for ( int b = 0; b < ST_BUCKETS && p < end; b++ )
+         p += snprintf( p, end - p, b ? ",%" PRIu64 : "%" PRIu64,
+                        st_bucket[b] );
+      if ( p < end )
+         p += snprintf( p, end - p, "|" );
+   }
+   pthread_mutex_unlock( &st_lock );
+   if ( p > end )
+      p = end;
+   return (int)( p - buf );
+}
@@ -0,0 +1,49 @@
+#ifndef SHARE_TRACK_H__
+#define SHARE_TRACK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Stratum shares in flight.
+//
+// Every mining.submit gets its own request id, from SHARE_ID_FIRST on,
+// the ids below are subscribe, authorize and extranonce.subscribe. The
+// workio thread sends shares without waiting for their answers, up to
+// --submit-window of them in flight, and the stratum thread matches each
+// answer to its share by id, in whatever order the pool answers.
+//
+// A share the pool has not answered in SHARE_ACK_TIMEOUT seconds while
+// the window is full is given up as lost, and so is everything in
+// flight when the connection drops.
+//
+// Submit to answer latencies go to a log2 histogram of microseconds, see
+// the "shares" API command.
+
+#define SHARE_ID_FIRST      4
+#define SHARE_WINDOW_MAX    256
+#define SHARE_ACK_TIMEOUT   30
+
+extern int opt_submit_window;
+
+// No room for another share, the next share_track_begin would wait.
+bool share_track_full();
+
+// Id for a share of difficulty diff about to be sent, waits while the
+// window is full. workio thread.
+uint32_t share_track_begin( double diff );
+
+// The share could not be sent after all.
+void share_track_cancel( uint32_t id );
+
+// Answer to request id, false if it is not a share in flight. The diff
+// of the share if it is.
+bool share_track_ack( uint32_t id, bool accepted, double *diff );
+
+// Connection lost, nothing in flight will be answered.
+void share_track_flush();
+
+// "SUBMITTED=;ACCEPTED=;REJECTED=;LOST=;UNKNOWN=;INFLIGHT=;WINDOW=|" and
+// "N=;AVG=;P50=;P99=;MAX=;H=b0,b1,..|" of the latencies in microseconds.
+int share_track_report( char *buf, int size );
+
+#endif
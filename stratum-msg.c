@@ -0,0 +1,259 @@
+/*
+ * Single pass stratum message decoder, see stratum-msg.h.
+ *
+ * The scanner only records where each member starts and how long it is,
+ * it never copies or unescapes, which is why it gives up on escapes: a
+ * view of an escaped string would not be its value.
+ *
+ * hex_decode does 32 digits per step with SSE2 where there is SSE2. The
+ * digits are checked and turned into nibbles with byte compares and
+ * masks, and the nibble pairs merged in 16 bit lanes and packed.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "stratum-msg.h"
+
+static const char *skip_ws( const char *s )
+{
+   while ( *s == ' ' || *s == '\t' || *s == '\r' || *s == '\n' )
+      s++;
+   return s;
+}
+
+// s is on the opening quote, returns what follows the closing one.
+static const char *scan_string( const char *s, struct stratum_tok *t )
+{
+   const char *e = strpbrk( ++s, "\"\\" );
+
+   if ( !e || *e != '"' )
+      return NULL;
+   t->p = s;
+   t->len = (int)( e - s );
+   t->type = STOK_STRING;
+   return e + 1;
+}
+
+static const char *scan_literal( const char *s, struct stratum_tok *t,
+                                 const char *lit, int type )
+{
+   int len = (int)strlen( lit );
+
+   if ( strncmp( s, lit, len ) )
+      return NULL;
+   t->p = s;
+   t->len = len;
+   t->type = type;
+   return s + len;
+}
+
+static const char *scan_scalar( const char *s, struct stratum_tok *t )
+{
+   const char *e = s;
+
+   switch ( *s )
+   {
+      case '"': return scan_string( s, t );
+      case 't': return scan_literal( s, t, "true", STOK_TRUE );
+      case 'f': return scan_literal( s, t, "false", STOK_FALSE );
+      case 'n': return scan_literal( s, t, "null", STOK_NULL );
+   }
+   while ( ( *e >= '0' && *e <= '9' ) || *e == '-' || *e == '+'
+           || *e == '.' || *e == 'e' || *e == 'E' )
+      e++;
+   if ( e == s )
+      return NULL;
+   t->p = s;
+   t->len = (int)( e - s );
+   t->type = STOK_NUMBER;
+   return e;
+}
+
+// s is on the '[' of the branch array.
+static const char *scan_branches( const char *s, struct stratum_msg *m )
+{
+   s = skip_ws( s + 1 );
+   if ( *s == ']' )
+      return s + 1;
+   while ( 1 )
+   {
+      if ( m->nbranches == STRATUM_MSG_BRANCHES || *s != '"' )
+         return NULL;
+      if ( !( s = scan_string( s, &m->branch[ m->nbranches++ ] ) ) )
+         return NULL;
+      s = skip_ws( s );
+      if ( *s == ']' )
+         return s + 1;
+      if ( *s != ',' )
+         return NULL;
+      s = skip_ws( s + 1 );
+   }
+}
+
+// s is on the '[' of params.
+static const char *scan_params( const char *s, struct stratum_msg *m )
+{
+   bool nested = false;
+
+   s = skip_ws( s + 1 );
+   if ( *s == ']' )
+      return s + 1;
+   while ( 1 )
+   {
+      struct stratum_tok *t;
+
+      if ( m->nparams == STRATUM_MSG_PARAMS )
+         return NULL;
+      t = &m->params[ m->nparams++ ];
+      if ( *s == '[' )
+      {
+         if ( nested )
+            return NULL;
+         nested = true;
+         t->p = s;
+         t->type = STOK_ARRAY;
+         if ( !( s = scan_branches( s, m ) ) )
+            return NULL;
+         t->len = (int)( s - t->p );
+      }
+      else if ( !( s = scan_scalar( s, t ) ) )
+         return NULL;
+      s = skip_ws( s );
+      if ( *s == ']' )
+         return s + 1;
+      if ( *s != ',' )
+         return NULL;
+      s = skip_ws( s + 1 );
+   }
+}
+
+static bool key_is( const struct stratum_tok *key, const char *name )
+{
+   return key->len == (int)strlen( name ) && !memcmp( key->p, name, key->len );
+}
+
+bool stratum_msg_parse( struct stratum_msg *m, const char *s )
+{
+   m->id.type = m->method.type = m->result.type = m->error.type = STOK_NONE;
+   m->nparams = m->nbranches = 0;
+
+   s = skip_ws( s );
+   if ( *s != '{' )
+      return false;
+   s = skip_ws( s + 1 );
+   while ( 1 )
+   {
+      struct stratum_tok key, other;
+
+      if ( *s != '"' || !( s = scan_string( s, &key ) ) )
+         return false;
+      s = skip_ws( s );
+      if ( *s != ':' )
+         return false;
+      s = skip_ws( s + 1 );
+
+      if ( key_is( &key, "params" ) )
+         s = *s == '[' && !m->nparams ? scan_params( s, m ) : NULL;
+      else if ( key_is( &key, "id" ) )
+         s = scan_scalar( s, &m->id );
+      else if ( key_is( &key, "method" ) )
+         s = scan_scalar( s, &m->method );
+      else if ( key_is( &key, "result" ) )
+         s = scan_scalar( s, &m->result );
+      else if ( key_is( &key, "error" ) )
+         s = scan_scalar( s, &m->error );
+      else
+         s = scan_scalar( s, &other );
+      if ( !s )
+         return false;
+
+      s = skip_ws( s );
+      if ( *s == '}' )
+         return !*skip_ws( s + 1 );
+      if ( *s != ',' )
+         return false;
+      s = skip_ws( s + 1 );
+   }
+}
+
+bool stratum_tok_is( const struct stratum_tok *t, const char *s )
+{
+   return t->type == STOK_STRING && t->len == (int)strlen( s )
+          && !strncasecmp( t->p, s, t->len );
+}
+
+static const int8_t hex_val[256] =
+{
+   [0 ... 255] = -1,
+   ['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+   ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+   ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+   ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+#ifdef __SSE2__
+
+// 16 digits to 16 nibbles, false if any is not a digit.
+static inline bool hex_nibbles( __m128i c, __m128i *v )
+{
+   // setting 0x20 lowercases the letters and leaves the digits alone
+   const __m128i lc  = _mm_or_si128( c, _mm_set1_epi8( 0x20 ) );
+   const __m128i dig = _mm_and_si128(
+                          _mm_cmpgt_epi8( c, _mm_set1_epi8( '0' - 1 ) ),
+                          _mm_cmplt_epi8( c, _mm_set1_epi8( '9' + 1 ) ) );
+   const __m128i let = _mm_and_si128(
+                          _mm_cmpgt_epi8( lc, _mm_set1_epi8( 'a' - 1 ) ),
+                          _mm_cmplt_epi8( lc, _mm_set1_epi8( 'f' + 1 ) ) );
+
+   if ( _mm_movemask_epi8( _mm_or_si128( dig, let ) ) != 0xffff )
+      return false;
+   *v = _mm_or_si128(
+           _mm_and_si128( dig, _mm_sub_epi8( c, _mm_set1_epi8( '0' ) ) ),
+           _mm_and_si128( let, _mm_sub_epi8( lc, _mm_set1_epi8( 'a' - 10 ) ) ) );
+   return true;
+}
+
+// Nibble pairs, high first, to bytes in the low half of 16 bit lanes.
+static inline __m128i hex_merge( __m128i v )
+{
+   return _mm_or_si128(
+             _mm_slli_epi16( _mm_and_si128( v, _mm_set1_epi16( 0xff ) ), 4 ),
+             _mm_srli_epi16( v, 8 ) );
+}
+
+#endif
+
+bool hex_decode( unsigned char *out, const char *hex, size_t len )
+{
+#ifdef __SSE2__
+   for ( ; len >= 16; len -= 16, hex += 32, out += 16 )
+   {
+      __m128i lo, hi;
+
+      if ( !hex_nibbles( _mm_loadu_si128( (const __m128i*)hex ), &lo )
+        || !hex_nibbles( _mm_loadu_si128( (const __m128i*)( hex + 16 ) ),
+                         &hi ) )
+         return false;
+      _mm_storeu_si128( (__m128i*)out,
+                        _mm_packus_epi16( hex_merge( lo ), hex_merge( hi ) ) );
+   }
+#endif
+   for ( ; len; len--, hex += 2, out++ )
+   {
+      int h = hex_val[ (uint8_t)hex[0] ], l = hex_val[ (uint8_t)hex[1] ];
+
+      if ( ( h | l ) < 0 )
+         return false;
+      *out = (unsigned char)( ( h << 4 ) | l );
+   }
+   return true;
+}
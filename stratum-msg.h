@@ -0,0 +1,61 @@
+#ifndef STRATUM_MSG_H__
+#define STRATUM_MSG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Single pass decoder for the common stratum messages.
+//
+// Nearly every line a pool sends is a mining.notify, a set_difficulty or
+// the answer to a share. stratum_msg_parse splits such a line into views
+// of its members in one pass, with no allocation and no jansson tree, and
+// the callers decode the hex straight into the job. Anything it does not
+// expect, a string with an escape, an object nested anywhere, a params
+// array nested deeper than the merkle branches, too many elements, makes
+// it give up, and the caller falls back to jansson as before.
+
+#define STRATUM_MSG_PARAMS    16
+#define STRATUM_MSG_BRANCHES  64
+
+enum stratum_tok_type
+{
+   STOK_NONE,       // member not present
+   STOK_STRING,     // p and len are the contents, without the quotes
+   STOK_NUMBER,
+   STOK_TRUE,
+   STOK_FALSE,
+   STOK_NULL,
+   STOK_ARRAY       // of strings, the branches of the message
+};
+
+struct stratum_tok
+{
+   const char *p;
+   int len;
+   int type;
+};
+
+struct stratum_msg
+{
+   struct stratum_tok id;
+   struct stratum_tok method;
+   struct stratum_tok result;
+   struct stratum_tok error;
+   int nparams;
+   struct stratum_tok params[ STRATUM_MSG_PARAMS ];
+   // the one params element that is an array, merkle branches
+   int nbranches;
+   struct stratum_tok branch[ STRATUM_MSG_BRANCHES ];
+};
+
+// false if s needs the jansson path.
+bool stratum_msg_parse( struct stratum_msg *m, const char *s );
+
+// A member is a given string, case insensitive like the method names.
+bool stratum_tok_is( const struct stratum_tok *t, const char *s );
+
+// Decode exactly 2*len hex digits, either case. False on anything that
+// is not a hex digit, out is undefined then.
+bool hex_decode( unsigned char *out, const char *hex, size_t len );
+
+#endif
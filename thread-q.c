@@ -0,0 +1,274 @@
+/*
+ * Thread queues, tq_new/tq_push/tq_pop.
+ *
+ * A bounded ring of TQ_SIZE slots, each with a sequence number, so push
+ * and pop are one compare and swap on the head or tail and a store to
+ * the slot, no lock and no allocation per entry. Producers are any
+ * number of threads, and so are consumers: the ASIC verify threads
+ * share one queue.
+ *
+ * A pop that finds the queue empty counts itself sleeping and waits on a
+ * futex, pushes only bump the futex and wake one sleeper while there are
+ * any, so a push to a busy consumer makes no system call and no shared
+ * write besides the slot, and one entry wakes one of several consumers.
+ * Freezing and thawing wake them all. Like the old mutex and condvar
+ * queue, a pop that was woken or timed out without an entry returns NULL
+ * and a push to a frozen queue fails.
+ *
+ * Unlike the old list the queue can fill up, and a push to a full queue
+ * fails the same way rather than wait: a miner thread submitting a share
+ * or the ASIC scheduler queueing nonces must not stall behind a slow
+ * workio or verify thread, and the scheduler waiting on the verifiers
+ * while they wait on it to drain their answers would never end. Callers
+ * already free what a failed push did not queue, tq_frozen tells the two
+ * failures apart. TQ_SIZE entries behind means the consumer is not
+ * keeping up anyway.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "miner.h"
+
+// Slots per queue, power of 2. A push to a full queue fails.
+#define TQ_SIZE  1024
+
+struct tq_slot {
+	uint64_t	seq;
+	void		*data;
+};
+
+// Something threads sleep on until another one signals it. waiters
+// counts the sleepers, threads between tq_sleep and tq_unsleep, in its
+// high half and the wakes still owed to them in its low half, so a
+// sleeper is woken once however many pushes come before it runs.
+struct tq_event {
+	uint32_t	seq;		// bumped on wake, the futex word
+	uint64_t	waiters;
+} __attribute__ ((aligned (64)));
+
+#define TQ_SLEEPERS(w)	((uint32_t)((w) >> 32))
+#define TQ_WOKEN(w)	((uint32_t)(w))
+
+struct thread_q {
+	uint64_t	head __attribute__ ((aligned (64)));	// next push
+	uint64_t	tail __attribute__ ((aligned (64)));	// next pop
+	struct tq_event	not_empty;
+	bool		frozen;
+#ifndef __linux__
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+#endif
+	struct tq_slot	slot[TQ_SIZE];
+};
+
+// Wake up to n threads sleeping on e that were not woken yet.
+static void tq_wake(struct thread_q *tq, struct tq_event *e, int n)
+{
+	uint64_t w, nw;
+	uint32_t more;
+
+	/* the slot change is visible before waiters is read, tq_sleep
+	 * does the reverse */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	w = __atomic_load_n(&e->waiters, __ATOMIC_RELAXED);
+	do {
+		more = TQ_SLEEPERS(w) - TQ_WOKEN(w);
+		if (!more)
+			return;
+		if (more > (uint32_t)n)
+			more = n;
+		nw = w + more;
+	} while (!__atomic_compare_exchange_n(&e->waiters, &w, nw, true,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	__atomic_fetch_add(&e->seq, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+	syscall(SYS_futex, &e->seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&tq->mutex);
+	if (n == 1)
+		pthread_cond_signal(&tq->cond);
+	else
+		pthread_cond_broadcast(&tq->cond);
+	pthread_mutex_unlock(&tq->mutex);
+#endif
+}
+
+// Announce a sleep on e, the returned value is for tq_wait once the
+// condition was checked again.
+static uint32_t tq_sleep(struct tq_event *e)
+{
+	__atomic_fetch_add(&e->waiters, 1ULL << 32, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&e->seq, __ATOMIC_SEQ_CST);
+}
+
+// Leave the sleepers, taking one owed wake along if there is one: the
+// wake went either to this thread or to one that will take an entry
+// the same as this one could.
+static void tq_unsleep(struct tq_event *e)
+{
+	uint64_t w = __atomic_load_n(&e->waiters, __ATOMIC_RELAXED), nw;
+
+	do {
+		nw = w - (1ULL << 32) - (TQ_WOKEN(w) ? 1 : 0);
+	} while (!__atomic_compare_exchange_n(&e->waiters, &w, nw, true,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+// Sleep until e was woken since tq_sleep returned seq, abstime is
+// CLOCK_REALTIME.
+static void tq_wait(struct thread_q *tq, struct tq_event *e, uint32_t seq,
+		    const struct timespec *abstime)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &e->seq,
+		FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, seq, abstime,
+		NULL, FUTEX_BITSET_MATCH_ANY);
+#else
+	pthread_mutex_lock(&tq->mutex);
+	if (__atomic_load_n(&e->seq, __ATOMIC_SEQ_CST) == seq) {
+		if (abstime)
+			pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
+		else
+			pthread_cond_wait(&tq->cond, &tq->mutex);
+	}
+	pthread_mutex_unlock(&tq->mutex);
+#endif
+}
+
+// Take the oldest entry, false if empty.
+static bool tq_take(struct thread_q *tq, void **data)
+{
+	uint64_t pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+
+	while (1) {
+		struct tq_slot *s = &tq->slot[pos & (TQ_SIZE - 1)];
+		uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		int64_t dif = (int64_t)(seq - (pos + 1));
+
+		if (dif < 0)
+			return false;
+		if (dif > 0)
+			pos = __atomic_load_n(&tq->tail, __ATOMIC_RELAXED);
+		else if (__atomic_compare_exchange_n(&tq->tail, &pos, pos + 1,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			*data = s->data;
+			__atomic_store_n(&s->seq, pos + TQ_SIZE, __ATOMIC_RELEASE);
+			return true;
+		}
+	}
+}
+
+struct thread_q *tq_new(void)
+{
+	struct thread_q *tq;
+
+	tq = (struct thread_q*) calloc(1, sizeof(*tq));
+	if (!tq)
+		return NULL;
+
+	for (int i = 0; i < TQ_SIZE; i++)
+		tq->slot[i].seq = i;
+#ifndef __linux__
+	pthread_mutex_init(&tq->mutex, NULL);
+	pthread_cond_init(&tq->cond, NULL);
+#endif
+
+	return tq;
+}
+
+void tq_free(struct thread_q *tq)
+{
+	if (!tq)
+		return;
+
+#ifndef __linux__
+	pthread_cond_destroy(&tq->cond);
+	pthread_mutex_destroy(&tq->mutex);
+#endif
+
+	memset(tq, 0, sizeof(*tq));	/* poison */
+	free(tq);
+}
+
+static void tq_freezethaw(struct thread_q *tq, bool frozen)
+{
+	__atomic_store_n(&tq->frozen, frozen, __ATOMIC_SEQ_CST);
+	tq_wake(tq, &tq->not_empty, INT32_MAX);
+}
+
+void tq_freeze(struct thread_q *tq)
+{
+	tq_freezethaw(tq, true);
+}
+
+void tq_thaw(struct thread_q *tq)
+{
+	tq_freezethaw(tq, false);
+}
+
+// Whether a failed push was to a frozen queue rather than a full one.
+bool tq_frozen(struct thread_q *tq)
+{
+	return __atomic_load_n(&tq->frozen, __ATOMIC_ACQUIRE);
+}
+
+bool tq_push(struct thread_q *tq, void *data)
+{
+	uint64_t pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	struct tq_slot *s;
+
+	while (1) {
+		uint64_t seq;
+		int64_t dif;
+
+		if (__atomic_load_n(&tq->frozen, __ATOMIC_ACQUIRE))
+			return false;
+		s = &tq->slot[pos & (TQ_SIZE - 1)];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		dif = (int64_t)(seq - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&tq->head, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* full, the slot still holds the entry of a lap ago */
+			return false;
+		} else
+			pos = __atomic_load_n(&tq->head, __ATOMIC_RELAXED);
+	}
+
+	s->data = data;
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+	tq_wake(tq, &tq->not_empty, 1);
+	return true;
+}
+
+void *tq_pop(struct thread_q *tq, const struct timespec *abstime)
+{
+	void *rval = NULL;
+	uint32_t ev;
+
+	if (tq_take(tq, &rval))
+		return rval;
+
+	ev = tq_sleep(&tq->not_empty);
+	if (!tq_take(tq, &rval)) {
+		tq_wait(tq, &tq->not_empty, ev, abstime);
+		tq_take(tq, &rval);
+	}
+	tq_unsleep(&tq->not_empty);
+	return rval;
+}
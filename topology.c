@@ -0,0 +1,374 @@
+/*
+ * CPU topology and miner thread placement, see topology.h.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+static const char *topo_names[] =
+{
+   [TOPO_NONE]    = "none",
+   [TOPO_COMPACT] = "compact",
+   [TOPO_SCATTER] = "scatter",
+   [TOPO_CORE]    = "core",
+   [TOPO_L3]      = "l3",
+};
+
+int topo_policy_parse( const char *name )
+{
+   for ( int i = 0; i < (int)( sizeof topo_names / sizeof topo_names[0] ); i++ )
+      if ( !strcasecmp( name, topo_names[i] ) )
+         return i;
+   return -1;
+}
+
+const char *topo_policy_name( int policy )
+{
+   return topo_names[ policy ];
+}
+
+#ifdef __linux__
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define TOPO_SYS_CPU   "/sys/devices/system/cpu"
+#define TOPO_SYS_NODE  "/sys/devices/system/node"
+
+struct topo_cpu
+{
+   int cpu;
+   int node;
+   int core;      // index of its physical core, in order of first CPU
+   int l3;        // index of its L3 cache, in order of first CPU
+   int smt_rank;  // position among the core's SMT siblings
+   int core_rank; // position of the core among the cores of its L3
+   int l3_rank;   // position of the L3 among the L3 caches of its node
+};
+
+static struct topo_cpu *topo_cpus = NULL;
+static struct topo_cpu *topo_l3_order = NULL;
+static int topo_ncpus = 0;
+static int topo_nnodes = 0;
+static int topo_node_max = 0;   // highest node id + 1, ids can have gaps
+static int topo_ncores = 0;
+static int topo_nl3 = 0;
+static int topo_policy = TOPO_NONE;
+
+static int read_int( const char *path, int def )
+{
+   FILE *f = fopen( path, "r" );
+   int v;
+
+   if ( !f )
+      return def;
+   if ( fscanf( f, "%d", &v ) != 1 )
+      v = def;
+   fclose( f );
+   return v;
+}
+
+// Parse a kernel cpu list like "0-3,8-11" into set, false if unreadable.
+static bool read_cpulist( const char *path, cpu_set_t *set )
+{
+   FILE *f = fopen( path, "r" );
+   char buf[4096], *p;
+
+   CPU_ZERO( set );
+   if ( !f )
+      return false;
+   p = fgets( buf, sizeof buf, f );
+   fclose( f );
+   if ( !p )
+      return false;
+   while ( *p && *p != '\n' )
+   {
+      char *end;
+      long a = strtol( p, &end, 10 ), b = a;
+
+      if ( end == p )
+         return false;
+      if ( *end == '-' )
+         b = strtol( end + 1, &end, 10 );
+      for ( long i = a; i <= b && i < CPU_SETSIZE; i++ )
+         CPU_SET( i, set );
+      p = *end == ',' ? end + 1 : end;
+   }
+   return true;
+}
+
+static int cmp_compact( const void *a, const void *b )
+{
+   const struct topo_cpu *x = a, *y = b;
+   if ( x->node != y->node ) return x->node - y->node;
+   if ( x->l3 != y->l3 )     return x->l3 - y->l3;
+   if ( x->core != y->core ) return x->core - y->core;
+   return x->cpu - y->cpu;
+}
+
+static int cmp_scatter( const void *a, const void *b )
+{
+   const struct topo_cpu *x = a, *y = b;
+   if ( x->smt_rank != y->smt_rank )   return x->smt_rank - y->smt_rank;
+   if ( x->core_rank != y->core_rank ) return x->core_rank - y->core_rank;
+   if ( x->l3_rank != y->l3_rank )     return x->l3_rank - y->l3_rank;
+   if ( x->node != y->node )           return x->node - y->node;
+   return x->cpu - y->cpu;
+}
+
+static int cmp_core( const void *a, const void *b )
+{
+   const struct topo_cpu *x = a, *y = b;
+   if ( x->smt_rank != y->smt_rank ) return x->smt_rank - y->smt_rank;
+   return cmp_compact( a, b );
+}
+
+// The L3 caches in scatter order, one entry per cache.
+static int cmp_l3( const void *a, const void *b )
+{
+   const struct topo_cpu *x = a, *y = b;
+   if ( x->l3_rank != y->l3_rank ) return x->l3_rank - y->l3_rank;
+   if ( x->node != y->node )       return x->node - y->node;
+   return x->l3 - y->l3;
+}
+
+// Number the distinct values of key over the CPUs in CPU order, cpus
+// with equal key get the same index. ids is scratch of topo_ncpus.
+static int number_groups( int *key, int *index, int *ids )
+{
+   int n = 0;
+
+   for ( int i = 0; i < topo_ncpus; i++ )
+   {
+      int j;
+      for ( j = 0; j < n && ids[j] != key[i]; j++ );
+      if ( j == n )
+         ids[ n++ ] = key[i];
+      index[i] = j;
+   }
+   return n;
+}
+
+bool topo_init( int policy )
+{
+   cpu_set_t online, nodes;
+   int *pkg, *key, *ids, *idx;
+   char path[256];
+
+   if ( !read_cpulist( TOPO_SYS_CPU "/online", &online ) )
+      return false;
+   topo_ncpus = CPU_COUNT( &online );
+   topo_cpus = (struct topo_cpu*) calloc( topo_ncpus, sizeof *topo_cpus );
+   pkg = (int*) calloc( topo_ncpus, sizeof(int) );
+   key = (int*) calloc( topo_ncpus, sizeof(int) );
+   ids = (int*) calloc( topo_ncpus, sizeof(int) );
+   idx = (int*) calloc( topo_ncpus, sizeof(int) );
+   if ( !topo_cpus || !pkg || !key || !ids || !idx )
+      return false;
+
+   for ( int c = 0, i = 0; i < topo_ncpus; c++ )
+   {
+      if ( !CPU_ISSET( c, &online ) )
+         continue;
+      topo_cpus[i].cpu = c;
+      snprintf( path, sizeof path,
+                TOPO_SYS_CPU "/cpu%d/topology/physical_package_id", c );
+      pkg[i] = read_int( path, 0 );
+      i++;
+   }
+
+   // nodes by the online list, their ids need not be contiguous with
+   // nodes offlined or memory only. A box without NUMA has no node
+   // directory and is all node 0.
+   topo_nnodes = topo_node_max = 1;
+   if ( read_cpulist( TOPO_SYS_NODE "/online", &nodes ) )
+   {
+      topo_nnodes = 0;
+      for ( int n = 0; n < CPU_SETSIZE; n++ )
+      {
+         cpu_set_t set;
+
+         if ( !CPU_ISSET( n, &nodes ) )
+            continue;
+         topo_nnodes++;
+         topo_node_max = n + 1;
+         snprintf( path, sizeof path, TOPO_SYS_NODE "/node%d/cpulist", n );
+         if ( !read_cpulist( path, &set ) )
+            continue;
+         for ( int i = 0; i < topo_ncpus; i++ )
+            if ( CPU_ISSET( topo_cpus[i].cpu, &set ) )
+               topo_cpus[i].node = n;
+      }
+      if ( !topo_nnodes )
+         topo_nnodes = 1;
+   }
+
+   // physical cores, core ids are only unique within a package
+   for ( int i = 0; i < topo_ncpus; i++ )
+   {
+      snprintf( path, sizeof path, TOPO_SYS_CPU "/cpu%d/topology/core_id",
+                topo_cpus[i].cpu );
+      key[i] = pkg[i] * 65536 + read_int( path, topo_cpus[i].cpu );
+   }
+   topo_ncores = number_groups( key, idx, ids );
+   for ( int i = 0; i < topo_ncpus; i++ )
+      topo_cpus[i].core = idx[i];
+
+   // L3 caches by their id, else by the first CPU sharing it, else one
+   // per package
+   for ( int i = 0; i < topo_ncpus; i++ )
+   {
+      cpu_set_t set;
+      int id;
+
+      snprintf( path, sizeof path, TOPO_SYS_CPU "/cpu%d/cache/index3/id",
+                topo_cpus[i].cpu );
+      id = read_int( path, -1 );
+      if ( id < 0 )
+      {
+         snprintf( path, sizeof path,
+                   TOPO_SYS_CPU "/cpu%d/cache/index3/shared_cpu_list",
+                   topo_cpus[i].cpu );
+         if ( read_cpulist( path, &set ) )
+            for ( id = 0; id < CPU_SETSIZE && !CPU_ISSET( id, &set ); id++ );
+      }
+      key[i] = pkg[i] * 65536 + ( id < 0 ? 0 : id );
+   }
+   topo_nl3 = number_groups( key, idx, ids );
+   for ( int i = 0; i < topo_ncpus; i++ )
+      topo_cpus[i].l3 = idx[i];
+
+   // ranks within the enclosing level, CPUs are in CPU order so earlier
+   // CPUs of a group were ranked first
+   for ( int i = 0; i < topo_ncpus; i++ )
+   {
+      struct topo_cpu *t = &topo_cpus[i];
+      int cores = 0, l3s = 0;
+
+      for ( int j = 0; j < i; j++ )
+      {
+         struct topo_cpu *u = &topo_cpus[j];
+         if ( u->core == t->core )
+            t->smt_rank++;
+      }
+      // count distinct cores of the same L3 and L3s of the same node that
+      // started before this CPU's own
+      for ( int j = 0; j < topo_ncpus; j++ )
+      {
+         struct topo_cpu *u = &topo_cpus[j];
+         bool first_core = true, first_l3 = true;
+
+         for ( int k = 0; k < j; k++ )
+         {
+            if ( topo_cpus[k].core == u->core ) first_core = false;
+            if ( topo_cpus[k].l3 == u->l3 )     first_l3 = false;
+         }
+         if ( first_core && u->l3 == t->l3 && u->core < t->core )
+            cores++;
+         if ( first_l3 && u->node == t->node && u->l3 < t->l3 )
+            l3s++;
+      }
+      t->core_rank = cores;
+      t->l3_rank = l3s;
+   }
+
+   if ( policy == TOPO_L3 )
+   {
+      // one entry per L3, its first CPU, in scatter order
+      int n = 0;
+
+      topo_l3_order = (struct topo_cpu*) calloc( topo_nl3,
+                                                 sizeof *topo_l3_order );
+      if ( !topo_l3_order )
+         return false;
+      for ( int i = 0; i < topo_ncpus; i++ )
+      {
+         int j;
+         for ( j = 0; j < n && topo_l3_order[j].l3 != topo_cpus[i].l3; j++ );
+         if ( j == n )
+            topo_l3_order[ n++ ] = topo_cpus[i];
+      }
+      qsort( topo_l3_order, n, sizeof *topo_l3_order, cmp_l3 );
+   }
+   else if ( policy == TOPO_COMPACT )
+      qsort( topo_cpus, topo_ncpus, sizeof *topo_cpus, cmp_compact );
+   else if ( policy == TOPO_SCATTER )
+      qsort( topo_cpus, topo_ncpus, sizeof *topo_cpus, cmp_scatter );
+   else if ( policy == TOPO_CORE )
+      qsort( topo_cpus, topo_ncpus, sizeof *topo_cpus, cmp_core );
+   topo_policy = policy;
+
+   free( pkg );
+   free( key );
+   free( ids );
+   free( idx );
+   return true;
+}
+
+bool topo_place_thread( int thr_id )
+{
+   const struct topo_cpu *t;
+   cpu_set_t set;
+
+   if ( !topo_cpus || topo_policy == TOPO_NONE )
+      return false;
+
+   CPU_ZERO( &set );
+   if ( topo_policy == TOPO_L3 )
+   {
+      t = &topo_l3_order[ thr_id % topo_nl3 ];
+      for ( int i = 0; i < topo_ncpus; i++ )
+         if ( topo_cpus[i].l3 == t->l3 )
+            CPU_SET( topo_cpus[i].cpu, &set );
+   }
+   else
+   {
+      t = &topo_cpus[ thr_id % topo_ncpus ];
+      CPU_SET( t->cpu, &set );
+   }
+   if ( pthread_setaffinity_np( pthread_self(), sizeof set, &set ) )
+      return false;
+
+   // prefer the thread's node for the memory it allocates from now on
+   if ( topo_nnodes > 1 )
+   {
+      unsigned long nodes[ CPU_SETSIZE / ( 8 * sizeof(long) ) ] = { 0 };
+
+      nodes[ t->node / ( 8 * sizeof(long) ) ] |=
+                                   1UL << ( t->node % ( 8 * sizeof(long) ) );
+      syscall( SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+               (unsigned long)topo_node_max + 1 );
+   }
+   return true;
+}
+
+void topo_describe( char *buf, int size )
+{
+   snprintf( buf, size, "%d node%s, %d L3, %d cores, %d CPUs",
+             topo_nnodes, topo_nnodes == 1 ? "" : "s", topo_nl3,
+             topo_ncores, topo_ncpus );
+}
+
+#else
+
+bool topo_init( int policy ) { return false; }
+bool topo_place_thread( int thr_id ) { return false; }
+void topo_describe( char *buf, int size ) { snprintf( buf, size, "unknown" ); }
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TOPOLOGY_H__
+#define TOPOLOGY_H__
+
+#include <stdbool.h>
+
+// CPU topology and miner thread placement, Linux only.
+//
+// topo_init reads /sys/devices/system/cpu and /sys/devices/system/node:
+// the NUMA node, package, core and L3 cache of every online CPU. A
+// placement policy then orders the CPUs and miner thread n gets the n-th,
+// wrapping around:
+//
+//   compact  fill all SMT siblings of a core, then the next core of the
+//            same L3 and node
+//   scatter  spread over nodes first, then L3 caches, then cores, SMT
+//            siblings only once every core has a thread
+//   core     one thread per physical core in compact order, SMT siblings
+//            only once every core has one
+//   l3       threads round robin over the L3 caches, each one free to run
+//            on any CPU sharing its cache
+//
+// A thread placed on one node also has its memory policy set to prefer
+// that node, so the scratchpad it allocates and touches is local.
+
+enum topo_policy
+{
+   TOPO_NONE,
+   TOPO_COMPACT,
+   TOPO_SCATTER,
+   TOPO_CORE,
+   TOPO_L3
+};
+
+// Policy for a --cpu-placement name, -1 if unknown.
+int  topo_policy_parse( const char *name );
+const char *topo_policy_name( int policy );
+
+bool topo_init( int policy );
+
+// Bind the calling thread for miner thread thr_id and prefer its node
+// for memory. False if there is no topology.
+bool topo_place_thread( int thr_id );
+
+// One line summary for the log, like "2 nodes, 4 L3, 32 cores, 64 CPUs".
+void topo_describe( char *buf, int size );
+
+#endif
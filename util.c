@@ -44,8 +44,9 @@
 #endif
 
 #include "miner.h"
-#include "elist.h"
 #include "algo-gate-api.h"
+#include "job-trace.h"
+#include "stratum-msg.h"
 
 //extern pthread_mutex_t stats_lock;
 
@@ -66,20 +67,6 @@ struct header_info {
 	char		*stratum_url;
 };
 
-struct tq_ent {
-	void			*data;
-	struct list_head	q_node;
-};
-
-struct thread_q {
-	struct list_head	q;
-
-	bool frozen;
-
-	pthread_mutex_t		mutex;
-	pthread_cond_t		cond;
-};
-
 void applog(int prio, const char *fmt, ...)
 {
 	va_list ap;
@@ -688,6 +675,10 @@ bool hex2bin(unsigned char *p, const char *hexstr, size_t len)
 	char hex_byte[3];
 	char *ep;
 
+	// all the digits there and valid, the usual case
+	if (strnlen(hexstr, len * 2) == len * 2 && hex_decode(p, hexstr, len))
+		return true;
+
 	hex_byte[2] = '\0';
 
 	while (*hexstr && len) {
@@ -1023,47 +1014,40 @@ bool stratum_send_line(struct stratum_ctx *sctx, char *s)
 	return ret;
 }
 
-static bool socket_full(curl_socket_t sock, int timeout)
+static bool socket_full_ms(curl_socket_t sock, int ms)
 {
 	struct timeval tv;
 	fd_set rd;
 
 	FD_ZERO(&rd);
 	FD_SET(sock, &rd);
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
 	if (select((int)(sock + 1), &rd, NULL, NULL, &tv) > 0)
 		return true;
 	return false;
 }
 
-bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
+static bool socket_full(curl_socket_t sock, int timeout)
 {
-	return strlen(sctx->sockbuf) || socket_full(sctx->sock, timeout);
+	return socket_full_ms(sock, timeout * 1000);
 }
 
-#define RBUFSIZE 2048
-#define RECVSIZE (RBUFSIZE - 4)
-
-static void stratum_buffer_append(struct stratum_ctx *sctx, const char *s)
+bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
 {
-	size_t old, n;
+	return line_buf_pending(&sctx->rbuf) || socket_full(sctx->sock, timeout);
+}
 
-	old = strlen(sctx->sockbuf);
-	n = old + strlen(s) + 1;
-	if (n >= sctx->sockbuf_size) {
-		sctx->sockbuf_size = n + (RBUFSIZE - (n % RBUFSIZE));
-		sctx->sockbuf = (char*) realloc(sctx->sockbuf, sctx->sockbuf_size);
-	}
-	strcpy(sctx->sockbuf + old, s);
+bool stratum_socket_full_ms(struct stratum_ctx *sctx, int ms)
+{
+	return line_buf_pending(&sctx->rbuf) || socket_full_ms(sctx->sock, ms);
 }
 
 char *stratum_recv_line(struct stratum_ctx *sctx)
 {
-	ssize_t len, buflen;
-	char *tok, *sret = NULL;
+	char *sret = line_buf_next(&sctx->rbuf, NULL);
 
-	if (!strstr(sctx->sockbuf, "\n")) {
+	if (!sret) {
 		bool ret = true;
 		time_t rstart;
 
@@ -1073,11 +1057,17 @@ char *stratum_recv_line(struct stratum_ctx *sctx)
 			goto out;
 		}
 		do {
-			char s[RBUFSIZE];
+			size_t room;
+			char *p = line_buf_space(&sctx->rbuf, &room);
 			ssize_t n;
 
-			memset(s, 0, RBUFSIZE);
-			n = recv(sctx->sock, s, RECVSIZE, 0);
+			if (!p) {
+				applog(LOG_ERR, "stratum_recv_line: line longer than %d bytes",
+					LINE_BUF_MAX);
+				ret = false;
+				break;
+			}
+			n = recv(sctx->sock, p, room, 0);
 			if (!n) {
 				ret = false;
 				break;
@@ -1087,30 +1077,22 @@ char *stratum_recv_line(struct stratum_ctx *sctx)
 					ret = false;
 					break;
 				}
-			} else
-				stratum_buffer_append(sctx, s);
-		} while (time(NULL) - rstart < 60 && !strstr(sctx->sockbuf, "\n"));
+			} else {
+				line_buf_commit(&sctx->rbuf, n);
+				sret = line_buf_next(&sctx->rbuf, NULL);
+			}
+		} while (!sret && time(NULL) - rstart < 60);
 
 		if (!ret) {
 			applog(LOG_WARNING, "stratum_recv_line failed");
 			goto out;
 		}
+		if (!sret) {
+			applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
+			goto out;
+		}
 	}
 
-	buflen = (ssize_t) strlen(sctx->sockbuf);
-	tok = strtok(sctx->sockbuf, "\n");
-	if (!tok) {
-		applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
-		goto out;
-	}
-	sret = strdup(tok);
-	len = (ssize_t) strlen(sret);
-
-	if (buflen > len + 1)
-		memmove(sctx->sockbuf, sctx->sockbuf + len + 1, buflen - len + 1);
-	else
-		sctx->sockbuf[0] = '\0';
-
 out:
 	if (sret && opt_protocol)
 		applog(LOG_DEBUG, "< %s", sret);
@@ -1142,11 +1124,14 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 		return false;
 	}
 	curl = sctx->curl;
-	if (!sctx->sockbuf) {
-		sctx->sockbuf = (char*) calloc(RBUFSIZE, 1);
-		sctx->sockbuf_size = RBUFSIZE;
+	if (!sctx->rbuf.buf && !line_buf_init(&sctx->rbuf)) {
+		applog(LOG_ERR, "Stratum receive buffer allocation failed");
+		curl_easy_cleanup(sctx->curl);
+		sctx->curl = NULL;
+		pthread_mutex_unlock(&sctx->sock_lock);
+		return false;
 	}
-	sctx->sockbuf[0] = '\0';
+	line_buf_reset(&sctx->rbuf);
 	pthread_mutex_unlock(&sctx->sock_lock);
 	if (url != sctx->url) {
 		free(sctx->url);
@@ -1200,11 +1185,42 @@ void stratum_disconnect(struct stratum_ctx *sctx)
 	if (sctx->curl) {
 		curl_easy_cleanup(sctx->curl);
 		sctx->curl = NULL;
-		sctx->sockbuf[0] = '\0';
+		line_buf_reset(&sctx->rbuf);
 	}
 	pthread_mutex_unlock(&sctx->sock_lock);
 }
 
+#define SWAP(x, y) do { __typeof__(x) t_ = (x); (x) = (y); (y) = t_; } while (0)
+
+/**
+ * Trade connections, subscriptions and jobs, everything but the locks
+ * and which one is the standby.
+ */
+void stratum_swap(struct stratum_ctx *a, struct stratum_ctx *b)
+{
+	pthread_mutex_lock(&a->sock_lock);
+	pthread_mutex_lock(&a->work_lock);
+	pthread_mutex_lock(&b->sock_lock);
+	pthread_mutex_lock(&b->work_lock);
+	SWAP(a->url, b->url);
+	SWAP(a->curl, b->curl);
+	SWAP(a->curl_url, b->curl_url);
+	SWAP(a->sock, b->sock);
+	SWAP(a->rbuf, b->rbuf);
+	SWAP(a->next_diff, b->next_diff);
+	SWAP(a->session_id, b->session_id);
+	SWAP(a->xnonce1_size, b->xnonce1_size);
+	SWAP(a->xnonce1, b->xnonce1);
+	SWAP(a->xnonce2_size, b->xnonce2_size);
+	SWAP(a->job, b->job);
+	SWAP(a->work, b->work);
+	SWAP(a->bloc_height, b->bloc_height);
+	pthread_mutex_unlock(&b->work_lock);
+	pthread_mutex_unlock(&b->sock_lock);
+	pthread_mutex_unlock(&a->work_lock);
+	pthread_mutex_unlock(&a->sock_lock);
+}
+
 static const char *get_stratum_session_id(json_t *val)
 {
 	json_t *arr_val;
@@ -1307,7 +1323,6 @@ start:
 		goto out;
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1391,11 +1406,9 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 			goto out;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1452,7 +1465,6 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 //				applog(LOG_DEBUG, "extranonce subscribe not supported");
 			json_decref(extra);
 		}
-		free(sret);
 	}
 
 out:
@@ -1625,11 +1637,8 @@ bool rpc2_job_decode(const json_t *job, struct work *work)
 		jobj_binary(job, "target", &target, 4);
 		if(rpc2_target != target)
                 {
-   		   double hashrate = 0.0;
-                   pthread_mutex_lock(&stats_lock);
-		   for (int i = 0; i < opt_n_threads; i++)
-		      hashrate += thr_hashrates[i];
-                   pthread_mutex_unlock(&stats_lock);
+   		   double hashcount, hashrate;
+		   thr_stats_total(&hashcount, &hashrate);
 		   double diff = trunc( ( ((double)0xffffffff) / target ) );
 		   if ( opt_showdiff )
 		      // xmr pool diff can change a lot...
@@ -1650,8 +1659,7 @@ bool rpc2_job_decode(const json_t *job, struct work *work)
 		memcpy(work->data, rpc2_blob, rpc2_bloblen);
 		memset(work->target, 0xff, sizeof(work->target));
 		work->target[7] = rpc2_target;
-		if (work->job_id) free(work->job_id);
-		work->job_id = strdup(rpc2_job_id);
+		work_set_job_id(work, rpc2_job_id);
 	}
 	return true;
 
@@ -1690,6 +1698,119 @@ static uint32_t getblocheight(struct stratum_ctx *sctx)
 	return height;
 }
 
+/**
+ * Room for count branches in job->merkle, one block of the pointers and
+ * then the branches, which only grows so a notify rarely allocates.
+ */
+static bool stratum_job_merkle_room(struct stratum_job *job, int count)
+{
+	uchar **merkle;
+
+	if (count <= job->merkle_max)
+		return true;
+	merkle = (uchar**) realloc(job->merkle, count * (sizeof(uchar*) + 32));
+	if (!merkle) {
+		applog(LOG_ERR, "Stratum notify: out of memory for %d branches", count);
+		return false;
+	}
+	for (int i = 0; i < count; i++)
+		merkle[i] = (uchar*) (merkle + count) + i * 32;
+	job->merkle = merkle;
+	job->merkle_max = count;
+	return true;
+}
+
+/**
+ * mining.notify from the views of stratum_msg_parse, hex decoded straight
+ * into the job. -1 if anything is not as expected, stratum_notify has the
+ * error messages for that.
+ */
+static int stratum_notify_msg(struct stratum_ctx *sctx, const struct stratum_msg *m)
+{
+	const struct stratum_tok *t = m->params;
+	const struct stratum_tok *job_id, *prevhash, *claim = NULL;
+	const struct stratum_tok *coinb1, *coinb2, *merkle, *version, *nbits, *stime;
+	bool has_claim = opt_algo == ALGO_LBRY;
+	size_t coinb1_size, coinb2_size;
+	bool clean, ok;
+	int i;
+
+	if (m->nparams < 9 + has_claim)
+		return -1;
+	job_id = t++;
+	prevhash = t++;
+	if (has_claim)
+		claim = t++;
+	coinb1 = t++;
+	coinb2 = t++;
+	merkle = t++;
+	version = t++;
+	nbits = t++;
+	stime = t++;
+	clean = t->type == STOK_TRUE;
+
+	if (job_id->type != STOK_STRING || coinb1->type != STOK_STRING ||
+	    coinb2->type != STOK_STRING || (coinb1->len | coinb2->len) & 1 ||
+	    prevhash->type != STOK_STRING || prevhash->len != 64 ||
+	    (claim && (claim->type != STOK_STRING || claim->len != 64)) ||
+	    merkle->type != STOK_ARRAY ||
+	    version->type != STOK_STRING || version->len != 8 ||
+	    nbits->type != STOK_STRING || nbits->len != 8 ||
+	    stime->type != STOK_STRING || stime->len != 8)
+		return -1;
+	for (i = 0; i < m->nbranches; i++)
+		if (m->branch[i].len != 64)
+			return -1;
+
+	pthread_mutex_lock(&sctx->work_lock);
+
+	coinb1_size = coinb1->len / 2;
+	coinb2_size = coinb2->len / 2;
+	sctx->job.coinbase_size = coinb1_size + sctx->xnonce1_size +
+	                          sctx->xnonce2_size + coinb2_size;
+	sctx->job.coinbase = (uchar*) realloc(sctx->job.coinbase, sctx->job.coinbase_size);
+	sctx->job.xnonce2 = sctx->job.coinbase + coinb1_size + sctx->xnonce1_size;
+	ok = hex_decode(sctx->job.coinbase, coinb1->p, coinb1_size);
+	memcpy(sctx->job.coinbase + coinb1_size, sctx->xnonce1, sctx->xnonce1_size);
+	if (!sctx->job.job_id || strlen(sctx->job.job_id) != (size_t) job_id->len ||
+	    memcmp(sctx->job.job_id, job_id->p, job_id->len)) {
+		memset(sctx->job.xnonce2, 0, sctx->xnonce2_size);
+		free(sctx->job.job_id);
+		sctx->job.job_id = strndup(job_id->p, job_id->len);
+	}
+	ok = hex_decode(sctx->job.xnonce2 + sctx->xnonce2_size, coinb2->p, coinb2_size) && ok;
+	ok = hex_decode(sctx->job.prevhash, prevhash->p, 32) && ok;
+	if (claim)
+		ok = hex_decode(sctx->job.claim, claim->p, 32) && ok;
+
+	sctx->bloc_height = getblocheight(sctx);
+	merkle_reset(&sctx->job.merkle_cache);
+
+	if (stratum_job_merkle_room(&sctx->job, m->nbranches)) {
+		for (i = 0; i < m->nbranches; i++)
+			ok = hex_decode(sctx->job.merkle[i], m->branch[i].p, 32) && ok;
+		sctx->job.merkle_count = m->nbranches;
+	} else
+		sctx->job.merkle_count = 0;
+
+	ok = hex_decode(sctx->job.version, version->p, 4) && ok;
+	ok = hex_decode(sctx->job.nbits, nbits->p, 4) && ok;
+	ok = hex_decode(sctx->job.ntime, stime->p, 4) && ok;
+	sctx->job.clean = clean;
+
+	sctx->job.diff = sctx->next_diff;
+
+	pthread_mutex_unlock(&sctx->work_lock);
+
+	if (!ok) {
+		applog(LOG_ERR, "Stratum notify: invalid hex");
+		return false;
+	}
+	if (clean && !sctx->standby)
+		job_trace_notify();
+	return true;
+}
+
 static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 {
 	const char *job_id, *prevhash, *coinb1, *coinb2, *version, *nbits, *stime;
@@ -1698,7 +1819,6 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 	bool clean, ret = false;
 	int merkle_count, i, p = 0;
 	json_t *merkle_arr;
-	uchar **merkle = NULL;
         bool has_claim = opt_algo == ALGO_LBRY;
 	job_id = json_string_value(json_array_get(params, p++));
 	prevhash = json_string_value(json_array_get(params, p++));
@@ -1729,18 +1849,12 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 		goto out;
 	}
 
-        merkle = (uchar**) malloc(merkle_count * sizeof(char *));
 	for (i = 0; i < merkle_count; i++) {
 		const char *s = json_string_value(json_array_get(merkle_arr, i));
 		if (!s || strlen(s) != 64) {
-			while (i--)
-				free(merkle[i]);
-			free(merkle);
 			applog(LOG_ERR, "Stratum notify: invalid Merkle branch");
 			goto out;
 		}
-		merkle[i] = (uchar*) malloc(32);
-		hex2bin(merkle[i], s, 32);
 	}
 
 	pthread_mutex_lock(&sctx->work_lock);
@@ -1762,12 +1876,13 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
         if (has_claim) hex2bin(sctx->job.claim, claim, 32);
 
 	sctx->bloc_height = getblocheight(sctx);
+	merkle_reset(&sctx->job.merkle_cache);
 
-	for (i = 0; i < sctx->job.merkle_count; i++)
-		free(sctx->job.merkle[i]);
-
-	free(sctx->job.merkle);
-	sctx->job.merkle = merkle;
+	if (!stratum_job_merkle_room(&sctx->job, merkle_count))
+		merkle_count = 0;
+	for (i = 0; i < merkle_count; i++)
+		hex2bin(sctx->job.merkle[i],
+			json_string_value(json_array_get(merkle_arr, i)), 32);
 	sctx->job.merkle_count = merkle_count;
 
 	hex2bin(sctx->job.version, version, 4);
@@ -1779,17 +1894,16 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 
 	pthread_mutex_unlock(&sctx->work_lock);
 
+	if (clean && !sctx->standby)
+		job_trace_notify();
 	ret = true;
 
 out:
 	return ret;
 }
 
-static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
+static bool stratum_set_diff(struct stratum_ctx *sctx, double diff)
 {
-	double diff;
-
-	diff = json_number_value(json_array_get(params, 0));
 	if (diff == 0)
 		return false;
 
@@ -1797,6 +1911,12 @@ static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
 	sctx->next_diff = diff;
 	pthread_mutex_unlock(&sctx->work_lock);
 
+	if (sctx->standby) {
+		if (opt_debug)
+			applog(LOG_DEBUG, "Standby difficulty set to %g", diff);
+		return true;
+	}
+
 	/* store for api stats */
 	stratum_diff = diff;
 
@@ -1805,6 +1925,11 @@ static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
 	return true;
 }
 
+static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
+{
+	return stratum_set_diff(sctx, json_number_value(json_array_get(params, 0)));
+}
+
 static bool stratum_reconnect(struct stratum_ctx *sctx, json_t *params)
 {
 	json_t *port_val;
@@ -1858,6 +1983,7 @@ static bool stratum_benchdata(json_t *result, json_t *params, int thr_id)
 	char os[8];
 	char *p;
 	double cpufreq = 0;
+	double hashcount, hashrate;
 	json_t *val;
 
 	if (!opt_stratum_stats) return false;
@@ -1925,7 +2051,8 @@ static bool stratum_benchdata(json_t *result, json_t *params, int thr_id)
 	json_object_set_new(val, "freq", json_integer((uint64_t)cpufreq));
 	json_object_set_new(val, "memf", json_integer(0));
 	json_object_set_new(val, "power", json_integer(0));
-	json_object_set_new(val, "khashes", json_real((double)global_hashrate / 1000.0));
+	thr_stats_total(&hashcount, &hashrate);
+	json_object_set_new(val, "khashes", json_real(hashrate / 1000.0));
 	json_object_set_new(val, "intensity", json_real(opt_priority));
 	json_object_set_new(val, "throughput", json_integer(opt_n_threads));
 	json_object_set_new(val, "client", json_string(PACKAGE_NAME "/" PACKAGE_VERSION));
@@ -2076,11 +2203,27 @@ static bool stratum_show_message(struct stratum_ctx *sctx, json_t *id, json_t *p
 
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s)
 {
+	struct stratum_msg msg;
 	json_t *val, *id, *params;
 	json_error_t err;
 	const char *method;
 	bool ret = false;
 
+	// the frequent ones without building a jansson tree
+	if (!jsonrpc_2 && stratum_msg_parse(&msg, s)) {
+		int r = -1;
+
+		if (msg.method.type != STOK_STRING)
+			return false;
+		if (stratum_tok_is(&msg.method, "mining.notify"))
+			r = stratum_notify_msg(sctx, &msg);
+		else if (stratum_tok_is(&msg.method, "mining.set_difficulty") &&
+			 msg.nparams && msg.params[0].type == STOK_NUMBER)
+			r = stratum_set_diff(sctx, strtod(msg.params[0].p, NULL));
+		if (r >= 0)
+			return r;
+	}
+
 	val = JSON_LOADS(s, &err);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
@@ -2155,119 +2298,6 @@ out:
 	return ret;
 }
 
-struct thread_q *tq_new(void)
-{
-	struct thread_q *tq;
-
-	tq = (struct thread_q*) calloc(1, sizeof(*tq));
-	if (!tq)
-		return NULL;
-
-	INIT_LIST_HEAD(&tq->q);
-	pthread_mutex_init(&tq->mutex, NULL);
-	pthread_cond_init(&tq->cond, NULL);
-
-	return tq;
-}
-
-void tq_free(struct thread_q *tq)
-{
-	struct tq_ent *ent, *iter;
-
-	if (!tq)
-		return;
-
-	list_for_each_entry_safe(ent, iter, &tq->q, q_node, struct tq_ent) {
-		list_del(&ent->q_node);
-		free(ent);
-	}
-
-	pthread_cond_destroy(&tq->cond);
-	pthread_mutex_destroy(&tq->mutex);
-
-	memset(tq, 0, sizeof(*tq));	/* poison */
-	free(tq);
-}
-
-static void tq_freezethaw(struct thread_q *tq, bool frozen)
-{
-	pthread_mutex_lock(&tq->mutex);
-
-	tq->frozen = frozen;
-
-	pthread_cond_signal(&tq->cond);
-	pthread_mutex_unlock(&tq->mutex);
-}
-
-void tq_freeze(struct thread_q *tq)
-{
-	tq_freezethaw(tq, true);
-}
-
-void tq_thaw(struct thread_q *tq)
-{
-	tq_freezethaw(tq, false);
-}
-
-bool tq_push(struct thread_q *tq, void *data)
-{
-	struct tq_ent *ent;
-	bool rc = true;
-
-	ent = (struct tq_ent*) calloc(1, sizeof(*ent));
-	if (!ent)
-		return false;
-
-	ent->data = data;
-	INIT_LIST_HEAD(&ent->q_node);
-
-	pthread_mutex_lock(&tq->mutex);
-
-	if (!tq->frozen) {
-		list_add_tail(&ent->q_node, &tq->q);
-	} else {
-		free(ent);
-		rc = false;
-	}
-
-	pthread_cond_signal(&tq->cond);
-	pthread_mutex_unlock(&tq->mutex);
-
-	return rc;
-}
-
-void *tq_pop(struct thread_q *tq, const struct timespec *abstime)
-{
-	struct tq_ent *ent;
-	void *rval = NULL;
-	int rc;
-
-	pthread_mutex_lock(&tq->mutex);
-
-	if (!list_empty(&tq->q))
-		goto pop;
-
-	if (abstime)
-		rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
-	else
-		rc = pthread_cond_wait(&tq->cond, &tq->mutex);
-	if (rc)
-		goto out;
-	if (list_empty(&tq->q))
-		goto out;
-
-pop:
-	ent = list_entry(tq->q.next, struct tq_ent, q_node);
- 	rval = ent->data;
-
-	list_del(&ent->q_node);
-	free(ent);
-
-out:
-	pthread_mutex_unlock(&tq->mutex);
-	return rval;
-}
-
 /* sprintf can be used in applog */
 static char* format_hash(char* buf, uint8_t *hash)
 {
@@ -0,0 +1,167 @@
+/*
+ * Published stratum work, see work-snap.h.
+ *
+ * Readers announce the epoch they started in, then load the current
+ * snapshot. A writer swaps in the new snapshot, then bumps the epoch and
+ * tags the old one with the epoch it was replaced at. A reader that
+ * announced a later epoch loaded the pointer after the swap, so the old
+ * snapshot is freed as soon as every active reader is past its tag.
+ *
+ * Snapshots published by the stratum thread keep a copy of the job, taken
+ * under the job's work_lock, for threads building their own headers.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mm_malloc.h>
+#include "work-snap.h"
+
+struct snap_reader
+{
+   uint64_t epoch;        // 0 while outside acquire/release
+} __attribute__ ((aligned (64)));
+
+static struct work_snap *snap_cur = NULL;
+static uint64_t snap_seq = 0;
+static uint64_t snap_epoch = 1;
+static struct snap_reader *snap_readers = NULL;
+static int snap_nreaders = 0;
+// writer side only
+static struct work_snap *snap_retired = NULL;
+
+bool work_snap_init( int readers )
+{
+   snap_readers = (struct snap_reader*)
+                  _mm_malloc( readers * sizeof *snap_readers, 64 );
+   if ( !snap_readers )
+      return false;
+   memset( snap_readers, 0, readers * sizeof *snap_readers );
+   snap_nreaders = readers;
+   return true;
+}
+
+const struct work_snap *work_snap_acquire( int id )
+{
+   struct snap_reader *r = &snap_readers[id];
+
+   __atomic_store_n( &r->epoch, __atomic_load_n( &snap_epoch, __ATOMIC_ACQUIRE ),
+                     __ATOMIC_SEQ_CST );
+   return __atomic_load_n( &snap_cur, __ATOMIC_SEQ_CST );
+}
+
+void work_snap_release( int id )
+{
+   __atomic_store_n( &snap_readers[id].epoch, 0, __ATOMIC_RELEASE );
+}
+
+uint64_t work_snap_seq()
+{
+   return __atomic_load_n( &snap_seq, __ATOMIC_ACQUIRE );
+}
+
+void work_snap_copy_job( struct stratum_ctx *dst, const struct stratum_ctx *src )
+{
+   const struct stratum_job *sj = &src->job;
+   struct stratum_job *dj = &dst->job;
+
+   *dj = *sj;
+   dj->merkle_max = sj->merkle_count;
+   dj->job_id = sj->job_id ? strdup( sj->job_id ) : NULL;
+   dj->coinbase = (unsigned char*) malloc( sj->coinbase_size );
+   memcpy( dj->coinbase, sj->coinbase, sj->coinbase_size );
+   dj->xnonce2 = dj->coinbase + ( sj->xnonce2 - sj->coinbase );
+   dj->merkle = (unsigned char**) malloc( sj->merkle_count * sizeof(char*)
+                                           + sj->merkle_count * 32 );
+   for ( int i = 0; i < sj->merkle_count; i++ )
+   {
+      // branches live right behind the pointer array, one allocation
+      dj->merkle[i] = (unsigned char*)( dj->merkle + sj->merkle_count ) + i * 32;
+      memcpy( dj->merkle[i], sj->merkle[i], 32 );
+   }
+
+   dst->xnonce1_size = src->xnonce1_size;
+   dst->xnonce1 = (unsigned char*) malloc( src->xnonce1_size );
+   memcpy( dst->xnonce1, src->xnonce1, src->xnonce1_size );
+   dst->xnonce2_size = src->xnonce2_size;
+   dst->bloc_height = src->bloc_height;
+}
+
+void work_snap_free_job( struct stratum_ctx *sctx )
+{
+   free( sctx->job.job_id );
+   free( sctx->job.coinbase );
+   free( sctx->job.merkle );
+   free( sctx->xnonce1 );
+   sctx->job.job_id = NULL;
+   sctx->job.coinbase = sctx->job.xnonce2 = NULL;
+   sctx->job.merkle = NULL;
+   sctx->xnonce1 = NULL;
+}
+
+// Free the retired snapshots no reader can see any more.
+static void snap_reclaim()
+{
+   uint64_t oldest = UINT64_MAX;
+   struct work_snap **pp = &snap_retired;
+
+   for ( int i = 0; i < snap_nreaders; i++ )
+   {
+      uint64_t e = __atomic_load_n( &snap_readers[i].epoch, __ATOMIC_SEQ_CST );
+      if ( e && e < oldest )
+         oldest = e;
+   }
+
+   while ( *pp )
+   {
+      struct work_snap *s = *pp;
+      if ( s->retired < oldest )
+      {
+         *pp = s->next;
+         work_free( &s->work );
+         if ( s->job )
+         {
+            work_snap_free_job( s->job );
+            free( s->job );
+         }
+         free( s );
+      }
+      else
+         pp = &s->next;
+   }
+}
+
+void work_snap_publish( const struct work *w, struct stratum_ctx *sctx )
+{
+   struct work_snap *s, *old;
+
+   s = (struct work_snap*) malloc( sizeof *s );
+   if ( !s )
+      return;
+   work_copy( &s->work, w );
+   s->job = NULL;
+   if ( sctx )
+   {
+      pthread_mutex_lock( &sctx->work_lock );
+      if ( sctx->job.job_id && sctx->job.coinbase
+           && ( s->job = (struct stratum_ctx*) calloc( 1, sizeof *s->job ) ) )
+         work_snap_copy_job( s->job, sctx );
+      pthread_mutex_unlock( &sctx->work_lock );
+   }
+   s->seq = snap_seq + 1;
+   s->next = NULL;
+
+   old = __atomic_exchange_n( &snap_cur, s, __ATOMIC_SEQ_CST );
+   __atomic_store_n( &snap_seq, s->seq, __ATOMIC_RELEASE );
+   if ( old )
+   {
+      old->retired = __atomic_fetch_add( &snap_epoch, 1, __ATOMIC_SEQ_CST );
+      old->next = snap_retired;
+      snap_retired = old;
+   }
+   snap_reclaim();
+}
@@ -0,0 +1,62 @@
+#ifndef WORK_SNAP_H__
+#define WORK_SNAP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "miner.h"
+
+// Published stratum work.
+//
+// Writers build the work as before, in g_work under g_work_lock, and then
+// publish an immutable copy. Miner threads read the current copy without
+// taking any lock: acquire is one store and one atomic load, release one
+// store. A replaced copy is freed by a later publish once no reader can
+// still be using it, epoch based, so readers never wait for writers.
+//
+// A snapshot also carries the stratum job it was built from, so a miner
+// thread can build headers of its own from it, see struct work_builder.
+
+struct work_snap
+{
+   struct work work;
+   struct stratum_ctx *job;   // job fields only, NULL if published without
+   uint64_t    seq;       // 1 for the first work published, then +1
+   uint64_t    retired;   // epoch at which it was replaced
+   struct work_snap *next;
+};
+
+// Room for reader ids 0..readers-1, call before any thread uses it.
+bool work_snap_init( int readers );
+
+// Copy w, and the current job of sctx unless NULL, into a new snapshot
+// and make it current. Writers must be serialised, g_work_lock does that.
+void work_snap_publish( const struct work *w, struct stratum_ctx *sctx );
+
+// Sequence number of the current snapshot, 0 if none yet.
+uint64_t work_snap_seq();
+
+// Current snapshot or NULL, valid until work_snap_release( id ).
+const struct work_snap *work_snap_acquire( int id );
+void work_snap_release( int id );
+
+// Deep copy of the job fields of src: job, xnonce1, extranonce sizes and
+// block height, all that gen_merkle_root and build_extraheader look at.
+void work_snap_copy_job( struct stratum_ctx *dst, const struct stratum_ctx *src );
+void work_snap_free_job( struct stratum_ctx *sctx );
+
+// A miner thread's private copy of the job. The top extranonce2 byte is
+// owner, so each thread rolls headers in its own extranonce2 range without
+// touching the shared job or any lock. Owner 0 is left to the shared
+// counter of stratum_gen_work, which wraps inside it. Jobs with less than
+// 3 extranonce2 bytes are not split.
+struct work_builder
+{
+   struct stratum_ctx sctx;
+   uint8_t owner;
+};
+
+bool work_builder_load( struct work_builder *b, const struct work_snap *snap,
+                        uint8_t owner );
+void work_builder_next( struct work_builder *b, struct work *work );
+
+#endif